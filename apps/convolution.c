@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <cNNFW.h>
+
+#define SIGNAL_LEN 256
+#define NUM_OF_SIGNALS 2000
+
+/* Creates the same task twice: a 1D signal of SIGNAL_LEN samples classified into
+two classes. The first Neural Network is built from dense layers only, the second
+one from convolutions and pooling. Prints the number of parameters and the
+inference time of both */
+static double measure(N_NET NNetwork, const double *inputs, double *outputs) {
+    clock_t start = clock();
+    if (CNNFW_CalculateBatch(NNetwork, inputs, NUM_OF_SIGNALS, outputs)) {
+        printf("Error of calculation\n");
+        return 0.0;
+    }
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(void) {
+    N_NET dense = NULL, conv = NULL;
+    size_t i, j, params;
+    double *inputs = NULL, *outputs = NULL, t;
+
+    /* Dense: 256 inputs, two hidden layers of 128 and 32 neurons, two outputs */
+    CONFIG config[] = { SIGNAL_LEN, 128, 32, 2 };
+
+    /* Convolutional: 8 filters with the window of 9 samples, max pooling by 4,
+    8 filters with the window of 5 samples, max pooling by 4, two outputs */
+    INPUT_SHAPE shape = { 1, 1, SIGNAL_LEN };
+    LAYER_CONFIG layers[] = {
+        { LAYER_CONV,     8, 0, 9, 0, 1, 0, 4 },
+        { LAYER_MAX_POOL, 0, 0, 4, 0, 4, 0, 0 },
+        { LAYER_CONV,     8, 0, 5, 0, 1, 0, 2 },
+        { LAYER_MAX_POOL, 0, 0, 4, 0, 4, 0, 0 },
+        { LAYER_DENSE,    2 }
+    };
+
+    srand((unsigned int)time(NULL));
+
+    if (CNNFW_Create(&dense, config, 0) || CNNFW_CreateEx(&conv, &shape, layers, 0)) {
+        printf("Error of Neural Network creating\n");
+        return 1;
+    }
+
+    inputs = (double *)malloc(sizeof(double) * NUM_OF_SIGNALS * SIGNAL_LEN);
+    outputs = (double *)malloc(sizeof(double) * NUM_OF_SIGNALS * 2);
+    if (NULL == inputs || NULL == outputs) {
+        printf("Unsuccessful memory allocation\n");
+        return 1;
+    }
+    for (i = 0; i < NUM_OF_SIGNALS; i++)
+        for (j = 0; j < SIGNAL_LEN; j++)
+            inputs[i * SIGNAL_LEN + j] = (double)(rand() % 2001 - 1000) / 1000.0;
+
+    CNNFW_GetParametersCount(dense, &params);
+    t = measure(dense, inputs, outputs);
+    printf("Dense:         %6lu parameters, %8.3f ms for %d signals\n", (unsigned long)params, t * 1e3, NUM_OF_SIGNALS);
+
+    CNNFW_GetParametersCount(conv, &params);
+    t = measure(conv, inputs, outputs);
+    printf("Convolutional: %6lu parameters, %8.3f ms for %d signals\n", (unsigned long)params, t * 1e3, NUM_OF_SIGNALS);
+
+    CNNFW_Free(&dense);
+    CNNFW_Free(&conv);
+    free(inputs);
+    free(outputs);
+
+    return 0;
+}
@@ -66,13 +66,9 @@ int main(int argc, char *argv[]) {
 
         /* Writing data for training to an Neural Network */
         printf("Writting data\n");
-        for (row = 0; row < NUM_OF_DATA_ROWS; row++) {
-            for (col = 0; col < NUM_OF_DATA_COLS; col++) {
-                if (CNNFW_SetValueInData(NNetwork, row, col, d[row][col])) {
-                    printf("Error of setting data\n");
-                    return 1;
-                }
-            }
+        if (CNNFW_SetDataRows(NNetwork, 0, NUM_OF_DATA_ROWS, &d[0][0])) {
+            printf("Error of setting data\n");
+            return 1;
         }
 
         /* Checking the values of the written data */
@@ -106,7 +102,8 @@ int main(int argc, char *argv[]) {
     /* Testing */
     quit = 0;
     while (1) {
-        double out[NUM_OF_OUTPUTS] = { 0.0 };       /* We will save the values of the outputs here */
+        const double *out = NULL;                   /* The values of the outputs will be available here */
+        size_t outLen = 0;
         double newInputs[NUM_OF_INPUTS] = { 0.0 };  /* Here we will write the new values of the inputs */
 
         printf("Your inputs (input < 0 or input > 1 to quit)\n");
@@ -132,9 +129,12 @@ int main(int argc, char *argv[]) {
 
         printf("\n____|XOR|AND| OR|~XOR|~AND|~OR|\n");
 
-        /* We get the values of the outputs */
-        for (i = 0; i < NUM_OF_OUTPUTS; i++)
-            CNNFW_GetOutput(NNetwork, i, &out[i]);
+        /* We get the values of the outputs after every calculation, with the lazy outputs
+        the values taken before it are not updated */
+        if (CNNFW_GetOutputs(NNetwork, &out, &outLen) || NUM_OF_OUTPUTS != outLen) {
+            printf("Error of reading the outputs\n");
+            break;
+        }
 
         printf("%d %d | %d | %d | %d |  %d |  %d | %d |\n\n",
             (int)newInputs[0],
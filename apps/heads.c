@@ -0,0 +1,125 @@
+/* Measures a Neural Network with many outputs (heads) of which only a few are needed for
+a request. The same rows are calculated one by one with all the outputs and with the lazy
+outputs, which calculate only the outputs taken by CNNFW_GetOutput, and at once by
+CNNFW_CalculateBatch and by CNNFW_CalculateBatchMasked with a mask of the needed heads.
+
+Usage: heads [-o outputs] [-q queried_outputs] [-n rows] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <cNNFW.h>
+
+#define DEFAULT_OUTPUTS 512
+#define DEFAULT_QUERIED 2
+#define DEFAULT_ROWS 2000
+
+#define NUM_OF_INPUTS 64
+#define NUM_OF_NEURONS 256
+
+/* Calculates the rows one by one and takes the queried outputs of every row */
+static int single(N_NET NNetwork, double *inputs, size_t rows, const size_t *queried, size_t count, double *outputs) {
+    size_t i, j;
+
+    for (i = 0; i < rows; i++) {
+        if (set_inputs(NNetwork, inputs + i * NUM_OF_INPUTS, NUM_OF_INPUTS) || CNNFW_Calculate(NNetwork))
+            return 1;
+        for (j = 0; j < count; j++)
+            if (CNNFW_GetOutput(NNetwork, queried[j], &outputs[i * count + j]))
+                return 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    size_t heads = DEFAULT_OUTPUTS, count = DEFAULT_QUERIED, rows = DEFAULT_ROWS, i, j;
+    size_t *queried = NULL;
+    unsigned char *mask = NULL;
+    double start, eagerTime, lazyTime, diff, maxDiff = 0.0;
+    double *inputs = NULL, *all = NULL, *eager = NULL, *lazy = NULL;
+    N_NET NNetwork = NULL;
+    CONFIG config[] = { NUM_OF_INPUTS, NUM_OF_NEURONS, NUM_OF_NEURONS, 0 };
+
+    for (i = 1; i + 1 < (size_t)argc; i += 2) {
+        if (0 == strcmp(argv[i], "-o")) heads = (size_t)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-q")) count = (size_t)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-n")) rows = (size_t)atoi(argv[i + 1]);
+        else break;
+    }
+    if (i != (size_t)argc || 0 == heads || 0 == count || count > heads || 0 == rows) {
+        printf("Usage: %s [-o outputs] [-q queried_outputs (up to outputs)] [-n rows]\n", argv[0]);
+        return 1;
+    }
+
+    queried = (size_t *)malloc(sizeof(size_t) * count);
+    mask = (unsigned char *)calloc(heads, 1);
+    inputs = (double *)malloc(sizeof(double) * rows * NUM_OF_INPUTS);
+    all = (double *)malloc(sizeof(double) * rows * heads);
+    eager = (double *)malloc(sizeof(double) * rows * count);
+    lazy = (double *)malloc(sizeof(double) * rows * count);
+    if (NULL == queried || NULL == mask || NULL == inputs || NULL == all || NULL == eager || NULL == lazy) {
+        printf("Unsuccessful memory allocation\n");
+        return 1;
+    }
+
+    srand((unsigned int)time(NULL));
+    for (i = 0; i < rows * NUM_OF_INPUTS; i++)
+        inputs[i] = (double)(rand() % 1001) / 1000.0;
+    /* The queried heads are spread over the outputs in ascending order, as the masked batch stores them */
+    for (j = 0; j < count; j++) {
+        queried[j] = j * heads / count;
+        mask[queried[j]] = 1;
+    }
+
+    config[3] = (CONFIG)heads;
+    if (CNNFW_Create(&NNetwork, config, 0)) {
+        printf("Error of Neural Network creating\n");
+        return 1;
+    }
+    printf("%lu outputs, %lu of them are taken, %lu rows\n", (unsigned long)heads, (unsigned long)count, (unsigned long)rows);
+
+    start = CNNFW_GetTime();
+    if (single(NNetwork, inputs, rows, queried, count, eager)) return 1;
+    eagerTime = CNNFW_GetTime() - start;
+    CNNFW_SetLazyOutputs(NNetwork, ENABLE);
+    start = CNNFW_GetTime();
+    if (single(NNetwork, inputs, rows, queried, count, lazy)) return 1;
+    lazyTime = CNNFW_GetTime() - start;
+    CNNFW_SetLazyOutputs(NNetwork, DISABLE);
+    for (i = 0; i < rows * count; i++) {
+        diff = fabs(eager[i] - lazy[i]);
+        if (diff > maxDiff) maxDiff = diff;
+    }
+    printf("  single: all %9.0f rows/s, lazy   %9.0f rows/s, max difference %g\n",
+        rows / eagerTime, rows / lazyTime, maxDiff);
+
+    start = CNNFW_GetTime();
+    if (CNNFW_CalculateBatch(NNetwork, inputs, rows, all)) return 1;
+    eagerTime = CNNFW_GetTime() - start;
+    start = CNNFW_GetTime();
+    if (CNNFW_CalculateBatchMasked(NNetwork, inputs, rows, mask, lazy)) return 1;
+    lazyTime = CNNFW_GetTime() - start;
+    maxDiff = 0.0;
+    for (i = 0; i < rows; i++) {
+        for (j = 0; j < count; j++) {
+            diff = fabs(all[i * heads + queried[j]] - lazy[i * count + j]);
+            if (diff > maxDiff) maxDiff = diff;
+        }
+    }
+    printf("  batch:  all %9.0f rows/s, masked %9.0f rows/s, max difference %g\n",
+        rows / eagerTime, rows / lazyTime, maxDiff);
+
+    CNNFW_Free(&NNetwork);
+    free(queried);
+    free(mask);
+    free(inputs);
+    free(all);
+    free(eager);
+    free(lazy);
+
+    return 0;
+}
@@ -0,0 +1,161 @@
+/* Compares the asynchronous lock-free training (CNNFW_TrainAsync) with the
+synchronous full-batch gradient descent (CNNFW_Train with BACKPROPAGATION).
+
+First both train the logical functions of apps/example.c and the final losses and
+outputs are printed. Then the throughput in rows per second is measured on a
+larger sparse data set with 1, 2, 4 ... threads up to the given number.
+
+Usage: hogwild [-t max_threads] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <cNNFW.h>
+
+#define DEFAULT_THREADS 4
+
+#define EXAMPLE_EPOCHS 20000
+
+#define NUM_OF_INPUTS 256
+#define NUM_OF_OUTPUTS 4
+#define NUM_OF_DATA_ROWS 8192
+#define NUM_OF_DATA_COLS (NUM_OF_INPUTS + NUM_OF_OUTPUTS)
+#define NON_ZERO_PERCENT 5
+#define BENCHMARK_EPOCHS 5
+
+static double loss(N_NET NNetwork, const double *data, size_t rows, size_t inputs, size_t outputs, double *buffer) {
+    size_t row, out;
+    double diff, result = 0.0;
+
+    for (row = 0; row < rows; row++) {
+        CNNFW_CalculateBatch(NNetwork, data + row * (inputs + outputs), 1, buffer);
+        for (out = 0; out < outputs; out++) {
+            diff = buffer[out] - data[row * (inputs + outputs) + inputs + out];
+            result += diff * diff;
+        }
+    }
+
+    return result / rows;
+}
+
+static int convergence(size_t threads) {
+    size_t i, row, out;
+    double outputs[6];
+    N_NET Sync = NULL, Async = NULL;
+
+    /* XOR, AND, OR, ~XOR, ~AND, ~OR of two inputs */
+    double d[4][8] = {
+        {0.0, 0.0,   0.0, 0.0, 0.0, 1.0, 1.0, 1.0},
+        {0.0, 1.0,   1.0, 0.0, 1.0, 0.0, 1.0, 0.0},
+        {1.0, 0.0,   1.0, 0.0, 1.0, 0.0, 1.0, 0.0},
+        {1.0, 1.0,   0.0, 1.0, 1.0, 1.0, 0.0, 0.0}
+    };
+    CONFIG config[] = { 2, 3, 6 };
+
+    if (CNNFW_Create(&Sync, config, 4) || CNNFW_SetDataRows(Sync, 0, 4, &d[0][0]) || CNNFW_Clone(&Async, Sync)) {
+        printf("Error of Neural Network creating\n");
+        return 1;
+    }
+    CNNFW_SetTrainingMethod(Sync, BACKPROPAGATION);
+    CNNFW_SetEpsilonAndLearningStep(Sync, 0.01, 0.5);
+    CNNFW_SetEpsilonAndLearningStep(Async, 0.01, 0.1);
+
+    printf("The logical functions, %d epochs, initial loss %f\n", EXAMPLE_EPOCHS, loss(Sync, &d[0][0], 4, 2, 6, outputs));
+    for (i = 0; i < EXAMPLE_EPOCHS; i++)
+        CNNFW_Train(Sync);
+    if (CNNFW_TrainAsync(Async, threads, EXAMPLE_EPOCHS)) return 1;
+    printf("  synchronous:          loss %f\n", loss(Sync, &d[0][0], 4, 2, 6, outputs));
+    printf("  asynchronous, %2lu thr: loss %f\n", (unsigned long)threads, loss(Async, &d[0][0], 4, 2, 6, outputs));
+
+    printf("  inputs | XOR   AND   OR    ~XOR  ~AND  ~OR   (asynchronous)\n");
+    for (row = 0; row < 4; row++) {
+        CNNFW_CalculateBatch(Async, d[row], 1, outputs);
+        printf("  %.0f %.0f    |", d[row][0], d[row][1]);
+        for (out = 0; out < 6; out++)
+            printf(" %.3f", outputs[out]);
+        printf("\n");
+    }
+
+    CNNFW_Free(&Sync);
+    CNNFW_Free(&Async);
+
+    return 0;
+}
+
+static int throughput(size_t maxThreads) {
+    size_t i, j, threads;
+    double start, elapsed, outputs[NUM_OF_OUTPUTS];
+    double *data = NULL;
+    N_NET Initial = NULL, NNetwork = NULL;
+    CONFIG config[] = { NUM_OF_INPUTS, 64, NUM_OF_OUTPUTS };
+
+    data = (double *)calloc(NUM_OF_DATA_ROWS * NUM_OF_DATA_COLS, sizeof(double));
+    if (NULL == data) {
+        printf("Unsuccessful memory allocation\n");
+        return 1;
+    }
+    for (i = 0; i < NUM_OF_DATA_ROWS; i++) {
+        for (j = 0; j < NUM_OF_INPUTS; j++)
+            if (rand() % 100 < NON_ZERO_PERCENT)
+                data[i * NUM_OF_DATA_COLS + j] = (double)(rand() % 1001) / 1000.0;
+        for (j = 0; j < NUM_OF_OUTPUTS; j++)
+            data[i * NUM_OF_DATA_COLS + NUM_OF_INPUTS + j] = (double)(rand() % 2);
+    }
+
+    if (CNNFW_Create(&Initial, config, NUM_OF_DATA_ROWS) || CNNFW_SetDataRows(Initial, 0, NUM_OF_DATA_ROWS, data)) {
+        printf("Error of Neural Network creating\n");
+        return 1;
+    }
+    CNNFW_SetEpsilonAndLearningStep(Initial, 0.01, 0.01);
+
+    printf("\n%d rows, %d inputs with %d%% non-zero, %d epochs\n", NUM_OF_DATA_ROWS, NUM_OF_INPUTS, NON_ZERO_PERCENT, BENCHMARK_EPOCHS);
+
+    CNNFW_Clone(&NNetwork, Initial);
+    CNNFW_SetTrainingMethod(NNetwork, BACKPROPAGATION);
+    start = CNNFW_GetTime();
+    for (i = 0; i < BENCHMARK_EPOCHS; i++)
+        CNNFW_Train(NNetwork);
+    elapsed = CNNFW_GetTime() - start;
+    printf("  synchronous:          %10.0f rows/s, loss %f\n",
+        NUM_OF_DATA_ROWS * BENCHMARK_EPOCHS / elapsed, loss(NNetwork, data, NUM_OF_DATA_ROWS, NUM_OF_INPUTS, NUM_OF_OUTPUTS, outputs));
+    CNNFW_Free(&NNetwork);
+
+    for (threads = 1; threads <= maxThreads; threads *= 2) {
+        CNNFW_Clone(&NNetwork, Initial);
+        start = CNNFW_GetTime();
+        if (CNNFW_TrainAsync(NNetwork, threads, BENCHMARK_EPOCHS)) return 1;
+        elapsed = CNNFW_GetTime() - start;
+        printf("  asynchronous, %2lu thr: %10.0f rows/s, loss %f\n", (unsigned long)threads,
+            NUM_OF_DATA_ROWS * BENCHMARK_EPOCHS / elapsed, loss(NNetwork, data, NUM_OF_DATA_ROWS, NUM_OF_INPUTS, NUM_OF_OUTPUTS, outputs));
+        CNNFW_Free(&NNetwork);
+    }
+
+    CNNFW_Free(&Initial);
+    free(data);
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    size_t threads = DEFAULT_THREADS;
+
+    if (3 == argc && 0 == strcmp(argv[1], "-t")) {
+        threads = (size_t)atoi(argv[2]);
+    } else if (1 != argc) {
+        printf("Usage: %s [-t max_threads]\n", argv[0]);
+        return 1;
+    }
+    if (0 == threads) {
+        printf("The number of threads must be at least 1\n");
+        return 1;
+    }
+
+    srand((unsigned int)time(NULL));
+
+    if (convergence(threads) || throughput(threads))
+        return 1;
+
+    return 0;
+}
@@ -0,0 +1,238 @@
+/* Measures the latency of the inference while the Neural Network is being replaced.
+Several readers calculate one set of inputs after another for the given time, each
+calculation is timed. They run three times: without reloads, with reloads which stop
+the readers (a read-write lock, every reader's copy is freed and loaded again) and with
+reloads of a model object (CNNFW_ReloadModel), which the readers never wait for.
+
+Usage: hotswap [-r readers] [-d seconds] [-i reload_interval_ms] [-f file] */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cNNFW.h>
+
+#ifdef _WIN32
+
+int main(void) {
+    printf("The benchmark of the model reloads is supported only on POSIX systems\n");
+    return 1;
+}
+
+#else
+
+#include <time.h>
+#include <pthread.h>
+
+#define DEFAULT_READERS 2
+#define DEFAULT_SECONDS 2
+#define DEFAULT_INTERVAL_MS 50
+#define DEFAULT_FILE "hotswap.bin"
+#define MAX_SAMPLES (1 << 20)
+
+typedef enum {
+    MODE_NONE, MODE_LOCKED, MODE_SWAP
+} MODE;
+
+typedef struct {
+    size_t index;
+    size_t count;
+    double *samples;
+    pthread_t thread;
+} READER;
+
+static MODE Mode;
+static volatile int Stop = 0;
+static const char *FileName = DEFAULT_FILE;
+static size_t NumOfInputs = 0;
+static size_t NumOfOutputs = 0;
+static size_t NumOfReaders = DEFAULT_READERS;
+static N_NET *Copies = NULL;
+static MODEL Model = NULL;
+static pthread_rwlock_t Lock;
+
+static void wait_ms(unsigned int ms) {
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+}
+
+static int compare(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void *reader(void *arg) {
+    READER *r = (READER *)arg;
+    double *inputs, *outputs, start;
+    size_t i;
+
+    inputs = (double *)malloc(sizeof(double) * NumOfInputs);
+    outputs = (double *)malloc(sizeof(double) * NumOfOutputs);
+    if (NULL == inputs || NULL == outputs) {
+        printf("Unsuccessful memory allocation\n");
+        exit(1);
+    }
+    for (i = 0; i < NumOfInputs; i++)
+        inputs[i] = (double)(i % 10) / 10.0;
+
+    while (!Stop && r->count < MAX_SAMPLES) {
+        start = CNNFW_GetTime();
+        if (MODE_SWAP == Mode) {
+            CNNFW_ModelCalculate(Model, r->index, inputs, 1, outputs);
+        } else {
+            pthread_rwlock_rdlock(&Lock);
+            CNNFW_CalculateBatch(Copies[r->index], inputs, 1, outputs);
+            pthread_rwlock_unlock(&Lock);
+        }
+        r->samples[r->count++] = CNNFW_GetTime() - start;
+    }
+
+    free(inputs);
+    free(outputs);
+
+    return NULL;
+}
+
+/* Reloads the Neural Network in the chosen way, returns the number of the reloads */
+static unsigned long reload(unsigned int interval) {
+    unsigned long reloads = 0;
+    size_t i;
+
+    while (!Stop) {
+        wait_ms(interval);
+        if (Stop) break;
+        if (MODE_SWAP == Mode) {
+            if (CNNFW_ReloadModel(Model, FileName)) exit(1);
+        } else if (MODE_LOCKED == Mode) {
+            pthread_rwlock_wrlock(&Lock);
+            for (i = 0; i < NumOfReaders; i++) {
+                CNNFW_Free(&Copies[i]);
+                if (CNNFW_LoadFromFile(&Copies[i], FileName)) exit(1);
+            }
+            pthread_rwlock_unlock(&Lock);
+        } else {
+            continue;
+        }
+        reloads++;
+    }
+
+    return reloads;
+}
+
+static void *stopper(void *arg) {
+    wait_ms(*(unsigned int *)arg);
+    Stop = 1;
+    return NULL;
+}
+
+static void measure(const char *name, READER *readers, unsigned int seconds, unsigned int interval) {
+    size_t i, total = 0;
+    unsigned long reloads;
+    unsigned int ms = seconds * 1000;
+    double *all;
+    pthread_t timer;
+
+    Stop = 0;
+    for (i = 0; i < NumOfReaders; i++) {
+        readers[i].count = 0;
+        pthread_create(&readers[i].thread, NULL, reader, &readers[i]);
+    }
+    pthread_create(&timer, NULL, stopper, &ms);
+    reloads = reload(interval);
+    pthread_join(timer, NULL);
+    for (i = 0; i < NumOfReaders; i++) {
+        pthread_join(readers[i].thread, NULL);
+        total += readers[i].count;
+    }
+
+    all = (double *)malloc(sizeof(double) * (total + 1));
+    if (NULL == all) {
+        printf("Unsuccessful memory allocation\n");
+        exit(1);
+    }
+    for (total = 0, i = 0; i < NumOfReaders; i++) {
+        memcpy(all + total, readers[i].samples, sizeof(double) * readers[i].count);
+        total += readers[i].count;
+    }
+    qsort(all, total, sizeof(double), compare);
+    if (0 == total) all[0] = 0.0;
+
+    printf("  %-18s %4lu reloads, %8.0f calc/s, p50 %8.1f us, p99 %8.1f us, p99.9 %9.1f us, max %9.1f us\n",
+        name, reloads, (double)total / seconds, all[total / 2] * 1e6, all[total * 99 / 100] * 1e6,
+        all[total * 999 / 1000] * 1e6, all[(0 < total) ? total - 1 : 0] * 1e6);
+    free(all);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int seconds = DEFAULT_SECONDS, interval = DEFAULT_INTERVAL_MS;
+    size_t i;
+    N_NET NNetwork = NULL;
+    READER *readers = NULL;
+    CONFIG config[] = { 128, 512, 512, 8 };
+
+    for (i = 1; i + 1 < (size_t)argc; i += 2) {
+        if (0 == strcmp(argv[i], "-r")) NumOfReaders = (size_t)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-d")) seconds = (unsigned int)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-i")) interval = (unsigned int)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-f")) FileName = argv[i + 1];
+        else break;
+    }
+    if (i != (size_t)argc || 0 == NumOfReaders || 0 == seconds || 0 == interval) {
+        printf("Usage: %s [-r readers] [-d seconds] [-i reload_interval_ms] [-f file]\n", argv[0]);
+        return 1;
+    }
+
+    srand((unsigned int)time(NULL));
+    /* The mutation stands for the retraining, only a changed Neural Network is saved */
+    if (CNNFW_Create(&NNetwork, config, 0) || CNNFW_Mutation(NNetwork, 1) || CNNFW_SaveToFile(NNetwork, FileName)) {
+        printf("Error of Neural Network creating\n");
+        return 1;
+    }
+    CNNFW_GetInputsAndOutputsCount(NNetwork, &NumOfInputs, &NumOfOutputs);
+
+    readers = (READER *)calloc(NumOfReaders, sizeof(READER));
+    Copies = (N_NET *)calloc(NumOfReaders, sizeof(N_NET));
+    if (NULL == readers || NULL == Copies) {
+        printf("Unsuccessful memory allocation\n");
+        return 1;
+    }
+    for (i = 0; i < NumOfReaders; i++) {
+        readers[i].index = i;
+        readers[i].samples = (double *)malloc(sizeof(double) * MAX_SAMPLES);
+        if (NULL == readers[i].samples || CNNFW_LoadFromFile(&Copies[i], FileName)) {
+            printf("Error of the reader initialization\n");
+            return 1;
+        }
+    }
+    if (CNNFW_CreateModel(&Model, &NNetwork, NumOfReaders)) {
+        printf("Error of the model creating\n");
+        return 1;
+    }
+    pthread_rwlock_init(&Lock, NULL);
+
+    printf("%lu readers, a reload every %u ms, %u s each\n", (unsigned long)NumOfReaders, interval, seconds);
+    Mode = MODE_NONE;
+    measure("no reloads", readers, seconds, interval);
+    Mode = MODE_LOCKED;
+    measure("stopping readers", readers, seconds, interval);
+    Mode = MODE_SWAP;
+    measure("model object", readers, seconds, interval);
+
+    pthread_rwlock_destroy(&Lock);
+    CNNFW_FreeModel(&Model);
+    for (i = 0; i < NumOfReaders; i++) {
+        CNNFW_Free(&Copies[i]);
+        free(readers[i].samples);
+    }
+    free(Copies);
+    free(readers);
+    remove(FileName);
+
+    return 0;
+}
+
+#endif
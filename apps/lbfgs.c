@@ -0,0 +1,93 @@
+/* Trains the Neural Network of the example (six logical functions of two inputs) by the
+gradient descent with the learning step and by LBFGS from the same weights, until the
+loss falls below the target or the limit of the epochs or the iterations is reached.
+LBFGS also stops when it converges, which may be a local minimum above the target, or
+when it stalls (no step along the gradient decreases the loss).
+
+Usage: lbfgs [-e max_epochs] [-i max_iterations] [-m history] [-s step] [-l target_loss] [-r seed] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <cNNFW.h>
+
+#define DEFAULT_EPOCHS 100000
+#define DEFAULT_ITERATIONS 1000
+#define DEFAULT_HISTORY 8
+#define DEFAULT_STEP 0.5
+#define DEFAULT_TARGET 0.001
+
+#define NUM_OF_INPUTS 2
+#define NUM_OF_NEURONS_IN_LAYERS 3
+#define NUM_OF_OUTPUTS 6
+
+#define NUM_OF_DATA_ROWS 4
+#define NUM_OF_DATA_COLS (NUM_OF_INPUTS + NUM_OF_OUTPUTS)
+
+int main(int argc, char *argv[]) {
+    size_t epochs = DEFAULT_EPOCHS, iterations = DEFAULT_ITERATIONS, history = DEFAULT_HISTORY, i;
+    unsigned int seed = (unsigned int)time(NULL);
+    double step = DEFAULT_STEP, target = DEFAULT_TARGET, start, elapsed, loss;
+    N_NET Initial = NULL, Descent = NULL, Quasi = NULL;
+    LBFGS_STATS stats;
+    double d[NUM_OF_DATA_ROWS][NUM_OF_DATA_COLS] = {
+        {0.0, 0.0,   0.0, 0.0, 0.0, 1.0, 1.0, 1.0},
+        {0.0, 1.0,   1.0, 0.0, 1.0, 0.0, 1.0, 0.0},
+        {1.0, 0.0,   1.0, 0.0, 1.0, 0.0, 1.0, 0.0},
+        {1.0, 1.0,   0.0, 1.0, 1.0, 1.0, 0.0, 0.0}
+    };
+    CONFIG config[] = { NUM_OF_INPUTS, NUM_OF_NEURONS_IN_LAYERS, NUM_OF_OUTPUTS };
+
+    for (i = 1; i + 1 < (size_t)argc; i += 2) {
+        if (0 == strcmp(argv[i], "-e")) epochs = (size_t)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-i")) iterations = (size_t)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-m")) history = (size_t)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-s")) step = atof(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-l")) target = atof(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-r")) seed = (unsigned int)atoi(argv[i + 1]);
+        else break;
+    }
+    if (i != (size_t)argc || 0 == epochs || 0 == iterations || 0 == history || 0.0 >= step) {
+        printf("Usage: %s [-e max_epochs] [-i max_iterations] [-m history] [-s step] [-l target_loss] [-r seed]\n", argv[0]);
+        return 1;
+    }
+
+    srand(seed);
+    if (CNNFW_Create(&Initial, config, NUM_OF_DATA_ROWS) || CNNFW_SetDataRows(Initial, 0, NUM_OF_DATA_ROWS, &d[0][0]) ||
+        CNNFW_Clone(&Descent, Initial) || CNNFW_Clone(&Quasi, Initial)) {
+        printf("Error of Neural Network creating\n");
+        return 1;
+    }
+    CNNFW_GetLoss(Initial, &loss);
+    printf("Seed %u, initial loss %f, the target %g\n", seed, loss, target);
+
+    CNNFW_SetTrainingMethod(Descent, BACKPROPAGATION);
+    CNNFW_SetEpsilonAndLearningStep(Descent, 0.01, step);
+    start = CNNFW_GetTime();
+    for (i = 0; i < epochs; i++) {
+        if (CNNFW_Train(Descent) || CNNFW_GetLoss(Descent, &loss)) return 1;
+        if (loss < target) break;
+    }
+    elapsed = CNNFW_GetTime() - start;
+    printf("  gradient descent: %7lu epochs,                       %8.3f s, loss %g\n",
+        (unsigned long)((i < epochs) ? i + 1 : epochs), elapsed, loss);
+
+    if (CNNFW_SetTrainingMethod(Quasi, LBFGS) || CNNFW_SetLBFGSHistory(Quasi, history)) return 1;
+    start = CNNFW_GetTime();
+    for (i = 0; i < iterations; i++) {
+        if (CNNFW_Train(Quasi) || CNNFW_GetLBFGSStats(Quasi, &stats)) return 1;
+        if (stats.loss < target || stats.converged || stats.stalled) break;
+    }
+    elapsed = CNNFW_GetTime() - start;
+    printf("  LBFGS:            %7lu iterations, %6lu evaluations, %8.3f s, loss %g, %lu restarts%s\n",
+        stats.iterations, stats.evaluations, elapsed, stats.loss, stats.restarts,
+        stats.converged ? ", converged" : (stats.stalled ? ", stalled" : ""));
+
+    CNNFW_Free(&Initial);
+    CNNFW_Free(&Descent);
+    CNNFW_Free(&Quasi);
+
+    return 0;
+}
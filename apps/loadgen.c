@@ -0,0 +1,229 @@
+/* A load generator for the inference server. It opens several connections,
+sends random inputs as fast as the server answers and reports the throughput
+and the latency percentiles.
+
+Usage: loadgen [-u socket_path | -p port] [-c connections] [-d duration_s] */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cNNFW.h>
+
+#ifdef _WIN32
+
+int main(void) {
+    printf("The load generator is supported only on POSIX systems\n");
+    return 1;
+}
+
+#else
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_PORT 5555
+#define DEFAULT_CONNECTIONS 8
+#define DEFAULT_DURATION_S 10
+
+/* Latency histogram with 1 microsecond buckets, the last bucket collects everything slower */
+#define HISTOGRAM_LEN 100000
+
+typedef struct {
+    pthread_t thread;
+    unsigned int seed;
+    unsigned long requests;
+    unsigned long errors;
+    unsigned long *histogram;
+} CLIENT;
+
+static const char *SockPath = NULL;
+static unsigned short Port = DEFAULT_PORT;
+static double Duration = DEFAULT_DURATION_S;
+
+static int read_all(int fd, void *buf, size_t len) {
+    char *p = (char *)buf;
+    ssize_t n;
+    while (len > 0) {
+        n = read(fd, p, len);
+        if (n < 0 && EINTR == errno) continue;
+        if (n <= 0) return 1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = (const char *)buf;
+    ssize_t n;
+    while (len > 0) {
+        n = write(fd, p, len);
+        if (n < 0 && EINTR == errno) continue;
+        if (n <= 0) return 1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int connect_to_server(void) {
+    int fd, one = 1;
+
+    if (NULL != SockPath) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, SockPath, sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+            close(fd);
+            fd = -1;
+        }
+    } else {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(Port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+            close(fd);
+            fd = -1;
+        }
+        if (fd >= 0)
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    return fd;
+}
+
+static void *client(void *arg) {
+    CLIENT *cl = (CLIENT *)arg;
+    unsigned int header[2];
+    double *inputs = NULL, *outputs = NULL;
+    double stop, start, latency;
+    size_t i, bucket;
+    int fd;
+
+    fd = connect_to_server();
+    if (fd < 0 || read_all(fd, header, sizeof(header))) {
+        printf("Unsuccessful connection to the server\n");
+        cl->errors++;
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+
+    inputs = (double *)malloc(sizeof(double) * header[0]);
+    outputs = (double *)malloc(sizeof(double) * header[1]);
+    if (NULL == inputs || NULL == outputs) {
+        printf("Unsuccessful memory allocation\n");
+        cl->errors++;
+    } else {
+        stop = CNNFW_GetTime() + Duration;
+        while ((start = CNNFW_GetTime()) < stop) {
+            for (i = 0; i < header[0]; i++)
+                inputs[i] = (double)(rand_r(&cl->seed) % 1001) / 1000.0;
+
+            if (write_all(fd, inputs, sizeof(double) * header[0]) ||
+                read_all(fd, outputs, sizeof(double) * header[1])) {
+                cl->errors++;
+                break;
+            }
+
+            latency = (CNNFW_GetTime() - start) * 1e6;
+            bucket = (size_t)latency;
+            if (bucket >= HISTOGRAM_LEN) bucket = HISTOGRAM_LEN - 1;
+            cl->histogram[bucket]++;
+            cl->requests++;
+        }
+    }
+
+    close(fd);
+    free(inputs);
+    free(outputs);
+
+    return NULL;
+}
+
+static size_t percentile(const unsigned long *histogram, unsigned long total, double p) {
+    unsigned long acc = 0, limit = (unsigned long)(p * (double)total);
+    size_t i;
+    for (i = 0; i < HISTOGRAM_LEN; i++) {
+        acc += histogram[i];
+        if (acc > limit) return i;
+    }
+    return HISTOGRAM_LEN - 1;
+}
+
+int main(int argc, char *argv[]) {
+    size_t connections = DEFAULT_CONNECTIONS, i, j;
+    CLIENT *clients = NULL;
+    unsigned long *histogram = NULL;
+    unsigned long requests = 0, errors = 0;
+    double start, elapsed;
+
+    for (i = 1; i + 1 < (size_t)argc; i += 2) {
+        if (0 == strcmp(argv[i], "-u")) SockPath = argv[i + 1];
+        else if (0 == strcmp(argv[i], "-p")) Port = (unsigned short)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-c")) connections = (size_t)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-d")) Duration = atof(argv[i + 1]);
+        else {
+            printf("Usage: %s [-u socket_path | -p port] [-c connections] [-d duration_s]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (0 == connections) {
+        printf("The number of connections must be at least 1\n");
+        return 1;
+    }
+
+    clients = (CLIENT *)calloc(connections, sizeof(CLIENT));
+    histogram = (unsigned long *)calloc((connections + 1) * HISTOGRAM_LEN, sizeof(unsigned long));
+    if (NULL == clients || NULL == histogram) {
+        printf("Unsuccessful memory allocation\n");
+        return 1;
+    }
+
+    start = CNNFW_GetTime();
+    for (i = 0; i < connections; i++) {
+        clients[i].seed = (unsigned int)i + 1;
+        clients[i].histogram = histogram + (i + 1) * HISTOGRAM_LEN;
+        pthread_create(&clients[i].thread, NULL, client, &clients[i]);
+    }
+    for (i = 0; i < connections; i++) {
+        pthread_join(clients[i].thread, NULL);
+        requests += clients[i].requests;
+        errors += clients[i].errors;
+        for (j = 0; j < HISTOGRAM_LEN; j++)
+            histogram[j] += clients[i].histogram[j];
+    }
+    elapsed = CNNFW_GetTime() - start;
+
+    printf("connections %lu, requests %lu, errors %lu, qps %.0f\n",
+        (unsigned long)connections, requests, errors, (double)requests / elapsed);
+    if (requests > 0) {
+        printf("latency p50 %lu us, p90 %lu us, p99 %lu us, p99.9 %lu us\n",
+            (unsigned long)percentile(histogram, requests, 0.5),
+            (unsigned long)percentile(histogram, requests, 0.9),
+            (unsigned long)percentile(histogram, requests, 0.99),
+            (unsigned long)percentile(histogram, requests, 0.999));
+    }
+
+    free(clients);
+    free(histogram);
+
+    return errors ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,126 @@
+/* Measures the effect of the memory placement on a large Neural Network: the usual
+allocation, transparent and explicit huge pages, the NUMA interleaving and the pinning
+of the threads of the asynchronous training. For each placement the inference of all
+the rows (CNNFW_CalculateBatch, the average of several passes) and one epoch of
+CNNFW_TrainAsync are timed.
+The explicit huge pages must be reserved first, e.g. sysctl vm.nr_hugepages=64
+
+Usage: memory [-t threads] [-w width] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <cNNFW.h>
+
+#define DEFAULT_THREADS 2
+#define DEFAULT_WIDTH 1024
+#define NUM_OF_OUTPUTS 8
+#define NUM_OF_DATA_ROWS 128
+#define INFERENCE_PASSES 8
+
+typedef struct {
+    const char *name;
+    HUGE_PAGES pages;
+    NUMA_POLICY numa;
+    FEATURE_STATE pinning;
+} PLACEMENT;
+
+static int measure(N_NET Initial, const PLACEMENT *place, size_t threads, const double *inputs, double *outputs) {
+    size_t i;
+    double start, inference, training;
+    N_NET NNetwork = NULL;
+
+    if (CNNFW_Clone(&NNetwork, Initial))
+        return 1;
+    if (CNNFW_SetMemoryPolicy(&NNetwork, place->pages, place->numa, 0)) {
+        printf("  %-34s not available\n", place->name);
+        CNNFW_Free(&NNetwork);
+        return 0;
+    }
+    CNNFW_SetThreadPinning(NNetwork, place->pinning);
+
+    start = CNNFW_GetTime();
+    for (i = 0; i < INFERENCE_PASSES; i++)
+        if (CNNFW_CalculateBatch(NNetwork, inputs, NUM_OF_DATA_ROWS, outputs)) return 1;
+    inference = (CNNFW_GetTime() - start) / INFERENCE_PASSES;
+
+    start = CNNFW_GetTime();
+    if (CNNFW_TrainAsync(NNetwork, threads, 1)) return 1;
+    training = CNNFW_GetTime() - start;
+
+    printf("  %-34s %10.0f rows/s inference, %10.0f rows/s training\n", place->name,
+        NUM_OF_DATA_ROWS / inference, NUM_OF_DATA_ROWS / training);
+    CNNFW_Free(&NNetwork);
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    size_t threads = DEFAULT_THREADS, width = DEFAULT_WIDTH, params, i, j;
+    double *data = NULL, *inputs = NULL, *outputs = NULL;
+    N_NET NNetwork = NULL;
+    CONFIG config[4];
+    PLACEMENT places[] = {
+        { "usual allocation",                  HUGE_PAGES_NONE,        NUMA_FIRST_TOUCH, DISABLE },
+        { "pinned threads",                    HUGE_PAGES_NONE,        NUMA_FIRST_TOUCH, ENABLE },
+        { "transparent huge pages",            HUGE_PAGES_TRANSPARENT, NUMA_FIRST_TOUCH, DISABLE },
+        { "explicit huge pages",               HUGE_PAGES_EXPLICIT,    NUMA_FIRST_TOUCH, DISABLE },
+        { "interleaved",                       HUGE_PAGES_NONE,        NUMA_INTERLEAVE,  DISABLE },
+        { "interleaved, huge pages, pinned",   HUGE_PAGES_TRANSPARENT, NUMA_INTERLEAVE,  ENABLE }
+    };
+
+    for (i = 1; i + 1 < (size_t)argc; i += 2) {
+        if (0 == strcmp(argv[i], "-t")) threads = (size_t)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-w")) width = (size_t)atoi(argv[i + 1]);
+        else break;
+    }
+    if (i != (size_t)argc || 0 == threads || 0 == width) {
+        printf("Usage: %s [-t threads] [-w width]\n", argv[0]);
+        return 1;
+    }
+
+    /* width inputs, two hidden layers of width neurons */
+    config[0] = config[1] = config[2] = (CONFIG)width;
+    config[3] = NUM_OF_OUTPUTS;
+
+    srand((unsigned int)time(NULL));
+    if (CNNFW_Create(&NNetwork, config, NUM_OF_DATA_ROWS)) {
+        printf("Error of Neural Network creating\n");
+        return 1;
+    }
+    CNNFW_SetEpsilonAndLearningStep(NNetwork, 0.01, 0.001);
+
+    data = (double *)malloc(sizeof(double) * NUM_OF_DATA_ROWS * (width + NUM_OF_OUTPUTS));
+    inputs = (double *)malloc(sizeof(double) * NUM_OF_DATA_ROWS * width);
+    outputs = (double *)malloc(sizeof(double) * NUM_OF_DATA_ROWS * NUM_OF_OUTPUTS);
+    if (NULL == data || NULL == inputs || NULL == outputs) {
+        printf("Unsuccessful memory allocation\n");
+        return 1;
+    }
+    for (i = 0; i < NUM_OF_DATA_ROWS; i++) {
+        for (j = 0; j < width; j++)
+            inputs[i * width + j] = data[i * (width + NUM_OF_OUTPUTS) + j] = (double)(rand() % 1001) / 1000.0;
+        for (j = 0; j < NUM_OF_OUTPUTS; j++)
+            data[i * (width + NUM_OF_OUTPUTS) + width + j] = (double)(rand() % 2);
+    }
+    if (CNNFW_SetDataRows(NNetwork, 0, NUM_OF_DATA_ROWS, data)) {
+        printf("Error of setting data\n");
+        return 1;
+    }
+
+    CNNFW_GetParametersCount(NNetwork, &params);
+    printf("%lu parameters (%.1f MB), %d rows, %lu threads\n", (unsigned long)params,
+        sizeof(double) * (double)params / (1 << 20), NUM_OF_DATA_ROWS, (unsigned long)threads);
+    for (i = 0; i < sizeof(places) / sizeof(places[0]); i++)
+        if (measure(NNetwork, &places[i], threads, inputs, outputs))
+            return 1;
+
+    CNNFW_Free(&NNetwork);
+    free(data);
+    free(inputs);
+    free(outputs);
+
+    return 0;
+}
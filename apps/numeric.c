@@ -0,0 +1,124 @@
+/* Training with finite differences (CNNFW_Train with FINITE_DIFFERENCE and
+CENTRAL_DIFFERENCE) of Neural Networks with 1, 2 ... hidden layers up to the given
+number. Prints the time of one epoch and the loss after the given number of epochs.
+The values of the layers are kept for every row, so a changed parameter costs the
+calculation of its layer and the layers after it only.
+
+Usage: numeric [-l max_layers] [-e epochs] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <cNNFW.h>
+
+#define DEFAULT_LAYERS 4
+#define DEFAULT_EPOCHS 5
+
+#define NUM_OF_INPUTS 16
+#define NUM_OF_NEURONS 32
+#define NUM_OF_OUTPUTS 4
+#define NUM_OF_DATA_ROWS 128
+#define NUM_OF_DATA_COLS (NUM_OF_INPUTS + NUM_OF_OUTPUTS)
+#define MAX_LAYERS 16
+
+static double loss(N_NET NNetwork, const double *data, double *outputs) {
+    size_t row, out;
+    double diff, result = 0.0;
+
+    for (row = 0; row < NUM_OF_DATA_ROWS; row++) {
+        CNNFW_CalculateBatch(NNetwork, data + row * NUM_OF_DATA_COLS, 1, outputs);
+        for (out = 0; out < NUM_OF_OUTPUTS; out++) {
+            diff = outputs[out] - data[row * NUM_OF_DATA_COLS + NUM_OF_INPUTS + out];
+            result += diff * diff;
+        }
+    }
+
+    return result / NUM_OF_DATA_ROWS;
+}
+
+/* Trains a copy of the Neural Network with the method and prints the time of an epoch and the loss */
+static int measure(N_NET Initial, TRAINING_METHOD method, size_t epochs, const double *data) {
+    size_t i;
+    double start, elapsed, outputs[NUM_OF_OUTPUTS];
+    N_NET NNetwork = NULL;
+
+    if (CNNFW_Clone(&NNetwork, Initial) || CNNFW_SetTrainingMethod(NNetwork, method))
+        return 1;
+
+    start = CNNFW_GetTime();
+    for (i = 0; i < epochs; i++) {
+        if (CNNFW_Train(NNetwork)) {
+            printf("Error of training\n");
+            return 1;
+        }
+    }
+    elapsed = CNNFW_GetTime() - start;
+
+    printf("  %-9s %9.3f s/epoch, loss %f\n", FINITE_DIFFERENCE == method ? "forward" : "central",
+        elapsed / epochs, loss(NNetwork, data, outputs));
+    CNNFW_Free(&NNetwork);
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    size_t layers = DEFAULT_LAYERS, epochs = DEFAULT_EPOCHS, hidden, params, i, j;
+    double x, outputs[NUM_OF_OUTPUTS];
+    double *data = NULL;
+    N_NET NNetwork = NULL;
+    CONFIG config[MAX_LAYERS + 2];
+
+    for (i = 1; i + 1 < (size_t)argc; i += 2) {
+        if (0 == strcmp(argv[i], "-l")) layers = (size_t)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-e")) epochs = (size_t)atoi(argv[i + 1]);
+        else break;
+    }
+    if (i != (size_t)argc || 0 == layers || layers > MAX_LAYERS || 0 == epochs) {
+        printf("Usage: %s [-l max_layers (1 - %d)] [-e epochs]\n", argv[0], MAX_LAYERS);
+        return 1;
+    }
+
+    data = (double *)malloc(sizeof(double) * NUM_OF_DATA_ROWS * NUM_OF_DATA_COLS);
+    if (NULL == data) {
+        printf("Unsuccessful memory allocation\n");
+        return 1;
+    }
+    srand((unsigned int)time(NULL));
+    for (i = 0; i < NUM_OF_DATA_ROWS; i++) {
+        x = 0.0;
+        for (j = 0; j < NUM_OF_INPUTS; j++) {
+            data[i * NUM_OF_DATA_COLS + j] = (double)(rand() % 1001) / 1000.0;
+            x += data[i * NUM_OF_DATA_COLS + j] * (double)(j % 4 + 1);
+        }
+        for (j = 0; j < NUM_OF_OUTPUTS; j++)
+            data[i * NUM_OF_DATA_COLS + NUM_OF_INPUTS + j] = 0.5 + 0.4 * sin(x / (double)(j + 3));
+    }
+
+    for (hidden = 1; hidden <= layers; hidden++) {
+        /* NUM_OF_INPUTS inputs, hidden layers of NUM_OF_NEURONS neurons, NUM_OF_OUTPUTS outputs */
+        config[0] = NUM_OF_INPUTS;
+        for (i = 1; i <= hidden; i++)
+            config[i] = NUM_OF_NEURONS;
+        config[hidden + 1] = NUM_OF_OUTPUTS;
+
+        if (create(&NNetwork, config, hidden + 2, NUM_OF_DATA_ROWS) || CNNFW_SetDataRows(NNetwork, 0, NUM_OF_DATA_ROWS, data)) {
+            printf("Error of Neural Network creating\n");
+            return 1;
+        }
+        CNNFW_SetEpsilonAndLearningStep(NNetwork, 0.1, 0.001);
+        CNNFW_GetParametersCount(NNetwork, &params);
+        printf("%lu hidden layers, %lu parameters, initial loss %f\n",
+            (unsigned long)hidden, (unsigned long)params, loss(NNetwork, data, outputs));
+
+        if (measure(NNetwork, FINITE_DIFFERENCE, epochs, data) || measure(NNetwork, CENTRAL_DIFFERENCE, epochs, data))
+            return 1;
+        CNNFW_Free(&NNetwork);
+    }
+
+    free(data);
+
+    return 0;
+}
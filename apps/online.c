@@ -0,0 +1,149 @@
+/* Learns a function which drifts with time from a stream of rows arriving in batches.
+The usual way rebuilds a Neural Network for all the rows received so far, copies the
+parameters into it and trains an epoch, so every batch costs more than the previous
+one. The online mode keeps the recent rows in a ring and a sample of the older ones in
+a reservoir, pushes every batch into them and makes a few steps over the newest rows,
+every REPLAY_BATCHES batches it replays an epoch over the ring and the reservoir.
+Every batch is first used to measure the loss of the Neural Network on the rows it has
+not seen yet.
+
+Usage: online [-b batch_rows] [-n batches] [-k newest_rows] [-s steps] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <cNNFW.h>
+
+#define DEFAULT_BATCH 100
+#define DEFAULT_BATCHES 100
+#define DEFAULT_NEWEST 256
+#define DEFAULT_STEPS 8
+
+#define NUM_OF_INPUTS 8
+#define NUM_OF_OUTPUTS 1
+#define NUM_OF_DATA_COLS (NUM_OF_INPUTS + NUM_OF_OUTPUTS)
+#define RING_ROWS 1024
+#define RESERVOIR_ROWS 1024
+#define REPLAY_BATCHES 10
+
+/* Fills the rows of the stream from the first one, the function drifts slowly */
+static void generate(double *rows, size_t first, size_t count) {
+    size_t i, j;
+    double x;
+
+    for (i = 0; i < count; i++) {
+        x = 0.0;
+        for (j = 0; j < NUM_OF_INPUTS; j++) {
+            rows[i * NUM_OF_DATA_COLS + j] = (double)(rand() % 1001) / 1000.0;
+            x += rows[i * NUM_OF_DATA_COLS + j] * (double)(j % 3 + 1);
+        }
+        rows[i * NUM_OF_DATA_COLS + NUM_OF_INPUTS] = 0.5 + 0.4 * sin(x / 3.0 + (double)(first + i) / 2000.0);
+    }
+}
+
+/* The loss of the Neural Network on the rows of a batch */
+static double loss(N_NET NNetwork, const double *rows, size_t count) {
+    size_t i;
+    double output, diff, result = 0.0;
+
+    for (i = 0; i < count; i++) {
+        CNNFW_CalculateBatch(NNetwork, rows + i * NUM_OF_DATA_COLS, 1, &output);
+        diff = output - rows[i * NUM_OF_DATA_COLS + NUM_OF_INPUTS];
+        result += diff * diff;
+    }
+
+    return result / count;
+}
+
+int main(int argc, char *argv[]) {
+    size_t batch = DEFAULT_BATCH, batches = DEFAULT_BATCHES, newest = DEFAULT_NEWEST, steps = DEFAULT_STEPS;
+    size_t i, b, params;
+    double start, rebuildTime, onlineTime, rebuildLoss = 0.0, onlineLoss = 0.0;
+    double *stream = NULL, *parameters = NULL;
+    N_NET Initial = NULL, Rebuilt = NULL, Online = NULL;
+    CONFIG config[] = { NUM_OF_INPUTS, 32, NUM_OF_OUTPUTS };
+
+    for (i = 1; i + 1 < (size_t)argc; i += 2) {
+        if (0 == strcmp(argv[i], "-b")) batch = (size_t)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-n")) batches = (size_t)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-k")) newest = (size_t)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-s")) steps = (size_t)atoi(argv[i + 1]);
+        else break;
+    }
+    if (i != (size_t)argc || 0 == batch || 0 == batches || 0 == newest || newest > RING_ROWS) {
+        printf("Usage: %s [-b batch_rows] [-n batches] [-k newest_rows (1 - %d)] [-s steps]\n", argv[0], RING_ROWS);
+        return 1;
+    }
+
+    srand((unsigned int)time(NULL));
+    stream = (double *)malloc(sizeof(double) * batch * batches * NUM_OF_DATA_COLS);
+    if (NULL == stream) {
+        printf("Unsuccessful memory allocation\n");
+        return 1;
+    }
+    generate(stream, 0, batch * batches);
+
+    if (CNNFW_Create(&Initial, config, 0)) {
+        printf("Error of Neural Network creating\n");
+        return 1;
+    }
+    CNNFW_SetTrainingMethod(Initial, BACKPROPAGATION);
+    CNNFW_SetEpsilonAndLearningStep(Initial, 0.01, 0.05);
+    CNNFW_GetParametersCount(Initial, &params);
+    parameters = (double *)malloc(sizeof(double) * params);
+    if (NULL == parameters || CNNFW_Clone(&Online, Initial) || CNNFW_SetOnline(Online, RING_ROWS, RESERVOIR_ROWS)) {
+        printf("Error of setting the online mode\n");
+        return 1;
+    }
+
+    printf("%lu batches of %lu rows, the ring of %d rows, the reservoir of %d rows\n",
+        (unsigned long)batches, (unsigned long)batch, RING_ROWS, RESERVOIR_ROWS);
+
+    /* A new Neural Network for all the received rows takes the parameters of the previous one */
+    CNNFW_GetParameters(Initial, parameters);
+    start = CNNFW_GetTime();
+    for (b = 0; b < batches; b++) {
+        if (0 < b) {
+            rebuildLoss += loss(Rebuilt, stream + b * batch * NUM_OF_DATA_COLS, batch);
+            CNNFW_GetParameters(Rebuilt, parameters);
+            CNNFW_Free(&Rebuilt);
+        }
+        if (create(&Rebuilt, config, sizeof(config) / sizeof(config[0]), (b + 1) * batch) ||
+            CNNFW_SetParameters(Rebuilt, parameters) ||
+            CNNFW_SetDataRows(Rebuilt, 0, (b + 1) * batch, stream)) {
+            printf("Error of rebuilding\n");
+            return 1;
+        }
+        CNNFW_SetTrainingMethod(Rebuilt, BACKPROPAGATION);
+        CNNFW_SetEpsilonAndLearningStep(Rebuilt, 0.01, 0.05);
+        if (CNNFW_Train(Rebuilt)) return 1;
+    }
+    rebuildTime = CNNFW_GetTime() - start;
+
+    start = CNNFW_GetTime();
+    for (b = 0; b < batches; b++) {
+        if (0 < b)
+            onlineLoss += loss(Online, stream + b * batch * NUM_OF_DATA_COLS, batch);
+        if (CNNFW_PushRows(Online, stream + b * batch * NUM_OF_DATA_COLS, batch)) return 1;
+        for (i = 0; i < steps; i++)
+            if (CNNFW_TrainNewest(Online, (newest < (b + 1) * batch) ? newest : (b + 1) * batch)) return 1;
+        if (0 == (b + 1) % REPLAY_BATCHES && CNNFW_Train(Online)) return 1;
+    }
+    onlineTime = CNNFW_GetTime() - start;
+
+    printf("  rebuilding: %9.0f rows/s, loss on the unseen rows %f\n", batch * batches / rebuildTime,
+        (1 < batches) ? rebuildLoss / (batches - 1) : 0.0);
+    printf("  online:     %9.0f rows/s, loss on the unseen rows %f\n", batch * batches / onlineTime,
+        (1 < batches) ? onlineLoss / (batches - 1) : 0.0);
+
+    CNNFW_Free(&Initial);
+    CNNFW_Free(&Rebuilt);
+    CNNFW_Free(&Online);
+    free(stream);
+    free(parameters);
+
+    return 0;
+}
@@ -0,0 +1,237 @@
+/* Data-parallel training in several processes. Each process owns a shard of the
+rows, calculates the gradient of its shard by backpropagation, the gradients are
+summed in the shared memory and every process applies the same sum to its copy
+of the Neural Network.
+
+With --verify the same training is first done by one process, which calculates
+the gradients of the shards one after another and sums them in the order of the
+ranks. Every process then checks that its weights are bitwise identical to it.
+
+Usage: parallel [-n processes] [-e epochs] [-s seed] [--verify] */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+
+int main(void) {
+    printf("Data-parallel training is supported only on POSIX systems\n");
+    return 1;
+}
+
+#else
+
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <cNNFW.h>
+
+#define NUM_OF_INPUTS 8
+#define NUM_OF_OUTPUTS 2
+#define NUM_OF_DATA_ROWS 4096
+#define NUM_OF_DATA_COLS (NUM_OF_INPUTS + NUM_OF_OUTPUTS)
+
+#define DEFAULT_PROCESSES 4
+#define DEFAULT_EPOCHS 200
+#define DEFAULT_SEED 1
+
+#define LEARNING_STEP_VALUE 0.5
+
+static DATA_ROWS shard_first(size_t rank, size_t processes) {
+    return (DATA_ROWS)((unsigned long)NUM_OF_DATA_ROWS * rank / processes);
+}
+
+/* Trains the process of the given rank, the gradient of its shard is summed with the others */
+static int train(N_NET NNetwork, GROUP Group, size_t rank, size_t processes, size_t epochs, double *gradient) {
+    size_t epoch;
+    DATA_ROWS first = shard_first(rank, processes);
+    DATA_ROWS count = shard_first(rank + 1, processes) - first;
+
+    for (epoch = 0; epoch < epochs; epoch++) {
+        if (CNNFW_ComputeGradient(NNetwork, first, count, gradient) ||
+            CNNFW_AllReduce(Group, rank, gradient) ||
+            CNNFW_ApplyGradient(NNetwork, gradient))
+            return 1;
+    }
+
+    return 0;
+}
+
+/* The same training in one process: the gradients of the shards are summed in the order of the ranks */
+static int train_reference(N_NET NNetwork, size_t processes, size_t epochs, size_t params, double *sum, double *gradient) {
+    size_t epoch, rank, i;
+    DATA_ROWS first;
+
+    for (epoch = 0; epoch < epochs; epoch++) {
+        for (rank = 0; rank < processes; rank++) {
+            first = shard_first(rank, processes);
+            if (CNNFW_ComputeGradient(NNetwork, first, shard_first(rank + 1, processes) - first, 0 == rank ? sum : gradient))
+                return 1;
+            if (0 != rank)
+                for (i = 0; i < params; i++)
+                    sum[i] += gradient[i];
+        }
+        if (CNNFW_ApplyGradient(NNetwork, sum))
+            return 1;
+    }
+
+    return 0;
+}
+
+static double loss(N_NET NNetwork, const double *data, double *outputs) {
+    size_t row, out;
+    double diff, result = 0.0;
+
+    for (row = 0; row < NUM_OF_DATA_ROWS; row++) {
+        CNNFW_CalculateBatch(NNetwork, data + row * NUM_OF_DATA_COLS, 1, outputs);
+        for (out = 0; out < NUM_OF_OUTPUTS; out++) {
+            diff = outputs[out] - data[row * NUM_OF_DATA_COLS + NUM_OF_INPUTS + out];
+            result += diff * diff;
+        }
+    }
+
+    return result / NUM_OF_DATA_ROWS;
+}
+
+int main(int argc, char *argv[]) {
+    size_t processes = DEFAULT_PROCESSES, epochs = DEFAULT_EPOCHS, params, rank, i, j;
+    unsigned int seed = DEFAULT_SEED;
+    int verify = 0, status, failed = 0;
+    double *data = NULL, *gradient = NULL, *sum = NULL, *reference = NULL, *parameters = NULL;
+    double start, x;
+    pid_t *pids = NULL;
+    N_NET NNetwork = NULL, Reference = NULL;
+    GROUP Group = NULL;
+
+    /* Eight inputs, two hidden layers with 32 and 16 neurons, two outputs */
+    CONFIG config[] = { NUM_OF_INPUTS, 32, 16, NUM_OF_OUTPUTS };
+
+    for (i = 1; i < (size_t)argc; i++) {
+        if (0 == strcmp(argv[i], "--verify")) verify = 1;
+        else if (i + 1 < (size_t)argc && 0 == strcmp(argv[i], "-n")) processes = (size_t)atoi(argv[++i]);
+        else if (i + 1 < (size_t)argc && 0 == strcmp(argv[i], "-e")) epochs = (size_t)atoi(argv[++i]);
+        else if (i + 1 < (size_t)argc && 0 == strcmp(argv[i], "-s")) seed = (unsigned int)atoi(argv[++i]);
+        else {
+            printf("Usage: %s [-n processes] [-e epochs] [-s seed] [--verify]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (0 == processes || processes > NUM_OF_DATA_ROWS) {
+        printf("The number of processes must be from 1 to %d\n", NUM_OF_DATA_ROWS);
+        return 1;
+    }
+
+    /* The weights and the data depend only on the seed */
+    srand(seed);
+    if (CNNFW_Create(&NNetwork, config, NUM_OF_DATA_ROWS)) {
+        printf("Error of Neural Network creating\n");
+        return 1;
+    }
+    CNNFW_SetEpsilonAndLearningStep(NNetwork, 0.01, LEARNING_STEP_VALUE);
+
+    data = (double *)malloc(sizeof(double) * NUM_OF_DATA_ROWS * NUM_OF_DATA_COLS);
+    if (NULL == data) {
+        printf("Unsuccessful memory allocation\n");
+        return 1;
+    }
+    for (i = 0; i < NUM_OF_DATA_ROWS; i++) {
+        x = 0.0;
+        for (j = 0; j < NUM_OF_INPUTS; j++) {
+            data[i * NUM_OF_DATA_COLS + j] = (double)(rand() % 1001) / 1000.0;
+            x += data[i * NUM_OF_DATA_COLS + j] * (double)(j + 1);
+        }
+        data[i * NUM_OF_DATA_COLS + NUM_OF_INPUTS] = 0.5 + 0.4 * sin(x / 6.0);
+        data[i * NUM_OF_DATA_COLS + NUM_OF_INPUTS + 1] = 0.5 + 0.4 * cos(x / 9.0);
+    }
+    if (CNNFW_SetDataRows(NNetwork, 0, NUM_OF_DATA_ROWS, data)) {
+        printf("Error of setting data\n");
+        return 1;
+    }
+
+    CNNFW_GetParametersCount(NNetwork, &params);
+    gradient = (double *)malloc(sizeof(double) * params);
+    sum = (double *)malloc(sizeof(double) * params);
+    reference = (double *)malloc(sizeof(double) * params);
+    parameters = (double *)malloc(sizeof(double) * params);
+    pids = (pid_t *)calloc(processes, sizeof(pid_t));
+    if (NULL == gradient || NULL == sum || NULL == reference || NULL == parameters || NULL == pids) {
+        printf("Unsuccessful memory allocation\n");
+        return 1;
+    }
+
+    printf("processes %lu, rows %d, parameters %lu, epochs %lu, initial loss %f\n",
+        (unsigned long)processes, NUM_OF_DATA_ROWS, (unsigned long)params, (unsigned long)epochs, loss(NNetwork, data, sum));
+
+    if (verify) {
+        if (CNNFW_Clone(&Reference, NNetwork)) return 1;
+        start = CNNFW_GetTime();
+        if (train_reference(Reference, processes, epochs, params, sum, gradient)) {
+            printf("Error of training\n");
+            return 1;
+        }
+        printf("one process:  %8.3f s\n", CNNFW_GetTime() - start);
+        CNNFW_GetParameters(Reference, reference);
+        CNNFW_Free(&Reference);
+    }
+
+    /* The group must exist before the fork, so that all the processes share its memory */
+    if (CNNFW_CreateGroup(&Group, processes, params)) return 1;
+
+    start = CNNFW_GetTime();
+    for (rank = 1; rank < processes; rank++) {
+        pids[rank] = fork();
+        if (pids[rank] < 0) {
+            printf("Unsuccessful fork\n");
+            return 1;
+        }
+        if (0 == pids[rank]) {
+            status = train(NNetwork, Group, rank, processes, epochs, gradient);
+            if (0 == status && verify) {
+                CNNFW_GetParameters(NNetwork, parameters);
+                status = memcmp(parameters, reference, sizeof(double) * params) ? 2 : 0;
+            }
+            _exit(status);
+        }
+    }
+
+    if (train(NNetwork, Group, 0, processes, epochs, gradient)) {
+        printf("Error of training\n");
+        failed = 1;
+    }
+    for (rank = 1; rank < processes; rank++) {
+        if (waitpid(pids[rank], &status, 0) < 0 || !WIFEXITED(status) || 0 != WEXITSTATUS(status)) {
+            printf("The process of rank %lu failed\n", (unsigned long)rank);
+            failed = 1;
+        }
+    }
+    printf("%lu processes: %8.3f s, final loss %f\n", (unsigned long)processes, CNNFW_GetTime() - start, loss(NNetwork, data, sum));
+
+    if (verify && !failed) {
+        CNNFW_GetParameters(NNetwork, parameters);
+        if (memcmp(parameters, reference, sizeof(double) * params)) {
+            printf("The weights differ from the training in one process\n");
+            failed = 1;
+        } else {
+            printf("The weights of all the processes are identical to the training in one process\n");
+        }
+    }
+
+    CNNFW_FreeGroup(&Group);
+    CNNFW_Free(&NNetwork);
+    free(data);
+    free(gradient);
+    free(sum);
+    free(reference);
+    free(parameters);
+    free(pids);
+
+    return failed;
+}
+
+#endif
@@ -0,0 +1,185 @@
+/* Trains a Neural Network on the rows read from a file by a pipeline. The producer
+reads a chunk of rows stored as floats, waits the given latency as a slow disk or
+network would, converts the rows to doubles, normalizes the inputs and shuffles the
+rows. With one buffer the reading and the training go one after another, with two
+and more buffers the next chunks are read while the current one is trained.
+
+Usage: pipeline [-d max_depth] [-l latency_ms] */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+
+#include <cNNFW.h>
+
+#define DEFAULT_DEPTH 4
+#define DEFAULT_LATENCY 20
+
+#define NUM_OF_INPUTS 32
+#define NUM_OF_OUTPUTS 4
+#define NUM_OF_DATA_COLS (NUM_OF_INPUTS + NUM_OF_OUTPUTS)
+#define NUM_OF_DATA_ROWS 16384
+#define CHUNK_ROWS 1024
+
+/* The state of the producer */
+typedef struct {
+    FILE *fp;
+    unsigned long remaining;
+    unsigned int latency;
+    float *raw;
+} SOURCE;
+
+static void wait_ms(unsigned int ms) {
+#if defined(_WIN32)
+    Sleep(ms);
+#else
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+#endif
+}
+
+/* Reads, converts, normalizes and shuffles the next chunk of the file */
+static int produce(void *context, double *buffer, DATA_ROWS capacity, DATA_ROWS *rows) {
+    SOURCE *src = (SOURCE *)context;
+    size_t count = (src->remaining < capacity) ? src->remaining : capacity;
+    size_t i, j, k;
+    double tmp;
+
+    *rows = 0;
+    if (0 == count)
+        return 0;
+    if (fread(src->raw, sizeof(float) * NUM_OF_DATA_COLS, count, src->fp) != count) {
+        printf("Error of reading the data\n");
+        return 1;
+    }
+    wait_ms(src->latency);
+    src->remaining -= count;
+
+    /* The inputs are stored from 0 to 255, the outputs from 0 to 1 */
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < NUM_OF_INPUTS; j++)
+            buffer[i * NUM_OF_DATA_COLS + j] = (double)src->raw[i * NUM_OF_DATA_COLS + j] / 255.0;
+        for (; j < NUM_OF_DATA_COLS; j++)
+            buffer[i * NUM_OF_DATA_COLS + j] = (double)src->raw[i * NUM_OF_DATA_COLS + j];
+    }
+    for (i = count - 1; i > 0; i--) {
+        k = (size_t)rand() % (i + 1);
+        for (j = 0; j < NUM_OF_DATA_COLS; j++) {
+            tmp = buffer[i * NUM_OF_DATA_COLS + j];
+            buffer[i * NUM_OF_DATA_COLS + j] = buffer[k * NUM_OF_DATA_COLS + j];
+            buffer[k * NUM_OF_DATA_COLS + j] = tmp;
+        }
+    }
+
+    *rows = (DATA_ROWS)count;
+    return 0;
+}
+
+/* Writes the rows of the data into the file */
+static int write_data(FILE *fp) {
+    size_t i, j;
+    double x;
+    float row[NUM_OF_DATA_COLS];
+
+    for (i = 0; i < NUM_OF_DATA_ROWS; i++) {
+        x = 0.0;
+        for (j = 0; j < NUM_OF_INPUTS; j++) {
+            row[j] = (float)(rand() % 256);
+            x += row[j] / 255.0 * (double)(j % 3 + 1);
+        }
+        for (j = 0; j < NUM_OF_OUTPUTS; j++)
+            row[NUM_OF_INPUTS + j] = (float)(0.5 + 0.4 * sin(x / (double)(j + 5)));
+        if (fwrite(row, sizeof(row), 1, fp) != 1) {
+            printf("Error of writing the data\n");
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int measure(N_NET Initial, SOURCE *src, size_t depth) {
+    double start, elapsed;
+    N_NET NNetwork = NULL;
+    PIPELINE Pipeline = NULL;
+    PIPELINE_STATS stats;
+
+    rewind(src->fp);
+    src->remaining = NUM_OF_DATA_ROWS;
+    if (CNNFW_Clone(&NNetwork, Initial))
+        return 1;
+
+    start = CNNFW_GetTime();
+    if (CNNFW_CreatePipeline(&Pipeline, NNetwork, CHUNK_ROWS, depth, produce, src) ||
+        CNNFW_TrainPipeline(NNetwork, Pipeline, 0, 1)) {
+        printf("Error of training\n");
+        return 1;
+    }
+    elapsed = CNNFW_GetTime() - start;
+
+    CNNFW_GetPipelineStats(Pipeline, &stats);
+    printf("  depth %lu: %7.3f s, %lu chunks, %lu rows, training %7.3f s, waiting %7.3f s, reading %7.3f s\n",
+        (unsigned long)depth, elapsed, stats.chunks, stats.rows, stats.trainTime, stats.waitTime, stats.produceTime);
+
+    CNNFW_FreePipeline(&Pipeline);
+    CNNFW_Free(&NNetwork);
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    size_t maxDepth = DEFAULT_DEPTH, depth, i;
+    SOURCE src;
+    N_NET NNetwork = NULL;
+    CONFIG config[] = { NUM_OF_INPUTS, 64, 64, NUM_OF_OUTPUTS };
+
+    src.latency = DEFAULT_LATENCY;
+    for (i = 1; i + 1 < (size_t)argc; i += 2) {
+        if (0 == strcmp(argv[i], "-d")) maxDepth = (size_t)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-l")) src.latency = (unsigned int)atoi(argv[i + 1]);
+        else break;
+    }
+    if (i != (size_t)argc || 0 == maxDepth) {
+        printf("Usage: %s [-d max_depth] [-l latency_ms]\n", argv[0]);
+        return 1;
+    }
+
+    srand((unsigned int)time(NULL));
+
+    src.fp = tmpfile();
+    src.raw = (float *)malloc(sizeof(float) * CHUNK_ROWS * NUM_OF_DATA_COLS);
+    if (NULL == src.fp || NULL == src.raw) {
+        printf("Error of creating the data file\n");
+        return 1;
+    }
+    if (write_data(src.fp))
+        return 1;
+
+    if (CNNFW_Create(&NNetwork, config, 0)) {
+        printf("Error of Neural Network creating\n");
+        return 1;
+    }
+    CNNFW_SetTrainingMethod(NNetwork, BACKPROPAGATION);
+    CNNFW_SetEpsilonAndLearningStep(NNetwork, 0.01, 0.5);
+
+    printf("%d rows in chunks of %d, %u ms to read a chunk\n", NUM_OF_DATA_ROWS, CHUNK_ROWS, src.latency);
+    for (depth = 1; depth <= maxDepth; depth *= 2)
+        if (measure(NNetwork, &src, depth))
+            return 1;
+
+    CNNFW_Free(&NNetwork);
+    fclose(src.fp);
+    free(src.raw);
+
+    return 0;
+}
@@ -0,0 +1,125 @@
+/* Searches for the configuration, the learning step and the activation function of a
+Neural Network which approximates two functions of eight inputs. The trials share the
+training data and are trained by several threads, with the successive halving only
+the best part of them is trained to the end. The loss is calculated on the
+validation rows, the best Neural Network can be saved to a file.
+
+Usage: search [-t threads] [-e epochs] [-r random_trials] [-h eta] [-o file] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <cNNFW.h>
+
+#define NUM_OF_INPUTS 8
+#define NUM_OF_OUTPUTS 2
+#define NUM_OF_DATA_COLS (NUM_OF_INPUTS + NUM_OF_OUTPUTS)
+#define NUM_OF_TRAIN_ROWS 1024
+#define NUM_OF_VALIDATION_ROWS 256
+
+#define DEFAULT_THREADS 4
+#define DEFAULT_EPOCHS 300
+#define DEFAULT_ETA 3
+
+/* Fills the rows of the data object with the inputs and the values of the functions */
+static int fill(DATASET Data, size_t rows) {
+    size_t i, j;
+    double x, row[NUM_OF_DATA_COLS];
+
+    for (i = 0; i < rows; i++) {
+        x = 0.0;
+        for (j = 0; j < NUM_OF_INPUTS; j++) {
+            row[j] = (double)(rand() % 1001) / 1000.0;
+            x += row[j] * (double)(j + 1);
+        }
+        row[NUM_OF_INPUTS] = 0.5 + 0.4 * sin(x / 6.0);
+        row[NUM_OF_INPUTS + 1] = 0.5 + 0.4 * cos(x / 9.0);
+        if (CNNFW_SetDatasetRows(Data, (DATA_ROWS)i, 1, row))
+            return 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    size_t i;
+    double start;
+    DATASET Train = NULL, Validation = NULL;
+    N_NET Best = NULL;
+    SEARCH_SPACE space;
+    SEARCH_OPTIONS options;
+    SEARCH_RESULT result;
+
+    /* Four topologies, four learning steps and the sigmoid or no activation: 32 combinations */
+    static const CONFIG small[] = { NUM_OF_INPUTS, 16, NUM_OF_OUTPUTS };
+    static const CONFIG wide[] = { NUM_OF_INPUTS, 48, NUM_OF_OUTPUTS };
+    static const CONFIG deep[] = { NUM_OF_INPUTS, 16, 16, NUM_OF_OUTPUTS };
+    static const CONFIG deeper[] = { NUM_OF_INPUTS, 32, 16, 8, NUM_OF_OUTPUTS };
+    const CONFIG *configs[] = { small, wide, deep, deeper };
+    size_t configSizes[] = { sizeof(small) / sizeof(small[0]), sizeof(wide) / sizeof(wide[0]),
+        sizeof(deep) / sizeof(deep[0]), sizeof(deeper) / sizeof(deeper[0]) };
+    LEARNING_STEP steps[] = { 0.05, 0.2, 0.5, 1.0 };
+    ACTIVATION_FUNCTION actFuncs[] = { ENABLE, DISABLE };
+
+    memset(&options, 0, sizeof(options));
+    options.mode = SEARCH_GRID;
+    options.threads = DEFAULT_THREADS;
+    options.epochs = DEFAULT_EPOCHS;
+    options.eta = DEFAULT_ETA;
+    options.method = BACKPROPAGATION;
+
+    for (i = 1; i + 1 < (size_t)argc; i += 2) {
+        if (0 == strcmp(argv[i], "-t")) options.threads = (size_t)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-e")) options.epochs = (size_t)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-h")) options.eta = (size_t)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-o")) options.fileName = argv[i + 1];
+        else if (0 == strcmp(argv[i], "-r")) {
+            options.mode = SEARCH_RANDOM;
+            options.trials = (size_t)atoi(argv[i + 1]);
+        } else break;
+    }
+    if (i != (size_t)argc) {
+        printf("Usage: %s [-t threads] [-e epochs] [-r random_trials] [-h eta] [-o file]\n", argv[0]);
+        return 1;
+    }
+
+    memset(&space, 0, sizeof(space));
+    space.configsCount = sizeof(configs) / sizeof(configs[0]);
+    space.configs = configs;
+    space.configSizes = configSizes;
+    space.stepsCount = sizeof(steps) / sizeof(steps[0]);
+    space.steps = steps;
+    space.actFuncsCount = sizeof(actFuncs) / sizeof(actFuncs[0]);
+    space.actFuncs = actFuncs;
+
+    srand((unsigned int)time(NULL));
+    if (CNNFW_CreateData(&Train, NUM_OF_TRAIN_ROWS, NUM_OF_DATA_COLS) ||
+        CNNFW_CreateData(&Validation, NUM_OF_VALIDATION_ROWS, NUM_OF_DATA_COLS) ||
+        fill(Train, NUM_OF_TRAIN_ROWS) || fill(Validation, NUM_OF_VALIDATION_ROWS)) {
+        printf("Error of creating the data\n");
+        return 1;
+    }
+
+    start = CNNFW_GetTime();
+    if (CNNFW_Search(Train, Validation, &space, &options, &Best, &result)) {
+        printf("Error of the search\n");
+        return 1;
+    }
+
+    printf("%lu trials in %.3f s with %lu threads, %lu stopped early\n", (unsigned long)result.trials,
+        CNNFW_GetTime() - start, (unsigned long)options.threads, (unsigned long)result.stopped);
+    printf("The best: configuration {");
+    for (i = 0; i < configSizes[result.config]; i++)
+        printf(i ? ", %u" : "%u", configs[result.config][i]);
+    printf("}, step %g, activation %s, validation loss %f\n", result.step,
+        ENABLE == result.actFunc ? "enabled" : "disabled", result.loss);
+
+    CNNFW_Free(&Best);
+    CNNFW_FreeData(&Train);
+    CNNFW_FreeData(&Validation);
+
+    return 0;
+}
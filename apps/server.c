@@ -0,0 +1,436 @@
+/* A local inference server. It loads a Neural Network from a file, accepts
+connections on a UNIX-domain or a loopback TCP socket and coalesces concurrent
+requests into batches which are calculated by a pool of workers.
+
+Protocol: after connecting the server sends two unsigned ints - the number of
+inputs and the number of outputs. Then the client sends the inputs (doubles)
+and receives the outputs (doubles), one request at a time per connection.
+
+Usage: server model.bin [-u socket_path | -p port] [-w workers] [-b max_batch] [-l max_latency_us] */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cNNFW.h>
+
+#ifdef _WIN32
+
+int main(void) {
+    printf("The inference server is supported only on POSIX systems\n");
+    return 1;
+}
+
+#else
+
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_PORT 5555
+#define DEFAULT_WORKERS 2
+#define DEFAULT_MAX_BATCH 32
+#define DEFAULT_MAX_LATENCY_US 500
+#define STATS_PERIOD_S 5
+
+typedef struct REQUEST {
+    double *inputs;
+    double *outputs;
+    double arrived;
+    int done;               /* 1 - the outputs are ready, -1 - the server is stopping, no outputs */
+    pthread_cond_t cond;
+    struct REQUEST *next;
+} REQUEST;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    REQUEST *head;
+    REQUEST *tail;
+    size_t len;
+} QUEUE;
+
+typedef struct {
+    unsigned long requests;
+    unsigned long batches;
+    double latencySum;
+    double latencyMax;
+    double computeSum;
+} STATS;
+
+static QUEUE Queue;
+static STATS Stats;
+static pthread_mutex_t StatsMutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t Quit = 0;
+static int Closed = 0;      /* Under Queue.mutex, no new requests are queued */
+
+static const char *ModelFile = NULL;
+static size_t NumOfInputs = 0;
+static size_t NumOfOutputs = 0;
+static size_t MaxBatch = DEFAULT_MAX_BATCH;
+static double MaxLatency = DEFAULT_MAX_LATENCY_US / 1e6;
+
+/* The deadline in the time of CNNFW_GetTime is moved to CLOCK_REALTIME, which
+pthread_cond_timedwait uses by default (macOS has no pthread_condattr_setclock) */
+static void to_timespec(double deadline, struct timespec *ts) {
+    double t;
+    clock_gettime(CLOCK_REALTIME, ts);
+    t = (double)ts->tv_sec + (double)ts->tv_nsec / 1e9 + deadline - CNNFW_GetTime();
+    ts->tv_sec = (time_t)t;
+    ts->tv_nsec = (long)((t - (double)ts->tv_sec) * 1e9);
+}
+
+static int read_all(int fd, void *buf, size_t len) {
+    char *p = (char *)buf;
+    ssize_t n;
+    while (len > 0) {
+        n = read(fd, p, len);
+        if (n < 0 && EINTR == errno) continue;
+        if (n <= 0) return 1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = (const char *)buf;
+    ssize_t n;
+    while (len > 0) {
+        n = write(fd, p, len);
+        if (n < 0 && EINTR == errno) continue;
+        if (n <= 0) return 1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Each worker owns its own copy of the Neural Network. It waits for the first
+request, then keeps collecting requests until the batch is full or the oldest
+request has waited for MaxLatency seconds */
+static void *worker(void *arg) {
+    N_NET NNetwork = NULL;
+    REQUEST **batch = NULL;
+    double *inputs = NULL, *outputs = NULL;
+    double deadline, start, finish, latency;
+    struct timespec ts;
+    size_t i, len;
+
+    (void)arg;
+
+    batch = (REQUEST **)malloc(sizeof(REQUEST *) * MaxBatch);
+    inputs = (double *)malloc(sizeof(double) * MaxBatch * NumOfInputs);
+    outputs = (double *)malloc(sizeof(double) * MaxBatch * NumOfOutputs);
+    if (NULL == batch || NULL == inputs || NULL == outputs || CNNFW_LoadFromFile(&NNetwork, ModelFile)) {
+        printf("Worker initialization error\n");
+        exit(1);
+    }
+
+    pthread_mutex_lock(&Queue.mutex);
+    while (!Quit) {
+        if (0 == Queue.len) {
+            pthread_cond_wait(&Queue.cond, &Queue.mutex);
+            continue;
+        }
+
+        deadline = Queue.head->arrived + MaxLatency;
+        while (!Quit && Queue.len > 0 && Queue.len < MaxBatch && CNNFW_GetTime() < deadline) {
+            to_timespec(deadline, &ts);
+            pthread_cond_timedwait(&Queue.cond, &Queue.mutex, &ts);
+        }
+        if (0 == Queue.len) continue;
+
+        for (len = 0; len < MaxBatch && NULL != Queue.head; len++) {
+            batch[len] = Queue.head;
+            Queue.head = Queue.head->next;
+            Queue.len--;
+        }
+        if (NULL == Queue.head) Queue.tail = NULL;
+        if (Queue.len > 0) pthread_cond_signal(&Queue.cond);
+        pthread_mutex_unlock(&Queue.mutex);
+
+        for (i = 0; i < len; i++)
+            memcpy(inputs + i * NumOfInputs, batch[i]->inputs, sizeof(double) * NumOfInputs);
+
+        start = CNNFW_GetTime();
+        CNNFW_CalculateBatch(NNetwork, inputs, len, outputs);
+        finish = CNNFW_GetTime();
+
+        pthread_mutex_lock(&StatsMutex);
+        Stats.batches++;
+        Stats.requests += len;
+        Stats.computeSum += finish - start;
+        for (i = 0; i < len; i++) {
+            latency = finish - batch[i]->arrived;
+            Stats.latencySum += latency;
+            if (latency > Stats.latencyMax) Stats.latencyMax = latency;
+        }
+        pthread_mutex_unlock(&StatsMutex);
+
+        pthread_mutex_lock(&Queue.mutex);
+        for (i = 0; i < len; i++) {
+            memcpy(batch[i]->outputs, outputs + i * NumOfOutputs, sizeof(double) * NumOfOutputs);
+            batch[i]->done = 1;
+            pthread_cond_signal(&batch[i]->cond);
+        }
+    }
+    pthread_mutex_unlock(&Queue.mutex);
+
+    CNNFW_Free(&NNetwork);
+    free(batch);
+    free(inputs);
+    free(outputs);
+
+    return NULL;
+}
+
+/* One thread per connection, the requests of a connection are answered in order */
+static void *connection(void *arg) {
+    int fd = *(int *)arg;
+    unsigned int header[2];
+    REQUEST req;
+
+    free(arg);
+
+    req.inputs = (double *)malloc(sizeof(double) * NumOfInputs);
+    req.outputs = (double *)malloc(sizeof(double) * NumOfOutputs);
+    pthread_cond_init(&req.cond, NULL);
+
+    header[0] = (unsigned int)NumOfInputs;
+    header[1] = (unsigned int)NumOfOutputs;
+    if (NULL != req.inputs && NULL != req.outputs && 0 == write_all(fd, header, sizeof(header))) {
+        while (!Quit && 0 == read_all(fd, req.inputs, sizeof(double) * NumOfInputs)) {
+            pthread_mutex_lock(&Queue.mutex);
+            if (Closed) {
+                pthread_mutex_unlock(&Queue.mutex);
+                break;
+            }
+            req.arrived = CNNFW_GetTime();
+            req.done = 0;
+            req.next = NULL;
+            if (NULL == Queue.tail)
+                Queue.head = &req;
+            else
+                Queue.tail->next = &req;
+            Queue.tail = &req;
+            Queue.len++;
+            pthread_cond_signal(&Queue.cond);
+            while (0 == req.done)
+                pthread_cond_wait(&req.cond, &Queue.mutex);
+            pthread_mutex_unlock(&Queue.mutex);
+
+            if (req.done < 0 || write_all(fd, req.outputs, sizeof(double) * NumOfOutputs)) break;
+        }
+    }
+
+    close(fd);
+    pthread_cond_destroy(&req.cond);
+    free(req.inputs);
+    free(req.outputs);
+
+    return NULL;
+}
+
+static void print_stats(double elapsed) {
+    STATS s;
+
+    pthread_mutex_lock(&StatsMutex);
+    s = Stats;
+    memset(&Stats, 0, sizeof(Stats));
+    pthread_mutex_unlock(&StatsMutex);
+
+    printf("qps %.0f, batches %lu, mean batch %.2f, mean latency %.1f us, max latency %.1f us, mean compute %.1f us\n",
+        (double)s.requests / elapsed,
+        s.batches,
+        s.batches ? (double)s.requests / (double)s.batches : 0.0,
+        s.requests ? s.latencySum / (double)s.requests * 1e6 : 0.0,
+        s.latencyMax * 1e6,
+        s.batches ? s.computeSum / (double)s.batches * 1e6 : 0.0);
+    fflush(stdout);
+}
+
+static void *stats(void *arg) {
+    double last = CNNFW_GetTime(), cur;
+    struct timespec ts;
+
+    (void)arg;
+
+    ts.tv_sec = STATS_PERIOD_S;
+    ts.tv_nsec = 0;
+    while (!Quit) {
+        nanosleep(&ts, NULL);
+        cur = CNNFW_GetTime();
+        print_stats(cur - last);
+        last = cur;
+    }
+
+    return NULL;
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    Quit = 1;
+}
+
+int main(int argc, char *argv[]) {
+    N_NET NNetwork = NULL;
+    const char *sockPath = NULL;
+    unsigned short port = DEFAULT_PORT;
+    size_t workers = DEFAULT_WORKERS, i;
+    pthread_t *pool = NULL, statsThread, thr;
+    REQUEST *req;
+    struct sigaction sa;
+    int listenFd, fd, one = 1, *arg;
+
+    if (argc < 2) {
+        printf("Usage: %s model.bin [-u socket_path | -p port] [-w workers] [-b max_batch] [-l max_latency_us]\n", argv[0]);
+        return 1;
+    }
+    ModelFile = argv[1];
+    for (i = 2; i + 1 < (size_t)argc; i += 2) {
+        if (0 == strcmp(argv[i], "-u")) sockPath = argv[i + 1];
+        else if (0 == strcmp(argv[i], "-p")) port = (unsigned short)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-w")) workers = (size_t)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-b")) MaxBatch = (size_t)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-l")) MaxLatency = atof(argv[i + 1]) / 1e6;
+        else {
+            printf("Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (0 == workers || 0 == MaxBatch) {
+        printf("The number of workers and the batch size must be at least 1\n");
+        return 1;
+    }
+
+    if (CNNFW_LoadFromFile(&NNetwork, ModelFile)) {
+        printf("Error of loading Neural Network from %s\n", ModelFile);
+        return 1;
+    }
+    CNNFW_GetInputsAndOutputsCount(NNetwork, &NumOfInputs, &NumOfOutputs);
+    CNNFW_Free(&NNetwork);
+
+    if (NULL != sockPath) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, sockPath, sizeof(addr.sun_path) - 1);
+        unlink(sockPath);
+        listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd < 0 || bind(listenFd, (struct sockaddr *)&addr, sizeof(addr))) {
+            perror("bind");
+            return 1;
+        }
+    } else {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listenFd >= 0)
+            setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (listenFd < 0 || bind(listenFd, (struct sockaddr *)&addr, sizeof(addr))) {
+            perror("bind");
+            return 1;
+        }
+    }
+    if (listen(listenFd, 128)) {
+        perror("listen");
+        return 1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+
+    pthread_mutex_init(&Queue.mutex, NULL);
+    pthread_cond_init(&Queue.cond, NULL);
+
+    pool = (pthread_t *)malloc(sizeof(pthread_t) * workers);
+    if (NULL == pool) {
+        printf("Unsuccessful memory allocation\n");
+        return 1;
+    }
+    for (i = 0; i < workers; i++) {
+        if (pthread_create(&pool[i], NULL, worker, NULL)) {
+            printf("Error of creating the workers\n");
+            return 1;
+        }
+    }
+    if (pthread_create(&statsThread, NULL, stats, NULL)) {
+        printf("Error of creating the statistics thread\n");
+        return 1;
+    }
+
+    printf("Serving %s (%lu inputs, %lu outputs) with %lu workers, batch %lu, latency %.0f us\n",
+        ModelFile, (unsigned long)NumOfInputs, (unsigned long)NumOfOutputs,
+        (unsigned long)workers, (unsigned long)MaxBatch, MaxLatency * 1e6);
+    if (NULL != sockPath)
+        printf("Listening on unix:%s\n", sockPath);
+    else
+        printf("Listening on 127.0.0.1:%u\n", (unsigned int)port);
+    fflush(stdout);
+
+    while (!Quit) {
+        fd = accept(listenFd, NULL, NULL);
+        if (fd < 0) continue;
+        if (NULL == sockPath)
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        arg = (int *)malloc(sizeof(int));
+        if (NULL == arg) {
+            close(fd);
+            continue;
+        }
+        *arg = fd;
+        if (pthread_create(&thr, NULL, connection, arg)) {
+            close(fd);
+            free(arg);
+            continue;
+        }
+        pthread_detach(thr);
+    }
+
+    close(listenFd);
+    if (NULL != sockPath) unlink(sockPath);
+
+    pthread_mutex_lock(&Queue.mutex);
+    Closed = 1;
+    pthread_cond_broadcast(&Queue.cond);
+    pthread_mutex_unlock(&Queue.mutex);
+    for (i = 0; i < workers; i++)
+        pthread_join(pool[i], NULL);
+    free(pool);
+
+    /* The requests left in the queue are not calculated, their connections are closed */
+    pthread_mutex_lock(&Queue.mutex);
+    while (NULL != Queue.head) {
+        req = Queue.head;
+        Queue.head = req->next;
+        req->done = -1;
+        pthread_cond_signal(&req->cond);
+    }
+    Queue.tail = NULL;
+    Queue.len = 0;
+    pthread_mutex_unlock(&Queue.mutex);
+
+    printf("\nDone\n");
+
+    return 0;
+}
+
+#endif
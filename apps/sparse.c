@@ -0,0 +1,151 @@
+/* Compares the dense and the sparse inputs of a Neural Network with many inputs of which
+only a few are not zeros (one-hot or bag-of-features vectors). The same rows are calculated
+by CNNFW_CalculateBatch and CNNFW_CalculateSparseBatch, one by one with set_inputs and
+CNNFW_SetSparseInputs, and trained with the backpropagation on the dense data and on
+the sparse data set by CNNFW_SetSparseData.
+
+Usage: sparse [-w inputs] [-n non_zeros] [-e epochs] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <cNNFW.h>
+
+#define DEFAULT_INPUTS 20000
+#define DEFAULT_NON_ZEROS 32
+#define DEFAULT_EPOCHS 5
+
+#define NUM_OF_NEURONS 64
+#define NUM_OF_OUTPUTS 4
+#define NUM_OF_DATA_ROWS 256
+
+int main(int argc, char *argv[]) {
+    size_t inputs = DEFAULT_INPUTS, nonZeros = DEFAULT_NON_ZEROS, epochs = DEFAULT_EPOCHS, cols, i, j, k;
+    size_t offsets[NUM_OF_DATA_ROWS + 1];
+    size_t *indices = NULL;
+    double start, denseTime, sparseTime, denseLoss, sparseLoss, diff, maxDiff = 0.0;
+    double *values = NULL, *targets = NULL, *data = NULL, *outputs = NULL, *sparseOutputs = NULL;
+    N_NET Dense = NULL, Sparse = NULL;
+    CONFIG config[] = { 0, NUM_OF_NEURONS, NUM_OF_NEURONS, NUM_OF_OUTPUTS };
+
+    for (i = 1; i + 1 < (size_t)argc; i += 2) {
+        if (0 == strcmp(argv[i], "-w")) inputs = (size_t)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-n")) nonZeros = (size_t)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-e")) epochs = (size_t)atoi(argv[i + 1]);
+        else break;
+    }
+    if (i != (size_t)argc || 0 == inputs || 0 == nonZeros || nonZeros > inputs || 0 == epochs) {
+        printf("Usage: %s [-w inputs] [-n non_zeros (up to inputs)] [-e epochs]\n", argv[0]);
+        return 1;
+    }
+
+    cols = inputs + NUM_OF_OUTPUTS;
+    indices = (size_t *)malloc(sizeof(size_t) * NUM_OF_DATA_ROWS * nonZeros);
+    values = (double *)malloc(sizeof(double) * NUM_OF_DATA_ROWS * nonZeros);
+    targets = (double *)malloc(sizeof(double) * NUM_OF_DATA_ROWS * NUM_OF_OUTPUTS);
+    data = (double *)calloc(NUM_OF_DATA_ROWS * cols, sizeof(double));
+    outputs = (double *)malloc(sizeof(double) * NUM_OF_DATA_ROWS * NUM_OF_OUTPUTS);
+    sparseOutputs = (double *)malloc(sizeof(double) * NUM_OF_DATA_ROWS * NUM_OF_OUTPUTS);
+    if (NULL == indices || NULL == values || NULL == targets || NULL == data || NULL == outputs || NULL == sparseOutputs) {
+        printf("Unsuccessful memory allocation\n");
+        return 1;
+    }
+
+    /* Every row has nonZeros features, the outputs depend on the parity of their indices */
+    srand((unsigned int)time(NULL));
+    offsets[0] = 0;
+    for (i = 0; i < NUM_OF_DATA_ROWS; i++) {
+        for (j = 0; j < nonZeros; j++) {
+            k = i * nonZeros + j;
+            indices[k] = (size_t)rand() % inputs;
+            values[k] = 1.0;
+            data[i * cols + indices[k]] += values[k];
+        }
+        offsets[i + 1] = (i + 1) * nonZeros;
+        for (j = 0; j < NUM_OF_OUTPUTS; j++) {
+            targets[i * NUM_OF_OUTPUTS + j] = (double)(indices[i * nonZeros + j % nonZeros] % 2);
+            data[i * cols + inputs + j] = targets[i * NUM_OF_OUTPUTS + j];
+        }
+    }
+
+    config[0] = (CONFIG)inputs;
+    if (CNNFW_Create(&Dense, config, NUM_OF_DATA_ROWS) || CNNFW_SetDataRows(Dense, 0, NUM_OF_DATA_ROWS, data)) {
+        printf("Error of Neural Network creating\n");
+        return 1;
+    }
+    CNNFW_SetTrainingMethod(Dense, BACKPROPAGATION);
+    CNNFW_SetEpsilonAndLearningStep(Dense, 0.01, 0.01);
+    /* The sparse copy gets the same weights and its own sparse rows */
+    if (CNNFW_Clone(&Sparse, Dense) || CNNFW_SetSparseData(Sparse, NUM_OF_DATA_ROWS, offsets, indices, values, targets)) {
+        printf("Error of setting the sparse data\n");
+        return 1;
+    }
+
+    CNNFW_GetLoss(Sparse, &sparseLoss);
+    printf("%lu inputs, %lu of them are not zeros, %d rows, initial loss %f\n", (unsigned long)inputs,
+        (unsigned long)nonZeros, NUM_OF_DATA_ROWS, sparseLoss);
+
+    /* The dense rows are stored with their outputs, so they are calculated one by one */
+    start = CNNFW_GetTime();
+    for (i = 0; i < NUM_OF_DATA_ROWS; i++)
+        if (CNNFW_CalculateBatch(Dense, data + i * cols, 1, outputs + i * NUM_OF_OUTPUTS)) return 1;
+    denseTime = CNNFW_GetTime() - start;
+    start = CNNFW_GetTime();
+    if (CNNFW_CalculateSparseBatch(Sparse, offsets, indices, values, NUM_OF_DATA_ROWS, sparseOutputs)) return 1;
+    sparseTime = CNNFW_GetTime() - start;
+    for (i = 0; i < NUM_OF_DATA_ROWS * NUM_OF_OUTPUTS; i++) {
+        diff = fabs(outputs[i] - sparseOutputs[i]);
+        if (diff > maxDiff) maxDiff = diff;
+    }
+    printf("  batch:   dense %9.0f rows/s, sparse %9.0f rows/s, max difference %g\n",
+        NUM_OF_DATA_ROWS / denseTime, NUM_OF_DATA_ROWS / sparseTime, maxDiff);
+
+    start = CNNFW_GetTime();
+    for (i = 0; i < NUM_OF_DATA_ROWS; i++)
+        if (set_inputs(Dense, data + i * cols, inputs) || CNNFW_Calculate(Dense)) return 1;
+    denseTime = CNNFW_GetTime() - start;
+    start = CNNFW_GetTime();
+    for (i = 0; i < NUM_OF_DATA_ROWS; i++)
+        if (CNNFW_SetSparseInputs(Sparse, indices + offsets[i], values + offsets[i], offsets[i + 1] - offsets[i]) ||
+            CNNFW_Calculate(Sparse)) return 1;
+    sparseTime = CNNFW_GetTime() - start;
+    printf("  single:  dense %9.0f rows/s, sparse %9.0f rows/s\n", NUM_OF_DATA_ROWS / denseTime, NUM_OF_DATA_ROWS / sparseTime);
+
+    start = CNNFW_GetTime();
+    for (i = 0; i < epochs; i++)
+        if (CNNFW_Train(Dense)) return 1;
+    denseTime = (CNNFW_GetTime() - start) / epochs;
+    start = CNNFW_GetTime();
+    for (i = 0; i < epochs; i++)
+        if (CNNFW_Train(Sparse)) return 1;
+    sparseTime = (CNNFW_GetTime() - start) / epochs;
+    CNNFW_GetLoss(Dense, &denseLoss);
+    CNNFW_GetLoss(Sparse, &sparseLoss);
+    printf("  train:   dense %9.3f s/epoch, sparse %9.3f s/epoch, loss %f and %f\n",
+        denseTime, sparseTime, denseLoss, sparseLoss);
+
+    start = CNNFW_GetTime();
+    if (CNNFW_TrainAsync(Dense, 1, epochs)) return 1;
+    denseTime = (CNNFW_GetTime() - start) / epochs;
+    start = CNNFW_GetTime();
+    if (CNNFW_TrainAsync(Sparse, 1, epochs)) return 1;
+    sparseTime = (CNNFW_GetTime() - start) / epochs;
+    CNNFW_GetLoss(Dense, &denseLoss);
+    CNNFW_GetLoss(Sparse, &sparseLoss);
+    printf("  async:   dense %9.3f s/epoch, sparse %9.3f s/epoch, loss %f and %f\n",
+        denseTime, sparseTime, denseLoss, sparseLoss);
+
+    CNNFW_Free(&Dense);
+    CNNFW_Free(&Sparse);
+    free(indices);
+    free(values);
+    free(targets);
+    free(data);
+    free(outputs);
+    free(sparseOutputs);
+
+    return 0;
+}
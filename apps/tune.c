@@ -0,0 +1,126 @@
+/* Tunes the kernels of a Neural Network with narrow and wide layers and measures the
+batched calculation and the training of it and of an untuned copy, one after another
+in every run. A second Neural Network of the same shapes is tuned from the cache file
+without measuring.
+
+Usage: tune [-n rows] [-f cache_file] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <cNNFW.h>
+
+#define DEFAULT_ROWS 2048
+#define DEFAULT_FILE "tuning.cache"
+
+#define MEASURE_RUNS 5
+
+#define NUM_OF_INPUTS 32
+#define NUM_OF_OUTPUTS 4
+#define NUM_OF_DATA_COLS (NUM_OF_INPUTS + NUM_OF_OUTPUTS)
+
+/* Measures the batched calculation and one epoch of the backpropagation of both Neural
+Networks in turn, so that both see the same load of the machine, the fastest of MEASURE_RUNS runs */
+static int measure(N_NET Default, N_NET Tuned, const double *inputs, size_t rows, double *outputs) {
+    size_t run, k;
+    double start, elapsed, calcTime[2] = { 0.0, 0.0 }, trainTime[2] = { 0.0, 0.0 };
+    N_NET nets[2];
+
+    nets[0] = Default;
+    nets[1] = Tuned;
+    for (run = 0; run < MEASURE_RUNS; run++) {
+        for (k = 0; k < 2; k++) {
+            start = CNNFW_GetTime();
+            if (CNNFW_CalculateBatch(nets[k], inputs, rows, outputs)) return 1;
+            elapsed = CNNFW_GetTime() - start;
+            if (0 == run || elapsed < calcTime[k]) calcTime[k] = elapsed;
+            start = CNNFW_GetTime();
+            if (CNNFW_Train(nets[k])) return 1;
+            elapsed = CNNFW_GetTime() - start;
+            if (0 == run || elapsed < trainTime[k]) trainTime[k] = elapsed;
+        }
+    }
+    printf("  default  calculation %9.0f rows/s, training %9.0f rows/s\n", rows / calcTime[0], rows / trainTime[0]);
+    printf("  tuned    calculation %9.0f rows/s, training %9.0f rows/s\n", rows / calcTime[1], rows / trainTime[1]);
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    size_t rows = DEFAULT_ROWS, measured, i, j;
+    const char *fileName = DEFAULT_FILE;
+    double start, x, diff, maxDiff = 0.0;
+    double *data = NULL, *inputs = NULL, *before = NULL, *after = NULL;
+    N_NET NNetwork = NULL, Default = NULL, Second = NULL;
+    CONFIG config[] = { NUM_OF_INPUTS, 8, 512, 512, NUM_OF_OUTPUTS };
+
+    for (i = 1; i + 1 < (size_t)argc; i += 2) {
+        if (0 == strcmp(argv[i], "-n")) rows = (size_t)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-f")) fileName = argv[i + 1];
+        else break;
+    }
+    if (i != (size_t)argc || 0 == rows) {
+        printf("Usage: %s [-n rows] [-f cache_file]\n", argv[0]);
+        return 1;
+    }
+
+    data = (double *)malloc(sizeof(double) * rows * NUM_OF_DATA_COLS);
+    inputs = (double *)malloc(sizeof(double) * rows * NUM_OF_INPUTS);
+    before = (double *)malloc(sizeof(double) * rows * NUM_OF_OUTPUTS);
+    after = (double *)malloc(sizeof(double) * rows * NUM_OF_OUTPUTS);
+    if (NULL == data || NULL == inputs || NULL == before || NULL == after) {
+        printf("Unsuccessful memory allocation\n");
+        return 1;
+    }
+
+    srand((unsigned int)time(NULL));
+    for (i = 0; i < rows; i++) {
+        x = 0.0;
+        for (j = 0; j < NUM_OF_INPUTS; j++) {
+            inputs[i * NUM_OF_INPUTS + j] = data[i * NUM_OF_DATA_COLS + j] = (double)(rand() % 1001) / 1000.0;
+            x += data[i * NUM_OF_DATA_COLS + j];
+        }
+        for (j = 0; j < NUM_OF_OUTPUTS; j++)
+            data[i * NUM_OF_DATA_COLS + NUM_OF_INPUTS + j] = 0.5 + 0.4 * sin(x / (double)(j + 3));
+    }
+
+    if (create(&NNetwork, config, sizeof(config) / sizeof(config[0]), rows) ||
+        CNNFW_SetDataRows(NNetwork, 0, rows, data)) {
+        printf("Error of Neural Network creating\n");
+        return 1;
+    }
+    CNNFW_SetTrainingMethod(NNetwork, BACKPROPAGATION);
+    CNNFW_SetEpsilonAndLearningStep(NNetwork, 0.01, 0.05);
+    /* The second Neural Network keeps the weights, its outputs are compared before and after the tuning */
+    if (CNNFW_Clone(&Second, NNetwork) || CNNFW_CalculateBatch(Second, inputs, rows, before)) return 1;
+    if (CNNFW_Clone(&Default, NNetwork)) return 1;
+
+    printf("%lu rows, the cache %s\n", (unsigned long)rows, fileName);
+    start = CNNFW_GetTime();
+    if (CNNFW_Tune(NNetwork, fileName, &measured)) return 1;
+    printf("  tuned in %.3f s, %lu shapes measured\n", CNNFW_GetTime() - start, (unsigned long)measured);
+    if (measure(Default, NNetwork, inputs, rows, after)) return 1;
+
+    start = CNNFW_GetTime();
+    if (CNNFW_Tune(Second, fileName, &measured)) return 1;
+    printf("  the second one tuned in %.3f s, %lu shapes measured\n", CNNFW_GetTime() - start, (unsigned long)measured);
+    if (CNNFW_CalculateBatch(Second, inputs, rows, after)) return 1;
+    for (i = 0; i < rows * NUM_OF_OUTPUTS; i++) {
+        diff = fabs(before[i] - after[i]);
+        if (diff > maxDiff) maxDiff = diff;
+    }
+    printf("  max difference of the outputs %g\n", maxDiff);
+
+    CNNFW_Free(&NNetwork);
+    CNNFW_Free(&Default);
+    CNNFW_Free(&Second);
+    free(data);
+    free(inputs);
+    free(before);
+    free(after);
+
+    return 0;
+}
@@ -0,0 +1,91 @@
+/* Measures the speed of wide dense layers: the outputs of a batch of rows
+calculated one row at a time (CNNFW_Calculate), the same batch calculated at
+once (CNNFW_CalculateBatch) and the gradient of the batch (CNNFW_ComputeGradient).
+
+Usage: wide [-w width] [-r rows] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <cNNFW.h>
+
+#define DEFAULT_WIDTH 2048
+#define DEFAULT_ROWS 128
+#define NUM_OF_OUTPUTS 10
+
+static void report(const char *name, double flops, double seconds) {
+    printf("  %-30s %9.3f s %9.2f GFLOP/s\n", name, seconds, flops / seconds / 1e9);
+}
+
+int main(int argc, char *argv[]) {
+    size_t width = DEFAULT_WIDTH, rows = DEFAULT_ROWS, params, i, j;
+    double *data = NULL, *outputs = NULL, *gradient = NULL;
+    double start, flops;
+    N_NET NNetwork = NULL;
+    CONFIG config[4];
+
+    for (i = 1; i + 1 < (size_t)argc; i += 2) {
+        if (0 == strcmp(argv[i], "-w")) width = (size_t)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-r")) rows = (size_t)atoi(argv[i + 1]);
+        else break;
+    }
+    if (i != (size_t)argc || 0 == width || 0 == rows) {
+        printf("Usage: %s [-w width] [-r rows]\n", argv[0]);
+        return 1;
+    }
+
+    /* width inputs, two hidden layers of width neurons, ten outputs */
+    config[0] = config[1] = config[2] = (CONFIG)width;
+    config[3] = NUM_OF_OUTPUTS;
+
+    srand((unsigned int)time(NULL));
+    if (CNNFW_Create(&NNetwork, config, rows)) {
+        printf("Error of Neural Network creating\n");
+        return 1;
+    }
+
+    data = (double *)malloc(sizeof(double) * rows * (width + NUM_OF_OUTPUTS));
+    outputs = (double *)malloc(sizeof(double) * rows * NUM_OF_OUTPUTS);
+    CNNFW_GetParametersCount(NNetwork, &params);
+    gradient = (double *)malloc(sizeof(double) * params);
+    if (NULL == data || NULL == outputs || NULL == gradient) {
+        printf("Unsuccessful memory allocation\n");
+        return 1;
+    }
+    for (i = 0; i < rows; i++)
+        for (j = 0; j < width + NUM_OF_OUTPUTS; j++)
+            data[i * (width + NUM_OF_OUTPUTS) + j] = (double)(rand() % 1001) / 1000.0;
+    CNNFW_SetDataRows(NNetwork, 0, rows, data);
+    for (i = 0; i < rows; i++)
+        memcpy(data + i * width, data + i * (width + NUM_OF_OUTPUTS), sizeof(double) * width);
+
+    /* Two multiplications and additions for each weight and each row */
+    flops = 2.0 * (double)(width * width * 2 + width * NUM_OF_OUTPUTS) * rows;
+    printf("%lu x %lu x %lu x %d, %lu parameters, %lu rows\n", (unsigned long)width, (unsigned long)width,
+        (unsigned long)width, NUM_OF_OUTPUTS, (unsigned long)params, (unsigned long)rows);
+
+    start = CNNFW_GetTime();
+    for (i = 0; i < rows; i++) {
+        set_inputs(NNetwork, data + i * width, width);
+        CNNFW_Calculate(NNetwork);
+    }
+    report("one row at a time", flops, CNNFW_GetTime() - start);
+
+    start = CNNFW_GetTime();
+    CNNFW_CalculateBatch(NNetwork, data, rows, outputs);
+    report("batch", flops, CNNFW_GetTime() - start);
+
+    /* The backward pass costs about twice the forward one */
+    start = CNNFW_GetTime();
+    CNNFW_ComputeGradient(NNetwork, 0, rows, gradient);
+    report("gradient of the batch", 3.0 * flops, CNNFW_GetTime() - start);
+
+    CNNFW_Free(&NNetwork);
+    free(data);
+    free(outputs);
+    free(gradient);
+
+    return 0;
+}
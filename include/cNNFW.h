@@ -28,24 +28,164 @@ typedef enum {
     DISABLE, ENABLE
 } ACTIVATION_FUNCTION;
 
+/* Values DISABLE or ENABLE for the optional features */
+typedef ACTIVATION_FUNCTION FEATURE_STATE;
+
+/* Output formats of the profiler */
+typedef enum {
+    PROFILE_TABLE, PROFILE_JSON
+} PROFILE_FORMAT;
+
 /* The object of the Neural Network */
 typedef void *N_NET;
 
+/* The object of the training data which can be shared by several Neural Networks */
+typedef void *DATASET;
+
+/* The object of a group of processes which sum their gradients in the shared memory */
+typedef void *GROUP;
+
+/* The object of a pipeline which prepares the training data in another thread */
+typedef void *PIPELINE;
+
+/* The object of a served Neural Network which can be replaced while it is being calculated */
+typedef void *MODEL;
+
+/* Training methods used by CNNFW_Train */
+typedef enum {
+    FINITE_DIFFERENCE, BACKPROPAGATION, CENTRAL_DIFFERENCE, LBFGS
+} TRAINING_METHOD;
+
 /* The type of Neural Network configuration */
 typedef unsigned int CONFIG;
 
+/* The pages of the memory of a Neural Network and its training data */
+typedef enum {
+    HUGE_PAGES_NONE, HUGE_PAGES_TRANSPARENT, HUGE_PAGES_EXPLICIT
+} HUGE_PAGES;
+
+/* The placement of the memory on the NUMA nodes */
+typedef enum {
+    NUMA_FIRST_TOUCH, NUMA_INTERLEAVE, NUMA_BIND
+} NUMA_POLICY;
+
+/* Types of the layers of the extended configuration */
+typedef enum {
+    LAYER_DENSE, LAYER_CONV, LAYER_MAX_POOL, LAYER_AVG_POOL
+} LAYER_TYPE;
+
+/* The shape of the inputs of the extended configuration. The inputs are
+* stored channel by channel, each channel row by row. For 1D signals the
+* height is 1 */
+typedef struct {
+    unsigned int channels;
+    unsigned int height;
+    unsigned int width;
+} INPUT_SHAPE;
+
+/* One layer of the extended configuration.
+* LAYER_DENSE:     channels is the number of neurons, the rest is ignored
+* LAYER_CONV:      channels is the number of filters, each filter covers all
+*                  the input channels in a kernelHeight x kernelWidth window
+* LAYER_MAX_POOL,
+* LAYER_AVG_POOL:  channels is ignored, the number of channels does not change
+* For 1D layers leave the height fields 0: the kernel height and the strides
+* equal to 0 are treated as 1 */
+typedef struct {
+    LAYER_TYPE type;
+    unsigned int channels;
+    unsigned int kernelHeight;
+    unsigned int kernelWidth;
+    unsigned int strideHeight;
+    unsigned int strideWidth;
+    unsigned int padHeight;
+    unsigned int padWidth;
+} LAYER_CONFIG;
+
 /* The type of the number of rows in the training data */
 typedef size_t DATA_ROWS;
 
 /* The type of the number of columns in the training data */
 typedef size_t DATA_COLS;
 
+/* The function of a pipeline which writes up to capacity rows of the training data
+* (the inputs followed by the outputs of each row) into buffer and their number into
+* rows. Zero rows mean the end of the data. It is called in the thread of the pipeline,
+* context is the pointer given to CNNFW_CreatePipeline. Returns 0 in case of success,
+* 1 in case of error */
+typedef int (*PRODUCER)(void *context, double *buffer, DATA_ROWS capacity, DATA_ROWS *rows);
+
+/* The statistics of a pipeline, the times are in seconds */
+typedef struct {
+    unsigned long chunks;       /* The number of trained chunks */
+    unsigned long rows;         /* The number of trained rows */
+    double waitTime;            /* The training waited for the next chunk */
+    double trainTime;           /* The training of the chunks */
+    double produceTime;         /* The producer filled the buffers */
+    double stallTime;           /* The producer waited for a free buffer */
+} PIPELINE_STATS;
+
+/* The statistics of the training with LBFGS since the history was discarded */
+typedef struct {
+    unsigned long iterations;   /* The iterations made by CNNFW_Train */
+    unsigned long evaluations;  /* The calculations of the loss and its gradient */
+    unsigned long restarts;     /* The history was discarded, the step went along the gradient */
+    double loss;                /* The loss at the parameters of the Neural Network */
+    double gradientNorm;        /* The norm of the gradient at the parameters of the Neural Network */
+    int converged;              /* 1 - the norm of the gradient is below the tolerance, the next
+                                   iterations do not change the parameters */
+    int stalled;                /* 1 - even a step along the gradient does not decrease the loss,
+                                   the next iterations do not change the parameters */
+} LBFGS_STATS;
+
 /* The step for calculating the gradient numerically */
 typedef double EPSILON;
 
 /* The Neural Network training step */
 typedef double LEARNING_STEP;
 
+/* The ways of CNNFW_Search to choose the trials */
+typedef enum {
+    SEARCH_GRID, SEARCH_RANDOM
+} SEARCH_MODE;
+
+/* The values tried by CNNFW_Search. The configurations are given as to create():
+* configs[i] is an array of configSizes[i] elements */
+typedef struct {
+    size_t configsCount;
+    const CONFIG *const *configs;
+    const size_t *configSizes;
+    size_t epsCount;
+    const EPSILON *eps;
+    size_t stepsCount;
+    const LEARNING_STEP *steps;
+    size_t actFuncsCount;
+    const ACTIVATION_FUNCTION *actFuncs;
+} SEARCH_SPACE;
+
+/* The options of CNNFW_Search */
+typedef struct {
+    SEARCH_MODE mode;
+    size_t trials;              /* The number of the random trials, the grid tries all the combinations */
+    size_t threads;             /* The number of the trials trained at the same time */
+    size_t epochs;              /* The number of epochs of the trials which are not stopped */
+    size_t eta;                 /* Successive halving: only the best 1/eta of the trials go on
+                                   after each round, 0 or 1 - every trial is trained to the end */
+    TRAINING_METHOD method;     /* The training method of all the trials */
+    const char *fileName;       /* The file for the best Neural Network or NULL */
+} SEARCH_OPTIONS;
+
+/* The result of CNNFW_Search */
+typedef struct {
+    size_t trials;              /* The number of the trials */
+    size_t stopped;             /* The trials stopped before the last round or diverged */
+    size_t config;              /* The index of the configuration of the best trial */
+    EPSILON eps;
+    LEARNING_STEP step;
+    ACTIVATION_FUNCTION actFunc;
+    double loss;                /* The loss of the best trial */
+} SEARCH_RESULT;
+
 
 /** Creating a neural network using the specified parameters in the config array.
 * Use the CNNFW_Create(config) macro to create a neural network to avoid errors
@@ -69,7 +209,9 @@ typedef double LEARNING_STEP;
 * @param   rows     Number of rows in the data. The number of data
 *                   columns is taken from the neural network
 *                   configuration and it is equal to the number of
-*                   inputs plus the number of outputs
+*                   inputs plus the number of outputs. If it is 0,
+*                   the neural network has no own training data,
+*                   use CNNFW_AttachData or CNNFW_BorrowData to give it one
 * @return           Pointer to neural network. NULL in case of an error
 */
 #define CNNFW_Create(NNetwork, config, rows) create((NNetwork), (config), sizeof((config))/sizeof((config)[0]), (rows))
@@ -78,6 +220,27 @@ typedef double LEARNING_STEP;
 int create(N_NET *NNetwork, CONFIG *config, size_t configSize, DATA_ROWS rows);
 
 
+/** Creating a neural network from the extended configuration which, besides the
+* fully connected (dense) layers, can contain convolutional and pooling layers.
+* Use the CNNFW_CreateEx macro to avoid errors with the number of layers.
+* The convolutions are calculated as a matrix multiplication of the filters and
+* the unrolled windows of the input (im2col). Each layer except the output one
+* has one bias and uses the activation function, pooling layers have neither
+* weights nor bias. The outputs are all the values of the last layer
+*
+* @param   NNetwork Neural Network object
+* @param   shape    The shape of the inputs
+* @param   layers   Array of the configurations of the layers
+* @param   rows     Number of rows in the data. The number of data
+*                   columns is equal to the number of inputs plus
+*                   the number of outputs
+* @return           0 in case of success, 1 in case of error
+*/
+#define CNNFW_CreateEx(NNetwork, shape, layers, rows) create_ex((NNetwork), (shape), (layers), sizeof((layers))/sizeof((layers)[0]), (rows))
+/** Use the CNNFW_CreateEx macro to avoid errors with the number of layers */
+int create_ex(N_NET *NNetwork, const INPUT_SHAPE *shape, const LAYER_CONFIG *layers, size_t layersSize, DATA_ROWS rows);
+
+
 /** The function of enabling or disabling the activation function
 *
 * @param    NNetwork    Neural Network object
@@ -87,14 +250,62 @@ int create(N_NET *NNetwork, CONFIG *config, size_t configSize, DATA_ROWS rows);
 int CNNFW_SetActivationFunction(N_NET NNetwork, ACTIVATION_FUNCTION state);
 
 
-/** Creating an object that will store data for training
+/** Creating an object that will store data for training. The same object can be
+* attached to any number of Neural Networks with CNNFW_AttachData, it is freed when
+* the last of its users releases it. The data can be changed only while nobody
+* else uses it, so fill it before attaching
 *
+* @param   Data    Pointer to the data object, it must be NULL
 * @param   rows    Number of rows of data
 * @param   cols    The number of columns in each row of data
 *
-* @return          A pointer to an object with training data. NULL in case of an error
+* @return          0 in case of success, 1 in case of error
+*/
+int CNNFW_CreateData(DATASET *Data, DATA_ROWS rows, DATA_COLS cols);
+
+
+/** Copies a range of whole rows into the data object
+*
+* @param    Data        Data object
+* @param    firstRow    The index of the first row to be written
+* @param    rowsCount   The number of rows to be written
+* @param    buffer      A pointer to rowsCount * columns values
+*
+* @return               0 in case of success, 1 in case of error
 */
-/* DATASET CNNFW_CreateData(DATASET *Data, NUM_OF_ROWS rows, NUM_OF_COLS cols); */
+int CNNFW_SetDatasetRows(DATASET Data, DATA_ROWS firstRow, DATA_ROWS rowsCount, const double *buffer);
+
+
+/** Writes a new value to a specific position in the data object
+*
+* @param    Data        Data object
+* @param    rowIndex    The index of the row in which you want to set a specific value
+* @param    colIndex    The index of the column in which you want to set a specific value
+* @param    value       The written value
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_SetValueInDataset(DATASET Data, DATA_ROWS rowIndex, DATA_COLS colIndex, double value);
+
+
+/** Makes the Neural Network use the data object as its training data without copying it.
+* The previous training data of the Neural Network is released. While the data is
+* shared, it cannot be changed through the Neural Network
+*
+* @param    NNetwork    Neural Network object
+* @param    Data        Data object, its number of columns must be equal to
+*                       the number of inputs plus the number of outputs
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_AttachData(N_NET NNetwork, DATASET Data);
+
+
+/** Releases the data object. The memory is freed when no Neural Network uses it anymore
+*
+* @param    Data    A pointer to the data object
+*/
+void CNNFW_FreeData(DATASET *Data);
 
 
 /** Writes new input values to the neural network object.
@@ -137,6 +348,99 @@ int CNNFW_SetValueInData(N_NET NNetwork, DATA_ROWS rowIndex, DATA_COLS colIndex,
 int CNNFW_GetValueFromData(N_NET NNetwork, DATA_ROWS rowIndex, DATA_COLS colIndex, double *retValue);
 
 
+/** Copies a range of whole rows into the training data. The rows in the buffer
+* are stored one after another, each of them has as many columns as the training
+* data (the number of inputs plus the number of outputs)
+*
+* @param    NNetwork    Neural Network object
+* @param    firstRow    The index of the first row to be written
+* @param    rowsCount   The number of rows to be written
+* @param    buffer      A pointer to rowsCount * columns values
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_SetDataRows(N_NET NNetwork, DATA_ROWS firstRow, DATA_ROWS rowsCount, const double *buffer);
+
+
+/** Uses a caller-owned buffer as the training data without copying it.
+* The rows in the buffer are stored one after another, each of them has as many
+* columns as the training data (the number of inputs plus the number of outputs).
+* The library never frees the buffer, it must stay valid until CNNFW_ReleaseData,
+* the next CNNFW_BorrowData or CNNFW_Free is called. The clones made by CNNFW_Clone
+* use the same buffer, so it must also outlive every clone (or their own release).
+* CNNFW_SetValueInData and CNNFW_SetDataRows write directly into the buffer.
+* CNNFW_SaveToFile writes the rows of the buffer into the file, CNNFW_LoadFromFile
+* reads them into training data owned by the loaded Neural Network
+*
+* @param    NNetwork    Neural Network object
+* @param    buffer      A pointer to rows * columns values
+* @param    rows        Number of rows in the buffer
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_BorrowData(N_NET NNetwork, double *buffer, DATA_ROWS rows);
+
+
+/** Stops using the borrowed buffer and returns to the training data the Neural Network had before
+*
+* @param    NNetwork    Neural Network object
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_ReleaseData(N_NET NNetwork);
+
+
+/** Copies sparse rows (the compressed sparse row format) into the training data of wide inputs
+* with few non-zero values. The non-zero inputs of the row r are indices[offsets[r]] ...
+* indices[offsets[r + 1] - 1] with the same elements of values, the other inputs are zeros.
+* While the sparse data is set, it is used instead of the dense data by CNNFW_Train with
+* BACKPROPAGATION, CNNFW_ComputeGradient, CNNFW_GetLoss and CNNFW_TrainAsync, so the first
+* layer costs as many operations as there are non-zero inputs. The sparse data is shared
+* by the clones and is not saved by CNNFW_SaveToFile
+*
+* @param    NNetwork    Neural Network object, its first layer must be dense
+* @param    rows        The number of rows, 0 removes the sparse data
+* @param    offsets     rows + 1 offsets of the rows in indices and values
+* @param    indices     The indices of the non-zero inputs of all the rows
+* @param    values      The values of the non-zero inputs of all the rows
+* @param    targets     rows sets of outputs stored one after another
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_SetSparseData(N_NET NNetwork, DATA_ROWS rows, const size_t *offsets, const size_t *indices,
+    const double *values, const double *targets);
+
+
+/** Switches the Neural Network object to the online mode. The training data is replaced by
+* a ring of the recent rows followed by a reservoir which keeps a uniform sample of the rows
+* that have left the ring. The memory is allocated once, CNNFW_PushRows and CNNFW_TrainNewest
+* never allocate it again, except for the first CNNFW_PushRows after a clone was made: the clone
+* keeps the rows as they were and the Neural Network gets its own copy of them. CNNFW_Train,
+* CNNFW_GetLoss and CNNFW_TrainAsync use all the filled rows of the ring and the reservoir.
+* CNNFW_AttachData ends the online mode
+*
+* @param    NNetwork    Neural Network object
+* @param    recent      The number of rows of the ring
+* @param    reservoir   The number of rows of the reservoir, 0 for the ring only
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_SetOnline(N_NET NNetwork, DATA_ROWS recent, DATA_ROWS reservoir);
+
+
+/** Adds rows to the ring of the online mode. When the ring is full, every new row replaces
+* the oldest one and the oldest row may replace a random row of the reservoir. The rows in
+* the buffer are stored as by CNNFW_SetDataRows
+*
+* @param    NNetwork    Neural Network object in the online mode
+* @param    rows        A pointer to count * columns values
+* @param    count       The number of rows
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_PushRows(N_NET NNetwork, const double *rows, DATA_ROWS count);
+
+
 /** Writes a new input value to one specific input of the Neural Network object
 *
 * @param    NNetwork    Neural Network object
@@ -148,7 +452,25 @@ int CNNFW_GetValueFromData(N_NET NNetwork, DATA_ROWS rowIndex, DATA_COLS colInde
 int CNNFW_SetInput(N_NET NNetwork, size_t index, double value);
 
 
-/** Neural network training. One call to this function is equal to one epoch
+/** Sets the inputs of the Neural Network object as pairs of an index and a value, the other
+* inputs are zeros and the values of the same index are summed. CNNFW_Calculate then reads only
+* the weights of the given inputs in the first layer. The next set_inputs or CNNFW_SetInput
+* returns to the dense inputs
+*
+* @param    NNetwork    Neural Network object, its first layer must be dense
+* @param    indices     The indices of the non-zero inputs
+* @param    values      The values of the non-zero inputs
+* @param    count       The number of the pairs
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_SetSparseInputs(N_NET NNetwork, const size_t *indices, const double *values, size_t count);
+
+
+/** Neural network training. One call to this function is equal to one epoch.
+* By default the gradient is calculated numerically by finite differences and each
+* parameter is updated right after its derivative is known, use
+* CNNFW_SetTrainingMethod to switch to the gradient descent with backpropagation
 *
 * @param    NNetwork    Neural Network object
 * @param    Data        Data object to training
@@ -161,6 +483,279 @@ int CNNFW_SetInput(N_NET NNetwork, size_t index, double value);
 int CNNFW_Train(N_NET NNetwork);
 
 
+/** Calculates the loss of the Neural Network on its training data: the mean over the
+* rows of the sum of the squared errors of the outputs
+*
+* @param    NNetwork    Neural Network object
+* @param    loss        The loss
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_GetLoss(N_NET NNetwork, double *loss);
+
+
+/** One step of the gradient descent over the newest rows of the ring of the online mode.
+* The gradient is calculated with the backpropagation whatever the training method is,
+* the step costs as much as count rows however large the ring and the reservoir are
+*
+* @param    NNetwork    Neural Network object in the online mode
+* @param    count       The number of the newest rows, up to the filled rows of the ring
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_TrainNewest(N_NET NNetwork, DATA_ROWS count);
+
+
+/** Asynchronous training with several threads: epochs passes of the stochastic
+* gradient descent over the rows of the training data. Each thread takes the next
+* rows, calculates the gradient of each row by backpropagation in its own buffers
+* and updates the common weights right away without any locks (Hogwild), the
+* calling thread is one of them. The updates of the threads may overwrite each
+* other, so the result differs from run to run. The learning step is applied to
+* the gradient of the squared error of one row. Do not use the Neural Network in
+* other threads during the call
+*
+* @param    NNetwork    Neural Network object
+* @param    threads     The number of threads
+* @param    epochs      The number of passes over the rows
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_TrainAsync(N_NET NNetwork, size_t threads, size_t epochs);
+
+
+/** Pins the threads of CNNFW_TrainAsync to the processors: the n-th thread runs on the
+* n-th processor the process is allowed to use, the calling thread is the first one and
+* gets its own affinity back at the end. Each thread allocates its buffers after it is
+* pinned, so they are placed on its NUMA node. It is disabled by default
+*
+* @param    NNetwork    Neural Network object
+* @param    state       The state is ENABLE or DISABLE
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_SetThreadPinning(N_NET NNetwork, FEATURE_STATE state);
+
+
+/** Moves the Neural Network and its training data into memory with the given pages and
+* NUMA placement. The training data is moved only if it is not shared and not borrowed.
+* With NUMA_FIRST_TOUCH the memory is placed on the node of the calling thread,
+* NUMA_INTERLEAVE spreads its pages over all the nodes and NUMA_BIND puts them on the
+* node. HUGE_PAGES_TRANSPARENT asks the kernel for transparent huge pages and
+* HUGE_PAGES_EXPLICIT takes them from the reserved ones (vm.nr_hugepages).
+* HUGE_PAGES_NONE with NUMA_FIRST_TOUCH returns to the usual allocation, which the clones
+* and the loaded Neural Networks use too. Only the usual allocation is supported on
+* systems other than Linux. The object gets a new address, like after CNNFW_Free the old
+* one must not be used
+*
+* @param    NNetwork    Pointer to the Neural Network object
+* @param    pages       HUGE_PAGES_NONE, HUGE_PAGES_TRANSPARENT or HUGE_PAGES_EXPLICIT
+* @param    numa        NUMA_FIRST_TOUCH, NUMA_INTERLEAVE or NUMA_BIND
+* @param    node        The node of NUMA_BIND
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_SetMemoryPolicy(N_NET *NNetwork, HUGE_PAGES pages, NUMA_POLICY numa, unsigned int node);
+
+
+/** Creates a pipeline of depth buffers of capacity rows each and starts its thread,
+* which fills the free buffers with the producer one after another. While one buffer
+* is trained by CNNFW_TrainPipeline, the next ones are being filled
+*
+* @param    Pipeline    Pipeline object, it must be NULL
+* @param    NNetwork    Neural Network object which gives the number of the columns
+* @param    capacity    The maximum number of rows in a buffer
+* @param    depth       The number of buffers, at least 2 to fill one while training another
+* @param    producer    The function which fills a buffer
+* @param    context     The argument of the producer
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_CreatePipeline(PIPELINE *Pipeline, N_NET NNetwork, DATA_ROWS capacity, size_t depth, PRODUCER producer, void *context);
+
+
+/** Trains the Neural Network on the chunks of the pipeline: each filled buffer becomes
+* the training data for epochs calls of CNNFW_Train and then is given back to the producer.
+* The training data the Neural Network had before is restored at the end
+*
+* @param    NNetwork    Neural Network object
+* @param    Pipeline    Pipeline object
+* @param    chunks      The maximum number of chunks, 0 - until the end of the data
+* @param    epochs      The number of epochs for each chunk
+*
+* @return               0 in case of success, 1 in case of error (of the producer too)
+*/
+int CNNFW_TrainPipeline(N_NET NNetwork, PIPELINE Pipeline, size_t chunks, size_t epochs);
+
+
+/** Reads the statistics of the pipeline
+*
+* @param    Pipeline    Pipeline object
+* @param    stats       The statistics
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_GetPipelineStats(PIPELINE Pipeline, PIPELINE_STATS *stats);
+
+
+/** Stops the thread of the pipeline and frees it
+*
+* @param    Pipeline    Pipeline object
+*/
+void CNNFW_FreePipeline(PIPELINE *Pipeline);
+
+
+/** Creates a model object which serves the Neural Network to readers, e.g. the threads of
+* a server. The model object takes the Neural Network and sets it to NULL
+*
+* @param    Model       Model object, it must be NULL
+* @param    NNetwork    Pointer to the Neural Network object
+* @param    readers     The number of readers, each of them calculates with its own buffers
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_CreateModel(MODEL *Model, N_NET *NNetwork, size_t readers);
+
+
+/** Calculates the outputs of the current Neural Network of the model object for several sets
+* of inputs, as CNNFW_CalculateBatch does. The readers never wait for each other or for
+* CNNFW_SwapModel, a reader index must be used by one thread at a time
+*
+* @param   Model       Model object
+* @param   reader      The index of the reader, from 0 to readers - 1
+* @param   inputs      count sets of inputs stored one after another
+* @param   count       The number of sets of inputs
+* @param   outputs     The buffer for count sets of outputs stored one after another
+*
+* @return              0 in case of success, 1 in case of error
+*/
+int CNNFW_ModelCalculate(MODEL Model, size_t reader, const double *inputs, size_t count, double *outputs);
+
+
+/** Replaces the Neural Network of the model object while the readers go on calculating.
+* The buffers of the new version are prepared first, then it is published by one pointer
+* store. The old Neural Network is freed as soon as the readers which could have taken it
+* are done, the calling thread waits for that. The model object takes the new Neural Network
+* and sets it to NULL, it must have the same numbers of inputs and outputs
+*
+* @param    Model       Model object
+* @param    NNetwork    Pointer to the new Neural Network object
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_SwapModel(MODEL Model, N_NET *NNetwork);
+
+
+/** Loads a Neural Network from the file and swaps it into the model object by CNNFW_SwapModel
+*
+* @param    Model       Model object
+* @param    fileName    The file saved by CNNFW_SaveToFile
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_ReloadModel(MODEL Model, const char *fileName);
+
+
+/** Frees the model object with its Neural Network, no reader may use it any more
+*
+* @param    Model       Model object
+*/
+void CNNFW_FreeModel(MODEL *Model);
+
+
+/** Sets the training method used by CNNFW_Train. FINITE_DIFFERENCE (by default)
+* calculates the derivatives numerically with the epsilon, CENTRAL_DIFFERENCE does
+* the same with the central differences, which are more precise but need two
+* calculations per parameter. Both keep the values of the layers of every row and
+* calculate only the layers from the changed parameter to the output.
+* BACKPROPAGATION calculates the gradient of the loss over all the rows analytically
+* and updates all the parameters at once with the learning step. LBFGS makes an iteration
+* of the limited-memory BFGS with the same gradient: the step goes along the direction
+* from the history of the previous steps and its length is found by a line search, the
+* learning step is not used
+*
+* @param    NNetwork    Neural Network object
+* @param    method      FINITE_DIFFERENCE, CENTRAL_DIFFERENCE, BACKPROPAGATION or LBFGS
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_SetTrainingMethod(N_NET NNetwork, TRAINING_METHOD method);
+
+
+/** Sets the number of the previous steps kept by LBFGS (8 by default) and discards the
+* history and the statistics. The history is also discarded when the parameters or the
+* training data were changed by the library since the last iteration (a borrowed buffer
+* changed by the caller is not noticed, borrow it again after the change). When the direction
+* from the history is almost orthogonal to the gradient or a step does not decrease the loss,
+* the history is discarded and the step goes along the gradient. The iterations stop when the
+* norm of the gradient is below 1e-5, relative to the loss if it is greater than 1 (converged),
+* or when even a step along the gradient does not decrease the loss (stalled)
+*
+* @param    NNetwork    Neural Network object
+* @param    history     The number of the kept steps, at least 1
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_SetLBFGSHistory(N_NET NNetwork, size_t history);
+
+
+/** Takes the statistics of the training with LBFGS
+*
+* @param    NNetwork    Neural Network object
+* @param    stats       The pointer by which the statistics will be saved
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_GetLBFGSStats(N_NET NNetwork, LBFGS_STATS *stats);
+
+
+/** Calculates the gradient of the loss by backpropagation over a part of the rows
+* of the training data. Each row contributes its squared error divided by the
+* number of all the rows, so the gradients of the parts of the data add up to the
+* gradient of the whole data. The gradient has CNNFW_GetParametersCount elements
+* in the order of CNNFW_GetParameters. The weights do not change
+*
+* @param    NNetwork    Neural Network object
+* @param    firstRow    The index of the first row
+* @param    rowsCount   The number of rows
+* @param    gradient    The buffer for the gradient
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_ComputeGradient(N_NET NNetwork, DATA_ROWS firstRow, DATA_ROWS rowsCount, double *gradient);
+
+
+/** Subtracts the gradient multiplied by the learning step from the parameters
+*
+* @param    NNetwork    Neural Network object
+* @param    gradient    The gradient in the order of CNNFW_GetParameters
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_ApplyGradient(N_NET NNetwork, const double *gradient);
+
+
+/** Copies all the parameters of a Neural Network object: the weights of all the
+* layers one after another followed by the biases of the hidden layers
+*
+* @param    NNetwork    Neural Network object
+* @param    parameters  The buffer for CNNFW_GetParametersCount values
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_GetParameters(N_NET NNetwork, double *parameters);
+
+
+/** Sets all the parameters of a Neural Network object in the order of CNNFW_GetParameters
+*
+* @param    NNetwork    Neural Network object
+* @param    parameters  CNNFW_GetParametersCount values
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_SetParameters(N_NET NNetwork, const double *parameters);
+
+
 /** Takes a specific output value from a Neural Network object
 *
 * @param    NNetwork    Neural Network object
@@ -172,6 +767,31 @@ int CNNFW_Train(N_NET NNetwork);
 int CNNFW_GetOutput(N_NET NNetwork, size_t index, double *retValue);
 
 
+/** Gives read-only access to all the output values of a Neural Network object.
+* The pointer stays valid until the Neural Network object is freed. The pending lazy
+* outputs are calculated first. Without the lazy outputs the values are updated by each
+* CNNFW_Calculate call. With them the values are those of the last calculation only until
+* the next CNNFW_Calculate, call CNNFW_GetOutputs again after it to get the new ones
+*
+* @param    NNetwork    Neural Network object
+* @param    outputs     The pointer by which the address of the output values will be saved
+* @param    count       The pointer by which the number of outputs will be saved
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_GetOutputs(N_NET NNetwork, const double **outputs, size_t *count);
+
+
+/** Takes the number of trainable parameters (weights and biases) of a Neural Network object
+*
+* @param    NNetwork    Neural Network object
+* @param    count       The pointer by which the number of parameters will be saved
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_GetParametersCount(N_NET NNetwork, size_t *count);
+
+
 /** Experimental parameter "mutation" function for the implementation of a genetic algorithm
 *
 * @param    NNetwork            Neural Network object
@@ -215,6 +835,98 @@ int CNNFW_SetEpsilonAndLearningStep(N_NET NNetwork, EPSILON eps, LEARNING_STEP s
 int CNNFW_Calculate(N_NET NNetwork);
 
 
+/** Enables or disables the lazy outputs. When they are enabled, CNNFW_Calculate calculates
+* only the hidden layers and an output is calculated when it is taken by CNNFW_GetOutput for
+* the first time, the other outputs are not calculated at all. CNNFW_GetOutputs and
+* CNNFW_PrintOutputs calculate all of them, the values given by CNNFW_GetOutputs are not
+* updated by the next CNNFW_Calculate until CNNFW_GetOutputs is called again. The outputs
+* are calculated with the weights at the time they are taken. A Neural Network with a single
+* layer or with a convolution or pooling output layer calculates all its outputs anyway.
+* It is disabled by default
+*
+* @param    NNetwork    Neural Network object
+* @param    state       The state is ENABLE or DISABLE
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_SetLazyOutputs(N_NET NNetwork, FEATURE_STATE state);
+
+
+/** Calculation of the outputs of the neural network for several sets of inputs at once.
+* The sets are calculated in tiles of several rows, each dense layer of a tile is one
+* matrix multiplication. The values of the weights and of the neurons do not change
+*
+* @param   NNetwork    Neural Network object
+* @param   inputs      count sets of inputs stored one after another
+* @param   count       The number of sets of inputs
+* @param   outputs     The buffer for count sets of outputs stored one after another
+*
+* @return              0 in case of success, 1 in case of error
+*/
+int CNNFW_CalculateBatch(N_NET NNetwork, const double *inputs, size_t count, double *outputs);
+
+
+/** The same as CNNFW_CalculateBatch for the outputs selected by the mask only. Of a dense
+* output layer only the weights of the selected outputs are read
+*
+* @param   NNetwork    Neural Network object
+* @param   inputs      count sets of inputs stored one after another
+* @param   count       The number of sets of inputs
+* @param   mask        A value for every output, the outputs which are not 0 are calculated
+* @param   outputs     The buffer for count sets of the selected outputs stored one after another,
+*                      the outputs of a set go in the order of their indices
+*
+* @return              0 in case of success, 1 in case of error
+*/
+int CNNFW_CalculateBatchMasked(N_NET NNetwork, const double *inputs, size_t count, const unsigned char *mask, double *outputs);
+
+
+/** The same as CNNFW_CalculateBatch for sparse sets of inputs stored as by CNNFW_SetSparseData.
+* The first layer reads only the weights of the non-zero inputs
+*
+* @param   NNetwork    Neural Network object, its first layer must be dense
+* @param   offsets     count + 1 offsets of the sets in indices and values
+* @param   indices     The indices of the non-zero inputs of all the sets
+* @param   values      The values of the non-zero inputs of all the sets
+* @param   count       The number of sets of inputs
+* @param   outputs     The buffer for count sets of outputs stored one after another
+*
+* @return              0 in case of success, 1 in case of error
+*/
+int CNNFW_CalculateSparseBatch(N_NET NNetwork, const size_t *offsets, const size_t *indices, const double *values,
+    size_t count, double *outputs);
+
+
+/** Tunes the kernels of a Neural Network object for this machine: the number of rows the
+* batched passes calculate together (the tile) and for every dense layer the matrix
+* multiplication by simple loops or by packed blocks. The variants are measured (the median
+* of several runs) and a variant replaces the default one only if it is faster by more than
+* the noise of the measurements. The chosen ones are stored in the cache file for the model
+* of the processor and the shapes of the layers, the variants found in the cache are taken
+* without measuring. The tuning is not saved with the Neural Network, call it after
+* CNNFW_Create or CNNFW_LoadFromFile
+*
+* @param   NNetwork    Neural Network object
+* @param   fileName    The name of the cache file or NULL to measure without a cache
+* @param   measured    The pointer by which the number of the measured shapes will be saved or NULL,
+*                      0 if all of them were found in the cache
+*
+* @return              0 in case of success, 1 in case of error
+*/
+int CNNFW_Tune(N_NET NNetwork, const char *fileName, size_t *measured);
+
+
+/** Takes the number of inputs and the number of outputs of a Neural Network object
+*
+* @param    NNetwork    Neural Network object
+* @param    inputs      The pointer by which the number of inputs will be saved
+* @param    outputs     The pointer by which the number of outputs will be saved
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_GetInputsAndOutputsCount(N_NET NNetwork, size_t *inputs, size_t *outputs);
+
+
 /** Displaying all the values of the Neural Network object
 *
 * @param    NeuralNetwork   Neural Network object
@@ -229,7 +941,125 @@ void CNNFW_Print(N_NET NeuralNetwork);
 void CNNFW_PrintOutputs(N_NET NNetwork);
 
 
-/** Saving the entire Neural Network object with all its parameters to a fileName file
+/** Enables or disables the profiler. When it is enabled, CNNFW_Calculate, CNNFW_CalculateBatch
+* and CNNFW_Train record for each layer and each phase (forward, activation, loss, backward, update)
+* the wall time, the number of calls, the number of floating point operations and the number of
+* bytes touched. On Linux the cycles, the instructions and the cache misses of the calling thread
+* can also be read from the hardware counters (perf_event_open). When the profiler is
+* disabled it costs nothing. Enabling it again resets the collected values
+*
+* @param    NNetwork    Neural Network object
+* @param    state       The state is ENABLE or DISABLE
+* @param    hwCounters  ENABLE to read the hardware counters as well, DISABLE to measure only the time
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_SetProfiling(N_NET NNetwork, FEATURE_STATE state, FEATURE_STATE hwCounters);
+
+
+/** Resets all the values collected by the profiler
+*
+* @param    NNetwork    Neural Network object
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_ResetProfile(N_NET NNetwork);
+
+
+/** Writes the values collected by the profiler as a table or as JSON
+*
+* @param    NNetwork    Neural Network object
+* @param    fileName    The path to the file where the profile will be written, NULL to print it
+* @param    format      PROFILE_TABLE or PROFILE_JSON
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_SaveProfile(N_NET NNetwork, const char *fileName, PROFILE_FORMAT format);
+
+
+/** Returns the time which the profiler measures, in seconds from an arbitrary point.
+* The clock is monotonic, the differences of two values are the elapsed time
+*
+* @return               The time in seconds
+*/
+double CNNFW_GetTime(void);
+
+
+/** Making a copy of a Neural Network object in memory. The copy gets its own weights,
+* the training data is not copied, but shared with the source. A buffer of CNNFW_BorrowData
+* stays borrowed by the copy and must outlive it. The copy of a Neural Network in the online
+* mode gets the rows of the ring and the reservoir as ordinary training data
+*
+* @param   NNdst       Pointer to the new Neural Network object, it must be NULL
+* @param   NNsrc       Source Neural Network object
+*
+* @return              0 in case of success, 1 in case of error
+*/
+int CNNFW_Clone(N_NET *NNdst, N_NET NNsrc);
+
+
+/** Creates a group of processes which sum their buffers in the shared memory
+* (data-parallel training). Create the group before the processes are forked,
+* each of them then calls CNNFW_AllReduce with its own rank. Available only on
+* POSIX systems
+*
+* @param    Group       Group object
+* @param    processes   The number of processes in the group
+* @param    length      The number of values in the buffer of each process
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_CreateGroup(GROUP *Group, size_t processes, size_t length);
+
+
+/** Replaces the buffer of each process of the group by the sum of the buffers of
+* all the processes. The call returns when all the processes have called it.
+* The values are always summed in the order of the ranks, ((b0 + b1) + b2) + ...,
+* so the result is the same from run to run and can be reproduced by one process
+*
+* @param    Group       Group object
+* @param    rank        The rank of the calling process, from 0 to processes - 1
+* @param    buffer      The buffer of length values
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_AllReduce(GROUP Group, size_t rank, double *buffer);
+
+
+/** Frees up the shared memory of the group in the calling process
+*
+* @param    Group       Group object
+*/
+void CNNFW_FreeGroup(GROUP *Group);
+
+
+/** Searches for the best configuration and training parameters. Every trial is a new
+* Neural Network with its own combination of the values of the space: all of them
+* (SEARCH_GRID) or options->trials random ones (SEARCH_RANDOM). The trials share the
+* training data without copying it and are trained by a pool of threads. With the
+* successive halving the trials are trained in rounds and only the best part of them
+* goes on to the next round with more epochs, the trials whose loss is not a finite
+* number are stopped at once. The loss is calculated on the validation data if it is
+* given, otherwise on the training data. The best Neural Network is saved to
+* options->fileName by CNNFW_SaveToFile
+*
+* @param    Data        The training data
+* @param    Validation  The validation data or NULL
+* @param    space       The tried values
+* @param    options     The options of the search
+* @param    Best        The pointer for the best Neural Network, it must point to NULL, or NULL
+* @param    result      The result of the search, or NULL
+*
+* @return               0 in case of success, 1 in case of error
+*/
+int CNNFW_Search(DATASET Data, DATASET Validation, const SEARCH_SPACE *space, const SEARCH_OPTIONS *options,
+    N_NET *Best, SEARCH_RESULT *result);
+
+
+/** Saving the entire Neural Network object with all its parameters to a fileName file.
+* The training data is saved too, also the rows of a buffer given to CNNFW_BorrowData,
+* the sparse training data is not. The file begins with a magic number and the version
+* of the format, CNNFW_LoadFromFile rejects the files of other versions
 *
 * @param   NNetwork    Neural Network object
 * @param   fileName    The path to the file where the Neural Network will be saved
@@ -20,40 +20,270 @@ TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
 SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. */
 
 
+#if defined(__linux__)
+#define _GNU_SOURCE
+#elif defined(__APPLE__)
+#define _DARWIN_C_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <time.h>
 
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
 #include <cNNFW.h>
 
+/* Atomically adds to a long and returns the new value */
+#if defined(__GNUC__)
+#define ATOMIC_ADD(ptr, val) __sync_add_and_fetch((ptr), (val))
+#elif defined(_WIN32)
+#define ATOMIC_ADD(ptr, val) (InterlockedExchangeAdd((volatile LONG *)(ptr), (LONG)(val)) + (LONG)(val))
+#else
+#error "No atomic addition for this compiler"
+#endif
+
+/* Sequentially consistent loads and stores, older compilers get volatile accesses after full barriers */
+#if defined(__GNUC__) && defined(__ATOMIC_SEQ_CST)
+#define ATOMIC_LOAD(ptr) __atomic_load_n((ptr), __ATOMIC_SEQ_CST)
+#define ATOMIC_STORE(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_SEQ_CST)
+#elif defined(__GNUC__)
+#define ATOMIC_LOAD(ptr) (__sync_synchronize(), *(ptr))
+#define ATOMIC_STORE(ptr, val) (__sync_synchronize(), *(ptr) = (val), __sync_synchronize())
+#elif defined(_WIN32)
+#define ATOMIC_LOAD(ptr) (MemoryBarrier(), *(ptr))
+#define ATOMIC_STORE(ptr, val) (MemoryBarrier(), *(ptr) = (val), MemoryBarrier())
+#else
+#define ATOMIC_LOAD(ptr) (*(ptr))
+#define ATOMIC_STORE(ptr, val) (*(ptr) = (val))
+#endif
+
+/* The size of a cache line, the data of different threads is kept in different lines */
+#define CACHE_LINE 64
+
+/* The number of rows calculated together by the batched passes, unless it is tuned */
+#define ROWS_TILE 64
+
+/* The number of the previous steps kept by LBFGS by default */
+#define LBFGS_HISTORY 8
+
+/* Training data which can be shared by several Neural Networks. It is read-only
+* as long as more than one reference to it exists */
+typedef struct {
+    long refs;
+    size_t rows;
+    size_t cols;
+    double *data;
+    size_t mapped;
+} SET, *p_SET;
+
+/* The version changes with every change of the rows (or of the sparse training data),
+* LBFGS discards its history when it changes */
 typedef struct {
     size_t rows;
     size_t cols;
-    double **data;
+    double *data;
+    p_SET set;
+    unsigned long version;
 } DATA_TRAIN, *p_DATA_TRAIN;
 
+/* Sparse rows of inputs (the compressed sparse row format): the non-zero inputs of the row r
+* are indices[offsets[r]] ... indices[offsets[r + 1] - 1] with their values. The training data
+* also has the outputs of every row, the sparse inputs of the Neural Network are one row
+* which has 0 rows while the inputs are set densely. The data is read-only while it is shared */
+typedef struct {
+    long refs;
+    size_t rows;
+    size_t length;
+    double *values;
+    double *targets;
+    size_t *offsets;
+    size_t *indices;
+} SPARSE, *p_SPARSE;
+
+/* The online mode: the training data is a ring of the recent rows followed by a reservoir
+* with a uniform sample of the rows which have left the ring. The filled rows are always
+* the first rows of the data, so the ring is filled before the reservoir */
+typedef struct {
+    size_t recent;
+    size_t reservoir;
+    size_t next;
+    size_t filled;
+    size_t sampled;
+    unsigned long evicted;
+} ONLINE, *p_ONLINE;
+
+/* The outputs calculated on demand: CNNFW_Calculate leaves them pending and an output
+* is calculated from the values of the last hidden layer when it is taken first */
+typedef struct {
+    int pending;
+    unsigned char *ready;
+} LAZY, *p_LAZY;
+
+/* The state of LBFGS between the iterations: the parameters of the last iteration with
+* their loss and gradient and a ring of the last steps s with the changes of the gradient y */
+typedef struct {
+    size_t length;
+    size_t history;
+    size_t count;
+    size_t next;
+    int valid;
+    unsigned long version;
+    double loss;
+    LBFGS_STATS stats;
+    double *x;
+    double *g;
+    double *d;
+    double *xNew;
+    double *gNew;
+    double *rho;
+    double *alpha;
+    double *s;
+    double *y;
+} LBFGS_MEMORY, *p_LBFGS_MEMORY;
+
 typedef struct {
     size_t inpLen;
     double *inputs;
 } INPUT, *p_INPUTS;
 
 typedef struct {
-    double value;
     size_t weiLen;
     double *weights;
 } NEURON, *p_NEURON;
 
+/* The shapes of the input and the output of a layer and the window of a convolution or a pooling */
+typedef struct {
+    size_t inChannels, inHeight, inWidth;
+    size_t outChannels, outHeight, outWidth;
+    size_t kerHeight, kerWidth;
+    size_t strHeight, strWidth;
+    size_t padHeight, padWidth;
+} GEOMETRY;
+
+/* The matrix multiplication of a dense layer: chosen by the sizes of the product or
+* tuned by CNNFW_Tune, the simple loops or the packed blocks */
+typedef enum {
+    KERNEL_AUTO, KERNEL_SIMPLE, KERNEL_BLOCKED
+} KERNEL;
+
 typedef struct {
+    LAYER_TYPE type;
     double bias;
     size_t neuLen;
+    size_t weiLen;
     p_NEURON neurons;
+    size_t valLen;
+    double *values;
+    GEOMETRY geo;
+    size_t colLen;
+    double *cols;
+    KERNEL kernel;
 } LAYER, *p_LAYER;
 
+/* The phases of the work measured by the profiler */
+typedef enum {
+    PHASE_FORWARD, PHASE_ACTIVATION, PHASE_LOSS, PHASE_BACKWARD, PHASE_UPDATE, PHASES
+} PHASE;
+
+/* The hardware counters read by the profiler */
+typedef enum {
+    COUNTER_CYCLES, COUNTER_INSTRUCTIONS, COUNTER_CACHE_MISSES, COUNTERS
+} COUNTER;
+
+/* A point in time together with the values of the hardware counters */
+typedef struct {
+    double time;
+    double counters[COUNTERS];
+} PROFILE_MARK;
+
+typedef struct {
+    unsigned long calls;
+    double flops;
+    double bytes;
+    PROFILE_MARK spent;
+} PROFILE_RECORD;
+
+typedef struct {
+    int hwCounters;
+    int fds[COUNTERS];
+    PROFILE_MARK nested;
+    size_t recLen;
+    PROFILE_RECORD *records;
+} PROFILER, *p_PROFILER;
+
+/* Private buffers of the forward and the backward passes. They let the gradient be
+* calculated without touching the values of the layers, one workspace per thread */
+typedef struct {
+    size_t rows;
+    double **values;
+    double **deltas;
+    double *cols;
+    double *dcols;
+    double *grad;
+    double *pack;
+} WORKSPACE, *p_WORKSPACE;
+
+/* The values of all the layers for every row of the training data, kept by the training
+* with finite differences. A changed parameter is calculated only from its layer to the
+* output, the single row of buffers holds these layers */
+typedef struct {
+    size_t rows;
+    double **values;
+    double **changed;
+    double *cols;
+    double *pack;
+} ACTIVATIONS, *p_ACTIVATIONS;
+
+/* Processes which sum their gradients in the shared memory. The buffers of all
+* the ranks are followed by the buffer of the sum */
+typedef struct {
+    size_t processes;
+    size_t length;
+    volatile long arrived;
+    volatile long generation;
+    double *buffers;
+    double *sum;
+} GROUP_MEMORY, *p_GROUP_MEMORY;
+
+/* A thread of the library, the function and its argument are kept for Windows */
+typedef struct {
+    void *(*func)(void *);
+    void *arg;
+#if defined(_WIN32)
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+} THREAD;
+
 typedef struct {
     int isChanged;
     ACTIVATION_FUNCTION actFunc;
+    TRAINING_METHOD method;
     EPSILON eps;
     LEARNING_STEP step;
     size_t structureSize;
@@ -61,13 +291,475 @@ typedef struct {
     size_t layLen;
     p_LAYER Lays;
     DATA_TRAIN Data;
+    p_PROFILER prof;
+    p_WORKSPACE ws;
+    p_ACTIVATIONS acts;
+    p_SPARSE sparseInps;
+    p_SPARSE sparseData;
+    p_ONLINE online;
+    p_LAZY lazy;
+    p_LBFGS_MEMORY lbfgs;
+    FEATURE_STATE pinning;
+    FEATURE_STATE lazyOutputs;
+    size_t tileRows;
+    size_t history;
+    size_t mapped;
 } PRIVATE, *p_PRIVATE;
 
+/* A mutex together with a condition variable */
+typedef struct {
+#if defined(_WIN32)
+    CRITICAL_SECTION mutex;
+    CONDITION_VARIABLE cond;
+#else
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+#endif
+} MONITOR;
+
+/* The buffers of a pipeline form a ring, filled buffers follow the first one. The first
+* buffer stays filled while it is trained, so the producer never writes into it */
+typedef struct {
+    MONITOR monitor;
+    THREAD thread;
+    PRODUCER producer;
+    void *context;
+    size_t depth;
+    DATA_ROWS capacity;
+    DATA_COLS cols;
+    size_t first;
+    size_t filled;
+    int finished;
+    int failed;
+    int stop;
+    PIPELINE_STATS stats;
+    double *buffers;
+    DATA_ROWS *rows;
+} PIPELINE_MEMORY, *p_PIPELINE_MEMORY;
+
+/* A trial of the search: a Neural Network with its values from the search space */
+typedef struct {
+    N_NET net;
+    size_t config;
+    EPSILON eps;
+    LEARNING_STEP step;
+    ACTIVATION_FUNCTION actFunc;
+    size_t epochs;
+    double loss;
+    int failed;
+} SEARCH_TRIAL;
+
+/* A round of the search: the threads take the trials from the common counter and
+* train them up to the epochs of the round */
+typedef struct {
+    SEARCH_TRIAL **order;
+    size_t count;
+    size_t epochs;
+    p_SET validation;
+    volatile long next;
+} SEARCH_ROUND;
+
+/* A version of the served Neural Network with a workspace for every reader */
+typedef struct {
+    N_NET net;
+    p_WORKSPACE *ws;
+} MODEL_VERSION, *p_MODEL_VERSION;
+
+/* A reader keeps the epoch in which it has taken the current version while it calculates
+* and 0 otherwise. Every reader has its own cache line */
+typedef struct {
+    volatile long epoch;
+    char pad[CACHE_LINE - sizeof(long)];
+} MODEL_READER;
+
+/* A served Neural Network. The readers never wait: they take the current version without
+* locks, a writer publishes a new version and frees the old one after all the readers which
+* could have taken it are done. The monitor only serializes the writers */
+typedef struct {
+    MONITOR monitor;
+    size_t readers;
+    size_t inputs;
+    size_t outputs;
+    volatile long epoch;
+    p_MODEL_VERSION volatile current;
+    MODEL_READER *slots;
+} MODEL_MEMORY, *p_MODEL_MEMORY;
+
+/* A worker of the asynchronous training. The workers take the rows from the common counter */
+typedef struct {
+    p_PRIVATE prvt;
+    p_WORKSPACE ws;
+    volatile long *next;
+    size_t total;
+    int cpu;
+    int failed;
+    THREAD thread;
+} ASYNC_WORKER;
+
+
+/* Sets all the internal pointers of the single memory block of the Neural Network.
+* If layers is not NULL, the descriptions of the layers are copied from it, otherwise
+* they are expected to be already stored in the block (after loading from a file) */
+static void link_structure(p_PRIVATE prvt, const LAYER *layers) {
+    size_t lay, neu;
+    double *values;
+
+    prvt->Inps.inputs = (double *)(prvt + 1);
+
+    prvt->Lays = (p_LAYER)(prvt->Inps.inputs + prvt->Inps.inpLen);
+    for (lay = 0; lay < prvt->layLen; lay++) {
+        if (NULL != layers)
+            prvt->Lays[lay] = layers[lay];
+
+        if (0 == lay)
+            prvt->Lays[0].neurons = (p_NEURON)(prvt->Lays + prvt->layLen);
+        else
+            prvt->Lays[lay].neurons = prvt->Lays[lay - 1].neurons + prvt->Lays[lay - 1].neuLen;
+    }
+
+    values = (double *)(prvt->Lays[prvt->layLen - 1].neurons + prvt->Lays[prvt->layLen - 1].neuLen);
+    for (lay = 0; lay < prvt->layLen; lay++) {
+        for (neu = 0; neu < prvt->Lays[lay].neuLen; neu++) {
+            prvt->Lays[lay].neurons[neu].weiLen = prvt->Lays[lay].weiLen;
+            prvt->Lays[lay].neurons[neu].weights = values;
+            values += prvt->Lays[lay].weiLen;
+        }
+    }
+
+    for (lay = 0; lay < prvt->layLen; lay++) {
+        prvt->Lays[lay].values = values;
+        values += prvt->Lays[lay].valLen;
+    }
+
+    for (lay = 0; lay < prvt->layLen; lay++) {
+        prvt->Lays[lay].cols = values;
+        values += prvt->Lays[lay].colLen;
+    }
+}
+
+/* Calculates the shapes of a layer from its configuration and the shape of its input */
+static int layer_setup(p_LAYER layer, const LAYER_CONFIG *config, size_t inC, size_t inH, size_t inW) {
+    GEOMETRY *geo = &layer->geo;
+
+    memset(layer, 0, sizeof(LAYER));
+    layer->type = config->type;
+    geo->inChannels = inC;
+    geo->inHeight = inH;
+    geo->inWidth = inW;
+
+    if (LAYER_DENSE == config->type) {
+        if (config->channels < 1) {
+            printf("The number of neurons of a dense layer is less than 1\n");
+            return 1;
+        }
+        layer->neuLen = config->channels;
+        layer->weiLen = inC * inH * inW;
+        geo->outChannels = config->channels;
+        geo->outHeight = 1;
+        geo->outWidth = 1;
+        geo->kerHeight = geo->kerWidth = geo->strHeight = geo->strWidth = 1;
+    } else if (LAYER_CONV == config->type || LAYER_MAX_POOL == config->type || LAYER_AVG_POOL == config->type) {
+        geo->kerWidth = config->kernelWidth;
+        geo->kerHeight = (0 == config->kernelHeight) ? 1 : config->kernelHeight;
+        geo->strWidth = (0 == config->strideWidth) ? 1 : config->strideWidth;
+        geo->strHeight = (0 == config->strideHeight) ? 1 : config->strideHeight;
+        geo->padWidth = config->padWidth;
+        geo->padHeight = config->padHeight;
+        if (geo->kerWidth < 1) {
+            printf("The kernel width is less than 1\n");
+            return 1;
+        }
+        if (inH + 2 * geo->padHeight < geo->kerHeight || inW + 2 * geo->padWidth < geo->kerWidth) {
+            printf("The kernel is larger than the padded input of the layer\n");
+            return 1;
+        }
+        geo->outHeight = (inH + 2 * geo->padHeight - geo->kerHeight) / geo->strHeight + 1;
+        geo->outWidth = (inW + 2 * geo->padWidth - geo->kerWidth) / geo->strWidth + 1;
+
+        if (LAYER_CONV == config->type) {
+            if (config->channels < 1) {
+                printf("The number of filters of a convolutional layer is less than 1\n");
+                return 1;
+            }
+            layer->neuLen = config->channels;
+            layer->weiLen = inC * geo->kerHeight * geo->kerWidth;
+            geo->outChannels = config->channels;
+            layer->colLen = layer->weiLen * geo->outHeight * geo->outWidth;
+        } else {
+            geo->outChannels = inC;
+        }
+    } else {
+        printf("Unknown type of a layer\n");
+        return 1;
+    }
+
+    layer->valLen = geo->outChannels * geo->outHeight * geo->outWidth;
+
+    return 0;
+}
+
+/* Pooling layers have neither weights nor bias */
+static int layer_has_bias(const LAYER *layer) {
+    return LAYER_DENSE == layer->type || LAYER_CONV == layer->type;
+}
+
+#define HUGE_PAGE_SIZE (2UL << 20)
+
+#if defined(__linux__)
+#if !defined(MPOL_BIND)
+#define MPOL_BIND 2
+#define MPOL_INTERLEAVE 3
+#endif
+#endif
+
+/* Allocates size bytes with the pages and the NUMA placement. The memory is taken from
+* malloc for the usual pages without a placement, then mapped is 0, otherwise it is mapped
+* and mapped is the length of the mapping */
+static void *memory_alloc(size_t size, HUGE_PAGES pages, NUMA_POLICY numa, unsigned int node, size_t *mapped) {
+#if defined(__linux__)
+    size_t len, align = (HUGE_PAGES_NONE == pages) ? (size_t)sysconf(_SC_PAGESIZE) : HUGE_PAGE_SIZE;
+    unsigned long mask = ~0UL;
+    char *p, *aligned;
+#endif
+
+    *mapped = 0;
+    if (HUGE_PAGES_NONE == pages && NUMA_FIRST_TOUCH == numa)
+        return malloc(size);
+
+#if defined(__linux__)
+    len = (size + align - 1) / align * align;
+    if (HUGE_PAGES_EXPLICIT == pages) {
+        p = (char *)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (MAP_FAILED == (void *)p) {
+            printf("Unsuccessful mapping of huge pages, are they reserved (vm.nr_hugepages)?\n");
+            return NULL;
+        }
+        aligned = p;
+    } else {
+        /* One more huge page to align the mapping, the kernel can use huge pages only inside aligned ranges */
+        p = (char *)mmap(NULL, len + align, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (MAP_FAILED == (void *)p) {
+            printf("Unsuccessful memory mapping\n");
+            return NULL;
+        }
+        aligned = p + (align - (size_t)p % align) % align;
+        if (aligned != p) munmap(p, (size_t)(aligned - p));
+        munmap(aligned + len, align - (size_t)(aligned - p));
+        if (HUGE_PAGES_TRANSPARENT == pages && 0 != madvise(aligned, len, MADV_HUGEPAGE))
+            printf("Transparent huge pages are not available, the usual pages are used\n");
+    }
+
+    /* The policy is set before the first touch, which places the pages */
+    if (NUMA_BIND == numa) {
+        if (node >= sizeof(mask) * 8) {
+            printf("Unknown NUMA node %u\n", node);
+            munmap(aligned, len);
+            return NULL;
+        }
+        mask = 1UL << node;
+    }
+    if (NUMA_FIRST_TOUCH != numa &&
+        0 != syscall(SYS_mbind, aligned, len, NUMA_BIND == numa ? MPOL_BIND : MPOL_INTERLEAVE, &mask, sizeof(mask) * 8, 0)) {
+        printf("Unsuccessful NUMA placement of the memory\n");
+        munmap(aligned, len);
+        return NULL;
+    }
+
+    *mapped = len;
+    return aligned;
+#else
+    (void)size;
+    (void)node;
+    printf("Huge pages and NUMA placement are supported only on Linux\n");
+    return NULL;
+#endif
+}
+
+static void memory_free(void *p, size_t mapped) {
+#if defined(__linux__)
+    if (0 != mapped) {
+        munmap(p, mapped);
+        return;
+    }
+#endif
+    (void)mapped;
+    free(p);
+}
+
+static p_SET set_create(size_t rows, size_t cols) {
+    size_t i;
+    p_SET set = (p_SET)malloc(sizeof(SET) + sizeof(double) * rows * cols);
+    if (NULL == set) {
+        printf("Unsuccessful memory allocation\n");
+        return NULL;
+    }
+
+    set->refs = 1;
+    set->rows = rows;
+    set->cols = cols;
+    set->data = (double *)(set + 1);
+    set->mapped = 0;
+    for (i = 0; i < rows * cols; i++)
+        set->data[i] = 0.0;
+
+    return set;
+}
+
+static void set_release(p_SET set) {
+    if (NULL != set && 0 == ATOMIC_ADD(&set->refs, -1))
+        memory_free(set, set->mapped);
+}
+
+/* Makes the Neural Network use the set (or nothing if it is NULL) as its training data,
+* the online mode ends */
+static void data_attach(p_PRIVATE prvt, p_SET set) {
+    if (NULL != set)
+        ATOMIC_ADD(&set->refs, 1);
+    set_release(prvt->Data.set);
+    free(prvt->online);
+    prvt->online = NULL;
+
+    prvt->Data.set = set;
+    prvt->Data.data = (NULL != set) ? set->data : NULL;
+    prvt->Data.rows = (NULL != set) ? set->rows : 0;
+    prvt->Data.version++;
+}
+
+/* The online mode is set and its rows are the training data, not a borrowed buffer */
+static int online_is_active(const PRIVATE *prvt) {
+    if (NULL == prvt->online || NULL == prvt->Data.set || prvt->Data.data != prvt->Data.set->data) {
+        printf("The online mode is not set or its rows are replaced by a borrowed buffer\n");
+        return 0;
+    }
+    return 1;
+}
+
+/* The rows of the online mode are shared with a clone: the Neural Network copies them and
+* leaves the old ones to the clone */
+static int online_unshare(p_PRIVATE prvt) {
+    p_SET set, shared = prvt->Data.set;
+    if (shared->refs < 2)
+        return 0;
+
+    set = set_create(shared->rows, shared->cols);
+    if (NULL == set)
+        return 1;
+    memcpy(set->data, shared->data, sizeof(double) * shared->rows * shared->cols);
+    set_release(shared);
+    prvt->Data.set = set;
+    prvt->Data.data = set->data;
+
+    return 0;
+}
+
+/* The data of the Neural Network can be changed if it is borrowed or not shared */
+static int data_is_writable(p_PRIVATE prvt) {
+    if (NULL != prvt->Data.set && prvt->Data.data == prvt->Data.set->data && prvt->Data.set->refs > 1) {
+        printf("The training data is shared with other objects and cannot be changed\n");
+        return 0;
+    }
+    return 1;
+}
+
+/* Creates sparse rows with room for length non-zero inputs and outLen outputs of every row */
+static p_SPARSE sparse_create(size_t rows, size_t length, size_t outLen) {
+    p_SPARSE sparse = (p_SPARSE)malloc(sizeof(SPARSE) + sizeof(double) * (length + rows * outLen)
+        + sizeof(size_t) * (rows + 1 + length));
+    if (NULL == sparse) {
+        printf("Unsuccessful memory allocation\n");
+        return NULL;
+    }
+
+    sparse->refs = 1;
+    sparse->rows = rows;
+    sparse->length = length;
+    sparse->values = (double *)(sparse + 1);
+    sparse->targets = sparse->values + length;
+    sparse->offsets = (size_t *)(sparse->targets + rows * outLen);
+    sparse->indices = sparse->offsets + rows + 1;
+    sparse->offsets[0] = 0;
+
+    return sparse;
+}
+
+static void sparse_release(p_SPARSE sparse) {
+    if (NULL != sparse && 0 == ATOMIC_ADD(&sparse->refs, -1))
+        free(sparse);
+}
+
+/* Checks that the first layer can take sparse inputs and that the rows are within the inputs */
+static int sparse_check(const PRIVATE *prvt, size_t rows, const size_t *offsets, const size_t *indices) {
+    size_t row, k;
+
+    if (LAYER_DENSE != prvt->Lays[0].type) {
+        printf("Sparse inputs need a dense first layer\n");
+        return 1;
+    }
+    for (row = 0; row < rows; row++) {
+        if (offsets[row + 1] < offsets[row]) {
+            printf("The offsets of the sparse rows cannot decrease\n");
+            return 1;
+        }
+        for (k = offsets[row]; k < offsets[row + 1]; k++) {
+            if (indices[k] >= prvt->Inps.inpLen) {
+                printf("Index is out of range\n");
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
 
 int create(N_NET *NNetwork, CONFIG *config, size_t configSize, DATA_ROWS rows) {
-    size_t i, j, inp, neu, wei, lay;
+    size_t i;
+    int result;
+    INPUT_SHAPE shape;
+    LAYER_CONFIG *layers = NULL;
+
+    if (2 > configSize) {
+        printf("The configuration size cannot be less than 2\n");
+        return 1;
+    }
+
+    if (NULL == config) {
+        printf("The pointer to the configuration cannot be NULL\n");
+        return 1;
+    }
+
+    for (i = 0; i < configSize; i++) {
+        if (config[i] < 1) {
+            printf("One of the config parameter is less than 1\n");
+            return 1;
+        }
+    }
+
+    layers = (LAYER_CONFIG *)calloc(configSize - 1, sizeof(LAYER_CONFIG));
+    if (NULL == layers) {
+        printf("Unsuccessful memory allocation\n");
+        return 1;
+    }
+
+    shape.channels = config[0];
+    shape.height = 1;
+    shape.width = 1;
+    for (i = 1; i < configSize; i++) {
+        layers[i - 1].type = LAYER_DENSE;
+        layers[i - 1].channels = config[i];
+    }
+
+    result = create_ex(NNetwork, &shape, layers, configSize - 1, rows);
+
+    free(layers);
+
+    return result;
+}
+
+int create_ex(N_NET *NNetwork, const INPUT_SHAPE *shape, const LAYER_CONFIG *layers, size_t layersSize, DATA_ROWS rows) {
+    size_t inp, neu, wei, lay, inC, inH, inW;
     size_t bytes = 0;
-    size_t inpBytes = 0, layBytes = 0, neuBytes = 0, weiBytes = 0, dataBytes = 0;
+    size_t inpBytes = 0, layBytes = 0, neuBytes = 0, weiBytes = 0, valBytes = 0, colBytes = 0;
+    p_LAYER Lays = NULL;
     p_PRIVATE prvt = NULL;
 
     if (NULL == NNetwork) {
@@ -84,85 +776,91 @@ int create(N_NET *NNetwork, CONFIG *config, size_t configSize, DATA_ROWS rows) {
         return 1;
     }
 
-    if (2 > configSize) {
-        printf("The configuration size cannot be less than 2\n");
+    if (NULL == shape || NULL == layers) {
+        printf("The pointers to the input shape and the layers cannot be NULL\n");
         return 1;
     }
 
-    if (1 > rows) {
-        printf("The training data must contain at least one row\n");
+    if (1 > layersSize) {
+        printf("The Neural Network must contain at least one layer\n");
         return 1;
     }
 
-    if (NULL == config) {
-        printf("The pointer to the configuration cannot be NULL\n");
+    inC = shape->channels;
+    inH = (0 == shape->height) ? 1 : shape->height;
+    inW = (0 == shape->width) ? 1 : shape->width;
+    if (1 > inC) {
+        printf("The number of input channels is less than 1\n");
         return 1;
     }
 
-    for (i = 0; i < configSize; i++) {
-        if (config[i] < 1) {
-            printf("One of the config parameter is less than 1\n");
+    Lays = (p_LAYER)malloc(sizeof(LAYER) * layersSize);
+    if (NULL == Lays) {
+        printf("Unsuccessful memory allocation\n");
+        return 1;
+    }
+
+    for (lay = 0; lay < layersSize; lay++) {
+        if (layer_setup(&Lays[lay], &layers[lay], inC, inH, inW)) {
+            printf("Wrong configuration of the layer %lu\n", (unsigned long)lay);
+            free(Lays);
             return 1;
         }
+        inC = Lays[lay].geo.outChannels;
+        inH = Lays[lay].geo.outHeight;
+        inW = Lays[lay].geo.outWidth;
+
+        neuBytes += sizeof(NEURON) * Lays[lay].neuLen;
+        weiBytes += sizeof(double) * Lays[lay].neuLen * Lays[lay].weiLen;
+        valBytes += sizeof(double) * Lays[lay].valLen;
+        colBytes += sizeof(double) * Lays[lay].colLen;
     }
 
     bytes = sizeof(PRIVATE);
 
-    inpBytes = sizeof(double) * config[0];
-    layBytes = sizeof(LAYER) * (configSize - 1);
-    for (lay = 1; lay < configSize; lay++) {
-        neuBytes += sizeof(NEURON) * config[lay];
-        weiBytes += sizeof(double) * config[lay] * config[lay - 1];
-    }
-
-    dataBytes = sizeof(double *) * rows + sizeof(double) * rows * (config[0] + config[configSize - 1]);
+    inpBytes = sizeof(double) * Lays[0].geo.inChannels * Lays[0].geo.inHeight * Lays[0].geo.inWidth;
+    layBytes = sizeof(LAYER) * layersSize;
 
-    bytes += inpBytes + layBytes + neuBytes + weiBytes + dataBytes;
+    bytes += inpBytes + layBytes + neuBytes + weiBytes + valBytes + colBytes;
 
     prvt = (p_PRIVATE)malloc(bytes);
     if (NULL == prvt) {
         printf("Unsuccessful memory allocation\n");
+        free(Lays);
         return 1;
     }
     prvt->isChanged = 0;
 
     prvt->structureSize = bytes;
-    prvt->Inps.inpLen = config[0];
-    prvt->Inps.inputs = (double *)(prvt + 1);
-    for (inp = 0; inp < prvt->Inps.inpLen; inp++) {
-        prvt->Inps.inputs[inp] = 0.0;
-    }
-
-    prvt->layLen = configSize - 1;
-    prvt->Lays = (p_LAYER)(prvt->Inps.inputs + prvt->Inps.inpLen);
-    for (lay = 0; lay < prvt->layLen; lay++) {
-        if (lay < prvt->layLen - 1)
-            prvt->Lays[lay].bias = 0.0;
-        else
-            prvt->Lays[lay].bias = 0.0;
+    prvt->Inps.inpLen = inpBytes / sizeof(double);
+    prvt->layLen = layersSize;
+    prvt->Data.cols = prvt->Inps.inpLen + Lays[layersSize - 1].valLen;
+    prvt->Data.rows = 0;
+    prvt->Data.data = NULL;
+    prvt->Data.set = NULL;
+    prvt->Data.version = 0;
 
-        prvt->Lays[lay].neuLen = config[lay + 1];
-        if (0 == lay)
-            prvt->Lays[0].neurons = (p_NEURON)(prvt->Lays + prvt->layLen);
-        else
-            prvt->Lays[lay].neurons = prvt->Lays[lay - 1].neurons + prvt->Lays[lay - 1].neuLen;
+    if (0 < rows) {
+        prvt->Data.set = set_create(rows, prvt->Data.cols);
+        if (NULL == prvt->Data.set) {
+            free(prvt);
+            free(Lays);
+            return 1;
+        }
+        prvt->Data.data = prvt->Data.set->data;
+        prvt->Data.rows = rows;
     }
 
-    for (lay = 0; lay < prvt->layLen; lay++) {
-        for (neu = 0; neu < prvt->Lays[lay].neuLen; neu++) {
-            prvt->Lays[lay].neurons[neu].value = 0.0;
+    link_structure(prvt, Lays);
+    free(Lays);
 
-            prvt->Lays[lay].neurons[neu].weiLen = config[lay];
-            if (0 == lay && 0 == neu)
-                prvt->Lays[0].neurons[0].weights = (double *)(prvt->Lays[prvt->layLen - 1].neurons + prvt->Lays[prvt->layLen - 1].neuLen);
-            else if (0 == neu)
-                prvt->Lays[lay].neurons[0].weights = (double *)(prvt->Lays[lay - 1].neurons[prvt->Lays[lay - 1].neuLen - 1].weights + prvt->Lays[lay - 1].neurons[prvt->Lays[lay - 1].neuLen - 1].weiLen);
-            else
-                prvt->Lays[lay].neurons[neu].weights = (double *)(prvt->Lays[lay].neurons[neu - 1].weights + prvt->Lays[lay].neurons[neu - 1].weiLen);
-        }
+    for (inp = 0; inp < prvt->Inps.inpLen; inp++) {
+        prvt->Inps.inputs[inp] = 0.0;
     }
 
     for (lay = 0; lay < prvt->layLen; lay++) {
+        prvt->Lays[lay].bias = 0.0;
+        memset(prvt->Lays[lay].values, 0, sizeof(double) * prvt->Lays[lay].valLen);
         for (neu = 0; neu < prvt->Lays[lay].neuLen; neu++) {
             for (wei = 0; wei < prvt->Lays[lay].neurons[neu].weiLen; wei++) {
                 prvt->Lays[lay].neurons[neu].weights[wei] = /* 0.5 */(1000.0 - (double)(rand() % 2001)) / 1000.0;
@@ -170,133 +868,2959 @@ int create(N_NET *NNetwork, CONFIG *config, size_t configSize, DATA_ROWS rows) {
         }
     }
 
-    prvt->Data.rows = rows;
-    prvt->Data.cols = config[0] + config[configSize - 1];
+    prvt->actFunc = ENABLE;
+    prvt->eps = 0.01;
+    prvt->step = 0.01;
+    prvt->method = FINITE_DIFFERENCE;
+    prvt->pinning = DISABLE;
+    prvt->lazyOutputs = DISABLE;
+    prvt->tileRows = ROWS_TILE;
+    prvt->history = LBFGS_HISTORY;
+    prvt->mapped = 0;
+    prvt->prof = NULL;
+    prvt->ws = NULL;
+    prvt->acts = NULL;
+    prvt->sparseInps = NULL;
+    prvt->sparseData = NULL;
+    prvt->online = NULL;
+    prvt->lazy = NULL;
+    prvt->lbfgs = NULL;
+
+    *NNetwork = (N_NET)prvt;
 
-    prvt->Data.data = (double **)(prvt->Lays[prvt->layLen - 1].neurons[prvt->Lays[prvt->layLen - 1].neuLen - 1].weights + prvt->Lays[prvt->layLen - 1].neurons[prvt->Lays[prvt->layLen - 1].neuLen - 1].weiLen);
+    return 0;
+}
 
-    for (i = 0; i < prvt->Data.rows; i++)
-        prvt->Data.data[i] = (double *)(prvt->Data.data + prvt->Data.rows) + i * prvt->Data.cols;
+/* Seconds from an arbitrary point in time */
+static double time_now(void) {
+#if defined(_WIN32)
+    return (double)clock() / CLOCKS_PER_SEC;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
 
-    for (i = 0; i < prvt->Data.rows; i++) {
-        prvt->Data.data[i] = (double *)(prvt->Data.data + prvt->Data.rows) + i * prvt->Data.cols;
-        for (j = 0; j < prvt->Data.cols; j++) {
-            prvt->Data.data[i][j] = 0.0;
+/* Reads the time and, if they are enabled, the hardware counters */
+static void profile_now(p_PROFILER prof, PROFILE_MARK *mark) {
+    size_t i;
+    mark->time = time_now();
+    for (i = 0; i < COUNTERS; i++)
+        mark->counters[i] = 0.0;
+#if defined(__linux__)
+    if (prof->hwCounters) {
+        /* PERF_FORMAT_GROUP: the number of events followed by their values */
+        struct {
+            __u64 nr;
+            __u64 values[COUNTERS];
+        } group;
+        if (read(prof->fds[0], &group, sizeof(group)) > 0) {
+            for (i = 0; i < COUNTERS && i < group.nr; i++)
+                mark->counters[i] = (double)group.values[i];
         }
     }
+#endif
+}
 
-    prvt->actFunc = ENABLE;
-    prvt->eps = 0.01;
-    prvt->step = 0.01;
+static void profile_begin(p_PROFILER prof, PROFILE_MARK *mark) {
+    profile_now(prof, mark);
+}
+
+/* Adds everything spent since the mark to the record of the layer and the phase */
+static void profile_end(p_PROFILER prof, const PROFILE_MARK *mark, size_t lay, PHASE phase, double flops, double bytes) {
+    PROFILE_MARK cur;
+    PROFILE_RECORD *rec = &prof->records[lay * PHASES + phase];
+    size_t i;
+
+    profile_now(prof, &cur);
+
+    rec->calls++;
+    rec->flops += flops;
+    rec->bytes += bytes;
+    rec->spent.time += cur.time - mark->time;
+    prof->nested.time += cur.time - mark->time;
+    for (i = 0; i < COUNTERS; i++) {
+        rec->spent.counters[i] += cur.counters[i] - mark->counters[i];
+        prof->nested.counters[i] += cur.counters[i] - mark->counters[i];
+    }
+}
+
+/* Same as profile_end, but without everything measured inside the interval */
+static void profile_end_outer(p_PROFILER prof, const PROFILE_MARK *mark, const PROFILE_MARK *nested, size_t lay, PHASE phase, double flops, double bytes) {
+    PROFILE_MARK start = *mark;
+    size_t i;
+
+    start.time += prof->nested.time - nested->time;
+    for (i = 0; i < COUNTERS; i++)
+        start.counters[i] += prof->nested.counters[i] - nested->counters[i];
+
+    profile_end(prof, &start, lay, phase, flops, bytes);
+}
+
+static void profile_close(p_PROFILER prof) {
+#if defined(__linux__)
+    size_t i;
+    for (i = 0; i < COUNTERS; i++) {
+        if (prof->fds[i] >= 0)
+            close(prof->fds[i]);
+        prof->fds[i] = -1;
+    }
+#endif
+    prof->hwCounters = 0;
+}
+
+static int profile_open(p_PROFILER prof) {
+#if defined(__linux__)
+    static const __u64 configs[COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES
+    };
+    struct perf_event_attr attr;
+    size_t i;
+
+    for (i = 0; i < COUNTERS; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = configs[i];
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.disabled = (0 == i);
+        prof->fds[i] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, (0 == i) ? -1 : prof->fds[0], 0);
+        if (prof->fds[i] < 0) {
+            profile_close(prof);
+            return 1;
+        }
+    }
+    ioctl(prof->fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(prof->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    prof->hwCounters = 1;
+
+    return 0;
+#else
+    (void)prof;
+    return 1;
+#endif
+}
+
+int CNNFW_SetProfiling(N_NET NNetwork, FEATURE_STATE state, FEATURE_STATE hwCounters) {
+    size_t i;
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+
+    if (NULL != prvt->prof) {
+        profile_close(prvt->prof);
+        free(prvt->prof);
+        prvt->prof = NULL;
+    }
+
+    if (ENABLE != state)
+        return 0;
+
+    prvt->prof = (p_PROFILER)malloc(sizeof(PROFILER) + sizeof(PROFILE_RECORD) * prvt->layLen * PHASES);
+    if (NULL == prvt->prof) {
+        printf("Unsuccessful memory allocation\n");
+        return 1;
+    }
+    prvt->prof->hwCounters = 0;
+    for (i = 0; i < COUNTERS; i++)
+        prvt->prof->fds[i] = -1;
+    prvt->prof->recLen = prvt->layLen * PHASES;
+    prvt->prof->records = (PROFILE_RECORD *)(prvt->prof + 1);
+
+    CNNFW_ResetProfile(NNetwork);
+
+    if (ENABLE == hwCounters && profile_open(prvt->prof))
+        printf("Hardware counters are not available, only the time will be measured\n");
+
+    return 0;
+}
+
+int CNNFW_ResetProfile(N_NET NNetwork) {
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+    if (NULL == prvt->prof) {
+        printf("Profiling is disabled\n");
+        return 1;
+    }
+
+    memset(prvt->prof->records, 0, sizeof(PROFILE_RECORD) * prvt->prof->recLen);
+    memset(&prvt->prof->nested, 0, sizeof(PROFILE_MARK));
+
+    return 0;
+}
+
+double CNNFW_GetTime(void) {
+    return time_now();
+}
+
+int CNNFW_SaveProfile(N_NET NNetwork, const char *fileName, PROFILE_FORMAT format) {
+    static const char *phases[PHASES] = { "forward", "activation", "loss", "backward", "update" };
+    size_t lay, ph;
+    PROFILE_RECORD *rec;
+    FILE *fp = stdout;
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+    if (NULL == prvt->prof) {
+        printf("Profiling is disabled\n");
+        return 1;
+    }
+
+    if (NULL != fileName) {
+        fp = fopen(fileName, "w");
+        if (NULL == fp) {
+            printf("Unsuccessful file opening\n");
+            return 1;
+        }
+    }
+
+    if (PROFILE_JSON == format) {
+        fprintf(fp, "{\n  \"hwCounters\": %s,\n  \"layers\": [\n", prvt->prof->hwCounters ? "true" : "false");
+        for (lay = 0; lay < prvt->layLen; lay++) {
+            fprintf(fp, "    {\"layer\": %lu, \"neurons\": %lu, \"phases\": {", (unsigned long)lay, (unsigned long)prvt->Lays[lay].neuLen);
+            for (ph = 0; ph < PHASES; ph++) {
+                rec = &prvt->prof->records[lay * PHASES + ph];
+                fprintf(fp, "%s\n      \"%s\": {\"calls\": %lu, \"seconds\": %.9f, \"flops\": %.0f, \"bytes\": %.0f",
+                    ph ? "," : "", phases[ph], rec->calls, rec->spent.time, rec->flops, rec->bytes);
+                if (prvt->prof->hwCounters)
+                    fprintf(fp, ", \"cycles\": %.0f, \"instructions\": %.0f, \"cacheMisses\": %.0f",
+                        rec->spent.counters[COUNTER_CYCLES], rec->spent.counters[COUNTER_INSTRUCTIONS], rec->spent.counters[COUNTER_CACHE_MISSES]);
+                fprintf(fp, "}");
+            }
+            fprintf(fp, "\n    }}%s\n", lay + 1 < prvt->layLen ? "," : "");
+        }
+        fprintf(fp, "  ]\n}\n");
+    } else {
+        fprintf(fp, "layer phase         calls     time,ms    MFLOP   GFLOP/s       MB     GB/s");
+        if (prvt->prof->hwCounters)
+            fprintf(fp, "      Mcycles       Minstr    IPC  cache-misses");
+        fprintf(fp, "\n");
+        for (lay = 0; lay < prvt->layLen; lay++) {
+            for (ph = 0; ph < PHASES; ph++) {
+                rec = &prvt->prof->records[lay * PHASES + ph];
+                if (0 == rec->calls) continue;
+                fprintf(fp, "%5lu %-10s %8lu %11.3f %8.3f %9.3f %8.3f %8.3f",
+                    (unsigned long)lay, phases[ph], rec->calls, rec->spent.time * 1e3,
+                    rec->flops / 1e6, rec->spent.time > 0.0 ? rec->flops / rec->spent.time / 1e9 : 0.0,
+                    rec->bytes / 1e6, rec->spent.time > 0.0 ? rec->bytes / rec->spent.time / 1e9 : 0.0);
+                if (prvt->prof->hwCounters)
+                    fprintf(fp, " %12.3f %12.3f %6.2f %13.0f",
+                        rec->spent.counters[COUNTER_CYCLES] / 1e6, rec->spent.counters[COUNTER_INSTRUCTIONS] / 1e6,
+                        rec->spent.counters[COUNTER_CYCLES] > 0.0 ? rec->spent.counters[COUNTER_INSTRUCTIONS] / rec->spent.counters[COUNTER_CYCLES] : 0.0,
+                        rec->spent.counters[COUNTER_CACHE_MISSES]);
+                fprintf(fp, "\n");
+            }
+        }
+    }
+
+    if (stdout != fp)
+        fclose(fp);
+
+    return 0;
+}
+
+double ActivationFunction(double x) {
+    return 1.0 / (1.0 + exp(-x));
+}
+
+/* Defined after the layers and their gradients */
+static void forward(p_PRIVATE prvt, const double *inputs);
+static double neuron_forward(p_PRIVATE prvt, size_t lay, size_t neu, const double *in);
+static int train_backpropagation(p_PRIVATE prvt);
+static int train_lbfgs(p_PRIVATE prvt);
+static int train_finite_difference(p_PRIVATE prvt);
+
+double difference(N_NET NNetwork) {
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+    size_t i, out;
+    double result = 0.0;
+    double diff = 0.0;
+    double *row;
+    PROFILE_MARK mark;
+    for (i = 0; i < prvt->Data.rows; i++) {
+        row = prvt->Data.data + i * prvt->Data.cols;
+
+        forward(prvt, row);
+
+        if (NULL != prvt->prof) profile_begin(prvt->prof, &mark);
+        for (out = 0; out < prvt->Lays[prvt->layLen - 1].valLen; out++) {
+            diff = prvt->Lays[prvt->layLen - 1].values[out] - row[prvt->Inps.inpLen + out];
+            result += diff * diff;
+        }
+        if (NULL != prvt->prof)
+            profile_end(prvt->prof, &mark, prvt->layLen - 1, PHASE_LOSS, 3.0 * out, 2.0 * sizeof(double) * out);
+    }
+
+    return result / prvt->Data.rows;
+}
+
+int CNNFW_Train(N_NET NNetwork) {
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+
+    if (NULL == prvt) {
+        printf("Neural Network is NULL\n");
+        return 1;
+    }
+
+    if (NULL == prvt->Data.data && NULL == prvt->sparseData) {
+        printf("Train data is NULL\n");
+        return 1;
+    }
+    if (0 == prvt->Data.rows && NULL == prvt->sparseData) {
+        printf("Train data has no rows\n");
+        return 1;
+    }
+
+    if (BACKPROPAGATION == prvt->method)
+        return train_backpropagation(prvt);
+    if (LBFGS == prvt->method)
+        return train_lbfgs(prvt);
+
+    if (NULL != prvt->sparseData) {
+        printf("The sparse training data is trained with the backpropagation only\n");
+        return 1;
+    }
+
+    return train_finite_difference(prvt);
+}
+
+/* Sizes of the blocks of the matrix multiplication. The micro-kernel keeps an
+* MR x NR block of C in the registers, a KC x NR sliver of the packed B stays in
+* L1, an MC x KC block of the packed A in L2 and a KC x NC block of B in L3 */
+#define GEMM_MR 4
+#define GEMM_NR 8
+#define GEMM_MC 96
+#define GEMM_KC 256
+#define GEMM_NC 2048
+
+/* Products with fewer multiplications are not worth packing */
+#define GEMM_PACK_MIN 32768
+
+#define GEMM_ELEMENT(M, ld, trans, row, col) ((trans) ? (M)[(col) * (ld) + (row)] : (M)[(row) * (ld) + (col)])
+
+/* C[MR x NR] (+)= the product of a packed MR x kc panel of A and a packed kc x NR panel
+* of B. Only the mr x nr top left part of the block is written for the edges of C */
+static void gemm_kernel(size_t kc, const double *a, const double *b, double *C, size_t ldc, size_t mr, size_t nr, int accumulate) {
+    size_t i, j, k;
+    double c[GEMM_MR][GEMM_NR];
+#if defined(__AVX2__) && defined(__FMA__)
+    __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+    __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+    __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+    __m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+    __m256d b0, b1, ai;
+
+    for (k = 0; k < kc; k++, a += GEMM_MR, b += GEMM_NR) {
+        b0 = _mm256_loadu_pd(b);
+        b1 = _mm256_loadu_pd(b + 4);
+        ai = _mm256_broadcast_sd(a);
+        c00 = _mm256_fmadd_pd(ai, b0, c00);
+        c01 = _mm256_fmadd_pd(ai, b1, c01);
+        ai = _mm256_broadcast_sd(a + 1);
+        c10 = _mm256_fmadd_pd(ai, b0, c10);
+        c11 = _mm256_fmadd_pd(ai, b1, c11);
+        ai = _mm256_broadcast_sd(a + 2);
+        c20 = _mm256_fmadd_pd(ai, b0, c20);
+        c21 = _mm256_fmadd_pd(ai, b1, c21);
+        ai = _mm256_broadcast_sd(a + 3);
+        c30 = _mm256_fmadd_pd(ai, b0, c30);
+        c31 = _mm256_fmadd_pd(ai, b1, c31);
+    }
+    _mm256_storeu_pd(c[0], c00);
+    _mm256_storeu_pd(c[0] + 4, c01);
+    _mm256_storeu_pd(c[1], c10);
+    _mm256_storeu_pd(c[1] + 4, c11);
+    _mm256_storeu_pd(c[2], c20);
+    _mm256_storeu_pd(c[2] + 4, c21);
+    _mm256_storeu_pd(c[3], c30);
+    _mm256_storeu_pd(c[3] + 4, c31);
+#else
+    for (i = 0; i < GEMM_MR; i++)
+        for (j = 0; j < GEMM_NR; j++)
+            c[i][j] = 0.0;
+
+    /* Fixed trip counts let the compiler unroll and vectorize the update of the block */
+    for (k = 0; k < kc; k++, a += GEMM_MR, b += GEMM_NR) {
+        for (i = 0; i < GEMM_MR; i++) {
+            for (j = 0; j < GEMM_NR; j++)
+                c[i][j] += a[i] * b[j];
+        }
+    }
+#endif
+
+    for (i = 0; i < mr; i++) {
+        if (accumulate) {
+            for (j = 0; j < nr; j++)
+                C[i * ldc + j] += c[i][j];
+        } else {
+            for (j = 0; j < nr; j++)
+                C[i * ldc + j] = c[i][j];
+        }
+    }
+}
+
+/* Copies an mc x kc block of op(A) into panels of MR rows stored column by column, the rows out of the block are zeros */
+static void gemm_pack_a(size_t mc, size_t kc, const double *A, size_t lda, int transA, size_t row, size_t col, double *packed) {
+    size_t i, k, p;
+
+    for (p = 0; p < mc; p += GEMM_MR) {
+        for (k = 0; k < kc; k++) {
+            for (i = 0; i < GEMM_MR; i++)
+                *packed++ = (p + i < mc) ? GEMM_ELEMENT(A, lda, transA, row + p + i, col + k) : 0.0;
+        }
+    }
+}
+
+/* Copies a kc x nc block of op(B) into panels of NR columns stored row by row, the columns out of the block are zeros */
+static void gemm_pack_b(size_t kc, size_t nc, const double *B, size_t ldb, int transB, size_t row, size_t col, double *packed) {
+    size_t j, k, q;
+
+    for (q = 0; q < nc; q += GEMM_NR) {
+        for (k = 0; k < kc; k++) {
+            for (j = 0; j < GEMM_NR; j++)
+                *packed++ = (q + j < nc) ? GEMM_ELEMENT(B, ldb, transB, row + k, col + q + j) : 0.0;
+        }
+    }
+}
+
+/* The product without packing for the small matrices */
+static void gemm_small(int transA, int transB, size_t M, size_t N, size_t K,
+    const double *A, size_t lda, const double *B, size_t ldb, int accumulate, double *C, size_t ldc) {
+    size_t i, j, k;
+    double a, *c;
+
+    for (i = 0; i < M; i++) {
+        c = C + i * ldc;
+        if (transB) {
+            for (j = 0; j < N; j++) {
+                a = 0.0;
+                for (k = 0; k < K; k++)
+                    a += GEMM_ELEMENT(A, lda, transA, i, k) * B[j * ldb + k];
+                c[j] = accumulate ? c[j] + a : a;
+            }
+        } else {
+            if (!accumulate)
+                memset(c, 0, sizeof(double) * N);
+            for (k = 0; k < K; k++) {
+                a = GEMM_ELEMENT(A, lda, transA, i, k);
+                for (j = 0; j < N; j++)
+                    c[j] += a * B[k * ldb + j];
+            }
+        }
+    }
+}
+
+/* The size of the buffer for the packed blocks of the products with all the sizes up to dim */
+static size_t gemm_pack_size(size_t dim) {
+    size_t mc = (dim < GEMM_MC) ? dim : GEMM_MC;
+    size_t nc = (dim < GEMM_NC) ? dim : GEMM_NC;
+    size_t kc = (dim < GEMM_KC) ? dim : GEMM_KC;
+    return kc * ((mc + GEMM_MR - 1) / GEMM_MR * GEMM_MR + (nc + GEMM_NR - 1) / GEMM_NR * GEMM_NR);
+}
+
+/* C[M x N] (+)= op(A)[M x K] * op(B)[K x N]. All the matrices are stored row by row,
+* op(X) is X or, if trans is not 0, the transposed X. The blocks are packed into pack,
+* which must hold gemm_pack_size of the largest size, or into a temporary buffer if it is NULL */
+static void gemm_blocked(int transA, int transB, size_t M, size_t N, size_t K,
+    const double *A, size_t lda, const double *B, size_t ldb, int accumulate, double *C, size_t ldc, double *pack) {
+    size_t ic, jc, pc, ir, jr, mc, nc, kc;
+    double *packA = pack, *packB;
+
+    mc = (M < GEMM_MC) ? M : GEMM_MC;
+    kc = (K < GEMM_KC) ? K : GEMM_KC;
+    if (NULL == pack) {
+        packA = (double *)malloc(sizeof(double) * gemm_pack_size(M > N ? (M > K ? M : K) : (N > K ? N : K)));
+        if (NULL == packA) {
+            gemm_small(transA, transB, M, N, K, A, lda, B, ldb, accumulate, C, ldc);
+            return;
+        }
+    }
+    packB = packA + kc * ((mc + GEMM_MR - 1) / GEMM_MR * GEMM_MR);
+
+    for (jc = 0; jc < N; jc += GEMM_NC) {
+        nc = (N - jc < GEMM_NC) ? N - jc : GEMM_NC;
+        for (pc = 0; pc < K; pc += GEMM_KC) {
+            kc = (K - pc < GEMM_KC) ? K - pc : GEMM_KC;
+            gemm_pack_b(kc, nc, B, ldb, transB, pc, jc, packB);
+            for (ic = 0; ic < M; ic += GEMM_MC) {
+                mc = (M - ic < GEMM_MC) ? M - ic : GEMM_MC;
+                gemm_pack_a(mc, kc, A, lda, transA, ic, pc, packA);
+                for (jr = 0; jr < nc; jr += GEMM_NR) {
+                    for (ir = 0; ir < mc; ir += GEMM_MR) {
+                        gemm_kernel(kc, packA + ir * kc, packB + jr * kc, C + (ic + ir) * ldc + jc + jr, ldc,
+                            (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR, (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR,
+                            accumulate || pc > 0);
+                    }
+                }
+            }
+        }
+    }
+
+    if (NULL == pack)
+        free(packA);
+}
+
+/* The same as gemm_blocked, the small products are calculated without packing */
+static void gemm(int transA, int transB, size_t M, size_t N, size_t K,
+    const double *A, size_t lda, const double *B, size_t ldb, int accumulate, double *C, size_t ldc, double *pack) {
+    if ((double)M * N * K < GEMM_PACK_MIN || M < GEMM_MR || N < GEMM_NR)
+        gemm_small(transA, transB, M, N, K, A, lda, B, ldb, accumulate, C, ldc);
+    else
+        gemm_blocked(transA, transB, M, N, K, A, lda, B, ldb, accumulate, C, ldc, pack);
+}
+
+/* The product of count rows of the input with the weights of a dense layer by the kernel of the layer */
+static void dense_gemm(const LAYER *layer, size_t count, const double *in, size_t ldIn, double *out, double *pack) {
+    if (KERNEL_SIMPLE == layer->kernel)
+        gemm_small(0, 1, count, layer->neuLen, layer->weiLen, in, ldIn,
+            layer->neurons[0].weights, layer->weiLen, 0, out, layer->valLen);
+    else if (KERNEL_BLOCKED == layer->kernel)
+        gemm_blocked(0, 1, count, layer->neuLen, layer->weiLen, in, ldIn,
+            layer->neurons[0].weights, layer->weiLen, 0, out, layer->valLen, pack);
+    else
+        gemm(0, 1, count, layer->neuLen, layer->weiLen, in, ldIn,
+            layer->neurons[0].weights, layer->weiLen, 0, out, layer->valLen, pack);
+}
+
+/* Unrolls the windows of the convolution into the columns of a
+* (inChannels * kerHeight * kerWidth) x (outHeight * outWidth) matrix */
+static void im2col(const GEOMETRY *geo, const double *in, double *cols) {
+    size_t c, ky, kx, oy, ox, P = geo->outHeight * geo->outWidth;
+    long iy, ix;
+    double *row = cols;
+
+    for (c = 0; c < geo->inChannels; c++) {
+        for (ky = 0; ky < geo->kerHeight; ky++) {
+            for (kx = 0; kx < geo->kerWidth; kx++) {
+                for (oy = 0; oy < geo->outHeight; oy++) {
+                    iy = (long)(oy * geo->strHeight + ky) - (long)geo->padHeight;
+                    for (ox = 0; ox < geo->outWidth; ox++) {
+                        ix = (long)(ox * geo->strWidth + kx) - (long)geo->padWidth;
+                        if (iy < 0 || iy >= (long)geo->inHeight || ix < 0 || ix >= (long)geo->inWidth)
+                            row[oy * geo->outWidth + ox] = 0.0;
+                        else
+                            row[oy * geo->outWidth + ox] = in[(c * geo->inHeight + (size_t)iy) * geo->inWidth + (size_t)ix];
+                    }
+                }
+                row += P;
+            }
+        }
+    }
+}
+
+/* Max or average pooling, the padded positions are not taken into account */
+static void pooling(const LAYER *layer, const double *in, double *out) {
+    const GEOMETRY *geo = &layer->geo;
+    size_t c, ky, kx, oy, ox, cnt;
+    long iy, ix;
+    double acc, v;
+
+    for (c = 0; c < geo->outChannels; c++) {
+        for (oy = 0; oy < geo->outHeight; oy++) {
+            for (ox = 0; ox < geo->outWidth; ox++) {
+                acc = 0.0;
+                cnt = 0;
+                for (ky = 0; ky < geo->kerHeight; ky++) {
+                    iy = (long)(oy * geo->strHeight + ky) - (long)geo->padHeight;
+                    if (iy < 0 || iy >= (long)geo->inHeight) continue;
+                    for (kx = 0; kx < geo->kerWidth; kx++) {
+                        ix = (long)(ox * geo->strWidth + kx) - (long)geo->padWidth;
+                        if (ix < 0 || ix >= (long)geo->inWidth) continue;
+                        v = in[(c * geo->inHeight + (size_t)iy) * geo->inWidth + (size_t)ix];
+                        if (LAYER_MAX_POOL == layer->type)
+                            acc = (0 == cnt || v > acc) ? v : acc;
+                        else
+                            acc += v;
+                        cnt++;
+                    }
+                }
+                if (LAYER_AVG_POOL == layer->type && cnt > 0)
+                    acc /= (double)cnt;
+                out[(c * geo->outHeight + oy) * geo->outWidth + ox] = acc;
+            }
+        }
+    }
+}
+
+/* The number of floating point operations of the weighted sums of a layer */
+static double layer_flops(const LAYER *layer) {
+    if (LAYER_CONV == layer->type)
+        return 2.0 * layer->colLen * layer->neuLen;
+    if (LAYER_DENSE == layer->type)
+        return 2.0 * layer->neuLen * layer->weiLen;
+    return (double)layer->valLen * layer->geo.kerHeight * layer->geo.kerWidth;
+}
+
+/* The number of bytes read and written by the weighted sums of a layer */
+static double layer_bytes(const LAYER *layer) {
+    const GEOMETRY *geo = &layer->geo;
+    return sizeof(double) * ((double)layer->neuLen * layer->weiLen + 2.0 * layer->colLen
+        + (double)geo->inChannels * geo->inHeight * geo->inWidth + layer->valLen);
+}
+
+/* Adds the bias and applies the activation function to len values of a hidden layer */
+static void layer_activate(p_PRIVATE prvt, size_t lay, double *values, size_t len, p_PROFILER prof) {
+    size_t i;
+    double bias;
+    p_LAYER layer = &prvt->Lays[lay];
+    PROFILE_MARK mark;
+
+    if (lay < prvt->layLen - 1 && layer_has_bias(layer)) {
+        bias = layer->bias;
+        if (NULL != prof) profile_begin(prof, &mark);
+        if (prvt->actFunc == ENABLE) {
+            for (i = 0; i < len; i++)
+                values[i] = ActivationFunction(values[i] + bias);
+        } else if (prvt->actFunc == DISABLE) {
+            for (i = 0; i < len; i++)
+                values[i] = values[i] + bias;
+        }
+        if (NULL != prof)
+            profile_end(prof, &mark, lay, PHASE_ACTIVATION, 4.0 * len, 2.0 * sizeof(double) * len);
+    }
+}
+
+/* Calculates one layer of the Neural Network from its input into the given values and columns,
+* pack is the buffer for the matrix multiplication or NULL */
+static void layer_forward(p_PRIVATE prvt, size_t lay, const double *in, double *values, double *cols, double *pack, p_PROFILER prof) {
+    size_t neu, wei, weiLen, neuLen;
+    double tmp;
+    double *weights;
+    p_LAYER layer = &prvt->Lays[lay];
+    PROFILE_MARK mark;
+
+    neuLen = layer->neuLen;
+    weiLen = layer->weiLen;
+
+    if (NULL != prof) profile_begin(prof, &mark);
+    if (LAYER_DENSE == layer->type) {
+        for (neu = 0; neu < neuLen; neu++) {
+            tmp = 0.0;
+            weights = layer->neurons[neu].weights;
+            for (wei = 0; wei < weiLen; wei++) {
+                tmp += in[wei] * weights[wei];
+            }
+            values[neu] = tmp;
+        }
+    } else if (LAYER_CONV == layer->type) {
+        im2col(&layer->geo, in, cols);
+        gemm(0, 0, neuLen, layer->geo.outHeight * layer->geo.outWidth, weiLen,
+            layer->neurons[0].weights, weiLen, cols, layer->geo.outHeight * layer->geo.outWidth,
+            0, values, layer->geo.outHeight * layer->geo.outWidth, pack);
+    } else {
+        pooling(layer, in, values);
+    }
+    if (NULL != prof)
+        profile_end(prof, &mark, lay, PHASE_FORWARD, layer_flops(layer), layer_bytes(layer));
+
+    layer_activate(prvt, lay, values, layer->valLen, prof);
+}
+
+/* Calculates the dense first layer for count sparse rows from first into values. Only the
+* weights of the non-zero inputs are read, the zeros are not multiplied */
+static void sparse_forward(p_PRIVATE prvt, const SPARSE *sparse, size_t first, size_t count, double *values, p_PROFILER prof) {
+    size_t row, neu, k, begin, end, nonZeros;
+    double tmp;
+    const double *weights;
+    p_LAYER layer = &prvt->Lays[0];
+    PROFILE_MARK mark;
+
+    if (NULL != prof) profile_begin(prof, &mark);
+    for (row = 0; row < count; row++) {
+        begin = sparse->offsets[first + row];
+        end = sparse->offsets[first + row + 1];
+        for (neu = 0; neu < layer->neuLen; neu++) {
+            tmp = 0.0;
+            weights = layer->neurons[neu].weights;
+            for (k = begin; k < end; k++)
+                tmp += weights[sparse->indices[k]] * sparse->values[k];
+            values[row * layer->neuLen + neu] = tmp;
+        }
+    }
+    if (NULL != prof) {
+        nonZeros = sparse->offsets[first + count] - sparse->offsets[first];
+        profile_end(prof, &mark, 0, PHASE_FORWARD, 2.0 * nonZeros * layer->neuLen,
+            sizeof(double) * ((double)nonZeros * (layer->neuLen + 2) + (double)count * layer->valLen));
+    }
+
+    layer_activate(prvt, 0, values, count * layer->valLen, prof);
+}
+
+/* Calculates all the layers of the Neural Network for the given inputs */
+static void forward(p_PRIVATE prvt, const double *inputs) {
+    size_t lay;
+
+    for (lay = 0; lay < prvt->layLen; lay++)
+        layer_forward(prvt, lay, (0 == lay) ? inputs : prvt->Lays[lay - 1].values,
+            prvt->Lays[lay].values, prvt->Lays[lay].cols, (NULL != prvt->ws) ? prvt->ws->pack : NULL, prvt->prof);
+    if (NULL != prvt->lazy)
+        prvt->lazy->pending = 0;
+}
+
+/* Marks all the outputs as pending before CNNFW_Calculate, returns 1 if the output layer is
+* left to be calculated on demand. Only a dense output layer after a hidden layer can be */
+static int lazy_start(p_PRIVATE prvt) {
+    p_LAYER layer = &prvt->Lays[prvt->layLen - 1];
+
+    if (ENABLE != prvt->lazyOutputs || 2 > prvt->layLen || LAYER_DENSE != layer->type) {
+        if (NULL != prvt->lazy) prvt->lazy->pending = 0;
+        return 0;
+    }
+    /* Without the flags all the outputs are calculated at once */
+    if (NULL == prvt->lazy) {
+        prvt->lazy = (p_LAZY)malloc(sizeof(LAZY) + layer->valLen);
+        if (NULL == prvt->lazy) return 0;
+        prvt->lazy->ready = (unsigned char *)(prvt->lazy + 1);
+    }
+    memset(prvt->lazy->ready, 0, layer->valLen);
+    prvt->lazy->pending = 1;
+
+    return 1;
+}
+
+/* Calculates the output if it is still pending */
+static void lazy_output(p_PRIVATE prvt, size_t index) {
+    size_t last = prvt->layLen - 1;
+    p_LAZY lazy = prvt->lazy;
+
+    if (NULL != lazy && lazy->pending && !lazy->ready[index]) {
+        prvt->Lays[last].values[index] = neuron_forward(prvt, last, index, prvt->Lays[last - 1].values);
+        lazy->ready[index] = 1;
+    }
+}
+
+/* Calculates all the pending outputs */
+static void lazy_finish(p_PRIVATE prvt) {
+    size_t neu;
+
+    if (NULL != prvt->lazy && prvt->lazy->pending) {
+        for (neu = 0; neu < prvt->Lays[prvt->layLen - 1].valLen; neu++)
+            lazy_output(prvt, neu);
+        prvt->lazy->pending = 0;
+    }
+}
+
+int CNNFW_Calculate(N_NET NNetwork) {
+    size_t lay, layers;
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+
+    layers = lazy_start(prvt) ? prvt->layLen - 1 : prvt->layLen;
+    for (lay = 0; lay < layers; lay++) {
+        if (0 == lay && NULL != prvt->sparseInps && 0 < prvt->sparseInps->rows)
+            sparse_forward(prvt, prvt->sparseInps, 0, 1, prvt->Lays[0].values, prvt->prof);
+        else
+            layer_forward(prvt, lay, (0 == lay) ? prvt->Inps.inputs : prvt->Lays[lay - 1].values, prvt->Lays[lay].values,
+                prvt->Lays[lay].cols, (NULL != prvt->ws) ? prvt->ws->pack : NULL, prvt->prof);
+    }
+
+    return 0;
+}
+
+int CNNFW_SetLazyOutputs(N_NET NNetwork, FEATURE_STATE state) {
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+    if (ENABLE != state && DISABLE != state) {
+        printf("Unknown state of the lazy outputs\n");
+        return 1;
+    }
+
+    lazy_finish(prvt);
+    prvt->lazyOutputs = state;
+
+    return 0;
+}
+
+/* The number of the weights of all the layers, they are stored one after another */
+static size_t weights_count(const PRIVATE *prvt) {
+    size_t lay, count = 0;
+    for (lay = 0; lay < prvt->layLen; lay++)
+        count += prvt->Lays[lay].neuLen * prvt->Lays[lay].weiLen;
+    return count;
+}
+
+/* The parameters are all the weights followed by the biases of the hidden layers */
+static size_t parameters_count(const PRIVATE *prvt) {
+    size_t lay, count = weights_count(prvt);
+    for (lay = 0; lay + 1 < prvt->layLen; lay++)
+        if (layer_has_bias(&prvt->Lays[lay])) count++;
+    return count;
+}
+
+static double *weights_begin(p_PRIVATE prvt) {
+    return (double *)(prvt->Lays[prvt->layLen - 1].neurons + prvt->Lays[prvt->layLen - 1].neuLen);
+}
+
+/* The number of rows of the training data, the sparse data is used while it is set */
+static size_t data_rows(const PRIVATE *prvt) {
+    return (NULL != prvt->sparseData) ? prvt->sparseData->rows : prvt->Data.rows;
+}
+
+/* Creates the buffers for the passes over up to rows rows at once and, if gradient
+* is not 0, for the gradient of all the parameters */
+static p_WORKSPACE workspace_create(const PRIVATE *prvt, size_t rows, int gradient) {
+    size_t lay, doubles = 0, maxCols = 0, dim = rows;
+    double *p;
+    const LAYER *layer;
+    p_WORKSPACE ws;
+
+    for (lay = 0; lay < prvt->layLen; lay++) {
+        layer = &prvt->Lays[lay];
+        doubles += 2 * rows * layer->valLen;
+        if (layer->colLen > maxCols) maxCols = layer->colLen;
+        /* The largest size of the matrices multiplied for the layer */
+        if (layer->valLen > dim) dim = layer->valLen;
+        if (layer->weiLen > dim) dim = layer->weiLen;
+    }
+    doubles += 2 * maxCols + gemm_pack_size(dim) + (gradient ? parameters_count(prvt) : 0);
+
+    ws = (p_WORKSPACE)malloc(sizeof(WORKSPACE) + sizeof(double) * doubles + 2 * sizeof(double *) * prvt->layLen);
+    if (NULL == ws) {
+        printf("Unsuccessful memory allocation\n");
+        return NULL;
+    }
+
+    p = (double *)(ws + 1);
+    ws->rows = rows;
+    ws->values = (double **)(p + doubles);
+    ws->deltas = ws->values + prvt->layLen;
+    for (lay = 0; lay < prvt->layLen; lay++) {
+        ws->values[lay] = p;
+        p += rows * prvt->Lays[lay].valLen;
+        ws->deltas[lay] = p;
+        p += rows * prvt->Lays[lay].valLen;
+    }
+    ws->cols = p;
+    ws->dcols = p + maxCols;
+    ws->pack = p + 2 * maxCols;
+    ws->grad = gradient ? ws->pack + gemm_pack_size(dim) : NULL;
+
+    return ws;
+}
+
+/* Calculates the first layers layers for count <= ws->rows rows of inputs (stored ldx values
+* apart) into the workspace. Dense layers are calculated for all the rows by one matrix
+* multiplication, the other layers row by row. If sparse is not NULL, its rows from
+* first are the inputs instead */
+static void forward_rows(p_PRIVATE prvt, p_WORKSPACE ws, const double *inputs, size_t ldx,
+    const SPARSE *sparse, size_t first, size_t count, size_t layers, p_PROFILER prof) {
+    size_t lay, row, ldIn;
+    const double *in;
+    p_LAYER layer;
+    PROFILE_MARK mark;
+
+    for (lay = 0; lay < layers; lay++) {
+        layer = &prvt->Lays[lay];
+        in = (0 == lay) ? inputs : ws->values[lay - 1];
+        ldIn = (0 == lay) ? ldx : prvt->Lays[lay - 1].valLen;
+
+        if (0 == lay && NULL != sparse) {
+            sparse_forward(prvt, sparse, first, count, ws->values[0], prof);
+        } else if (LAYER_DENSE == layer->type) {
+            if (NULL != prof) profile_begin(prof, &mark);
+            dense_gemm(layer, count, in, ldIn, ws->values[lay], ws->pack);
+            if (NULL != prof)
+                profile_end(prof, &mark, lay, PHASE_FORWARD, count * layer_flops(layer), layer_bytes(layer) + sizeof(double) * count * (ldIn + layer->valLen));
+            layer_activate(prvt, lay, ws->values[lay], count * layer->valLen, prof);
+        } else {
+            for (row = 0; row < count; row++)
+                layer_forward(prvt, lay, in + row * ldIn, ws->values[lay] + row * layer->valLen, ws->cols, ws->pack, prof);
+        }
+    }
+}
+
+/* Calculates count sets of inputs into the outputs tile by tile in the workspace */
+static void calculate_rows(p_PRIVATE prvt, p_WORKSPACE ws, const double *inputs, size_t count, double *outputs, p_PROFILER prof) {
+    size_t first, rows, outLen = prvt->Lays[prvt->layLen - 1].valLen;
+
+    for (first = 0; first < count; first += rows) {
+        rows = (count - first < ws->rows) ? count - first : ws->rows;
+        forward_rows(prvt, ws, inputs + first * prvt->Inps.inpLen, prvt->Inps.inpLen, NULL, 0, rows, prvt->layLen, prof);
+        memcpy(outputs + first * outLen, ws->values[prvt->layLen - 1], sizeof(double) * rows * outLen);
+    }
+}
+
+int CNNFW_CalculateBatch(N_NET NNetwork, const double *inputs, size_t count, double *outputs) {
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+    if (NULL == inputs || NULL == outputs) {
+        printf("The pointers to the inputs and outputs cannot be NULL\n");
+        return 1;
+    }
+
+    if (NULL == prvt->ws) {
+        prvt->ws = workspace_create(prvt, prvt->tileRows, 0);
+        if (NULL == prvt->ws) return 1;
+    }
+
+    calculate_rows(prvt, prvt->ws, inputs, count, outputs, prvt->prof);
+
+    return 0;
+}
+
+/* Calculates count sets of inputs tile by tile as calculate_rows does, of a dense output layer only
+* the selected outputs are calculated, every run of them is one matrix multiplication */
+static void calculate_masked_rows(p_PRIVATE prvt, p_WORKSPACE ws, const double *inputs, size_t count,
+    const unsigned char *mask, size_t selected, double *outputs, p_PROFILER prof) {
+    size_t first, rows, row, neu, run, col, ldIn, last = prvt->layLen - 1;
+    const double *in;
+    p_LAYER layer = &prvt->Lays[last];
+    PROFILE_MARK mark;
+
+    for (first = 0; first < count; first += rows) {
+        rows = (count - first < ws->rows) ? count - first : ws->rows;
+        if (LAYER_DENSE != layer->type) {
+            forward_rows(prvt, ws, inputs + first * prvt->Inps.inpLen, prvt->Inps.inpLen, NULL, 0, rows, prvt->layLen, prof);
+            for (row = 0; row < rows; row++)
+                for (neu = 0, col = 0; neu < layer->valLen; neu++)
+                    if (mask[neu])
+                        outputs[(first + row) * selected + col++] = ws->values[last][row * layer->valLen + neu];
+            continue;
+        }
+
+        forward_rows(prvt, ws, inputs + first * prvt->Inps.inpLen, prvt->Inps.inpLen, NULL, 0, rows, last, prof);
+        in = (0 == last) ? inputs + first * prvt->Inps.inpLen : ws->values[last - 1];
+        ldIn = (0 == last) ? prvt->Inps.inpLen : prvt->Lays[last - 1].valLen;
+
+        if (NULL != prof) profile_begin(prof, &mark);
+        for (neu = 0, col = 0; neu < layer->neuLen; neu += run) {
+            run = 1;
+            while (neu + run < layer->neuLen && (0 != mask[neu]) == (0 != mask[neu + run]))
+                run++;
+            if (mask[neu]) {
+                gemm(0, 1, rows, run, layer->weiLen, in, ldIn, layer->neurons[neu].weights, layer->weiLen,
+                    0, outputs + first * selected + col, selected, ws->pack);
+                col += run;
+            }
+        }
+        if (NULL != prof)
+            profile_end(prof, &mark, last, PHASE_FORWARD, 2.0 * rows * selected * layer->weiLen,
+                sizeof(double) * ((double)selected * layer->weiLen + (double)rows * (ldIn + selected)));
+    }
+}
+
+int CNNFW_CalculateBatchMasked(N_NET NNetwork, const double *inputs, size_t count, const unsigned char *mask, double *outputs) {
+    size_t neu, selected = 0;
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+    if (NULL == inputs || NULL == mask || NULL == outputs) {
+        printf("The pointers to the inputs, the mask and the outputs cannot be NULL\n");
+        return 1;
+    }
+
+    for (neu = 0; neu < prvt->Lays[prvt->layLen - 1].valLen; neu++)
+        if (mask[neu]) selected++;
+    if (0 == selected)
+        return 0;
+
+    if (NULL == prvt->ws) {
+        prvt->ws = workspace_create(prvt, prvt->tileRows, 0);
+        if (NULL == prvt->ws) return 1;
+    }
+
+    calculate_masked_rows(prvt, prvt->ws, inputs, count, mask, selected, outputs, prvt->prof);
+
+    return 0;
+}
+
+int CNNFW_CalculateSparseBatch(N_NET NNetwork, const size_t *offsets, const size_t *indices, const double *values,
+    size_t count, double *outputs) {
+    size_t first, rows, outLen;
+    SPARSE sparse;
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+    if (NULL == offsets || NULL == outputs || ((NULL == indices || NULL == values) && offsets[count] > offsets[0])) {
+        printf("The pointers to the sparse inputs and outputs cannot be NULL\n");
+        return 1;
+    }
+    if (sparse_check(prvt, count, offsets, indices))
+        return 1;
+
+    if (NULL == prvt->ws) {
+        prvt->ws = workspace_create(prvt, prvt->tileRows, 0);
+        if (NULL == prvt->ws) return 1;
+    }
+
+    /* The rows of the caller are only read */
+    sparse.rows = count;
+    sparse.offsets = (size_t *)offsets;
+    sparse.indices = (size_t *)indices;
+    sparse.values = (double *)values;
+    sparse.targets = NULL;
+
+    outLen = prvt->Lays[prvt->layLen - 1].valLen;
+    for (first = 0; first < count; first += rows) {
+        rows = (count - first < prvt->ws->rows) ? count - first : prvt->ws->rows;
+        forward_rows(prvt, prvt->ws, NULL, 0, &sparse, first, rows, prvt->layLen, prvt->prof);
+        memcpy(outputs + first * outLen, prvt->ws->values[prvt->layLen - 1], sizeof(double) * rows * outLen);
+    }
+
+    return 0;
+}
+
+/* The rows calculated by a measurement of the tuning, the number of the measurements of
+* a variant and the shortest time of one, the median of the measurements is taken. A variant
+* replaces the default one only if it is faster by more than TUNE_MARGIN of the time and
+* by more than the spread of the measurements of the default one */
+#define TUNE_ROWS 256
+#define TUNE_RUNS 5
+#define TUNE_MIN_TIME 0.002
+#define TUNE_MARGIN 0.05
+#define TUNE_LINE 256
+
+/* The numbers of rows of a tile tried by the tuning */
+static const size_t TuneTiles[] = { 16, 32, 64, 128, 256 };
+
+/* A measured variant: the passes over the rows with the tile of the workspace
+* or, if layer is not NULL, the product of the dense layer with its kernel */
+typedef struct {
+    p_PRIVATE prvt;
+    const LAYER *layer;
+    const double *inputs;
+    double *outputs;
+} TUNE_CASE;
+
+/* The model of the processor, which the tuned kernels are kept for */
+static void tune_cpu(char *model, size_t size) {
+    char *p;
+#if defined(_WIN32)
+    p = getenv("PROCESSOR_IDENTIFIER");
+    strncpy(model, (NULL != p) ? p : "", size - 1);
+    model[size - 1] = '\0';
+#else
+    char line[TUNE_LINE];
+    FILE *fp = fopen("/proc/cpuinfo", "r");
+
+    model[0] = '\0';
+    if (NULL != fp) {
+        while (NULL != fgets(line, sizeof(line), fp)) {
+            p = strchr(line, ':');
+            if (0 == strncmp(line, "model name", 10) && NULL != p) {
+                for (p++; ' ' == *p; p++)
+                    continue;
+                strncpy(model, p, size - 1);
+                model[size - 1] = '\0';
+                break;
+            }
+        }
+        fclose(fp);
+    }
+#endif
+
+    /* The tabs and the ends of lines separate the fields of the cache */
+    model[strcspn(model, "\r\n")] = '\0';
+    for (p = model; '\0' != *p; p++)
+        if ('\t' == *p) *p = ' ';
+    if ('\0' == model[0])
+        strcpy(model, "unknown");
+}
+
+/* Finds the value of the key for the processor in the cache file, returns 1 if it is there.
+* The cache has a line for every key: the processor, the key and the value separated by tabs */
+static int tune_lookup(const char *fileName, const char *cpu, const char *key, char *value, size_t size) {
+    char line[3 * TUNE_LINE], *keyField, *valueField;
+    int found = 0;
+    FILE *fp;
+
+    if (NULL == fileName)
+        return 0;
+    fp = fopen(fileName, "r");
+    if (NULL == fp)
+        return 0;
+
+    /* A key measured again is appended, the last line wins */
+    while (NULL != fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        keyField = strchr(line, '\t');
+        valueField = (NULL != keyField) ? strchr(keyField + 1, '\t') : NULL;
+        if (NULL == valueField)
+            continue;
+        *keyField++ = '\0';
+        *valueField++ = '\0';
+        if (0 == strcmp(line, cpu) && 0 == strcmp(keyField, key)) {
+            strncpy(value, valueField, size - 1);
+            value[size - 1] = '\0';
+            found = 1;
+        }
+    }
+    fclose(fp);
+
+    return found;
+}
+
+static int tune_store(const char *fileName, const char *cpu, const char *key, const char *value) {
+    FILE *fp;
+
+    if (NULL == fileName)
+        return 0;
+    fp = fopen(fileName, "a");
+    if (NULL == fp) {
+        printf("Unsuccessful opening of the tuning cache\n");
+        return 1;
+    }
+    fprintf(fp, "%s\t%s\t%s\n", cpu, key, value);
+    fclose(fp);
+
+    return 0;
+}
+
+/* Creates the workspace for the tile of the Neural Network */
+static int tune_workspace(p_PRIVATE prvt) {
+    free(prvt->ws);
+    prvt->ws = workspace_create(prvt, prvt->tileRows, 0);
+
+    return (NULL == prvt->ws) ? 1 : 0;
+}
+
+/* The time of the variant per run, the median of TUNE_RUNS measurements. The noise is the
+* difference of the measurements around the median */
+static double tune_measure(const TUNE_CASE *tc, double *noise) {
+    size_t run, runs, i;
+    double start, elapsed, times[TUNE_RUNS];
+    p_PRIVATE prvt = tc->prvt;
+
+    for (run = 0; run < TUNE_RUNS; run++) {
+        runs = 0;
+        start = time_now();
+        do {
+            if (NULL == tc->layer)
+                calculate_rows(prvt, prvt->ws, tc->inputs, TUNE_ROWS, tc->outputs, NULL);
+            else
+                dense_gemm(tc->layer, prvt->tileRows, tc->inputs, tc->layer->weiLen, tc->outputs, prvt->ws->pack);
+            runs++;
+            elapsed = time_now() - start;
+        } while (elapsed < TUNE_MIN_TIME);
+        elapsed /= runs;
+        for (i = run; i > 0 && times[i - 1] > elapsed; i--)
+            times[i] = times[i - 1];
+        times[i] = elapsed;
+    }
+
+    if (NULL != noise)
+        *noise = times[TUNE_RUNS / 2 + 1] - times[TUNE_RUNS / 2 - 1];
+
+    return times[TUNE_RUNS / 2];
+}
+
+/* The candidate is faster than the default variant by more than the noise */
+static int tune_is_better(double candidate, double deflt, double noise) {
+    if (noise < TUNE_MARGIN * deflt)
+        noise = TUNE_MARGIN * deflt;
+
+    return (candidate < deflt - noise) ? 1 : 0;
+}
+
+int CNNFW_Tune(N_NET NNetwork, const char *fileName, size_t *measured) {
+    size_t lay, i, best, maxLen, count = 0;
+    unsigned long hash = 2166136261UL;
+    double elapsed, bestTime = 0.0, defaultTime, noise, *buffer;
+    KERNEL kernel;
+    char cpu[TUNE_LINE], key[TUNE_LINE], value[TUNE_LINE];
+    p_LAYER layer;
+    TUNE_CASE tc;
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+
+    maxLen = prvt->Inps.inpLen;
+    for (lay = 0; lay < prvt->layLen; lay++) {
+        layer = &prvt->Lays[lay];
+        if (layer->valLen > maxLen) maxLen = layer->valLen;
+        if (layer->weiLen > maxLen) maxLen = layer->weiLen;
+        /* The shapes of all the layers identify the Neural Network in the cache */
+        hash = ((hash ^ (unsigned long)layer->type) * 16777619UL) & 0xFFFFFFFFUL;
+        hash = ((hash ^ (unsigned long)layer->weiLen) * 16777619UL) & 0xFFFFFFFFUL;
+        hash = ((hash ^ (unsigned long)layer->neuLen) * 16777619UL) & 0xFFFFFFFFUL;
+        hash = ((hash ^ (unsigned long)layer->valLen) * 16777619UL) & 0xFFFFFFFFUL;
+    }
+
+    /* The inputs of the measurements do not touch the state of rand() */
+    buffer = (double *)malloc(sizeof(double) * 2 * TUNE_ROWS * maxLen);
+    if (NULL == buffer) {
+        printf("Unsuccessful memory allocation\n");
+        return 1;
+    }
+    for (i = 0; i < TUNE_ROWS * maxLen; i++)
+        buffer[i] = (double)(i % 17) / 17.0;
+    tc.prvt = prvt;
+    tc.inputs = buffer;
+    tc.outputs = buffer + TUNE_ROWS * maxLen;
+
+    tune_cpu(cpu, sizeof(cpu));
+
+    /* The tile is measured with the kernels chosen by the sizes */
+    for (lay = 0; lay < prvt->layLen; lay++)
+        prvt->Lays[lay].kernel = KERNEL_AUTO;
+    sprintf(key, "tile %lu %lu %lu %08lx", (unsigned long)prvt->Inps.inpLen, (unsigned long)prvt->layLen,
+        (unsigned long)prvt->Lays[prvt->layLen - 1].valLen, hash);
+    best = 0;
+    if (tune_lookup(fileName, cpu, key, value, sizeof(value)))
+        best = (size_t)strtoul(value, NULL, 10);
+    if (0 == best || TUNE_ROWS < best) {
+        tc.layer = NULL;
+        prvt->tileRows = ROWS_TILE;
+        if (tune_workspace(prvt)) {
+            free(buffer);
+            return 1;
+        }
+        defaultTime = tune_measure(&tc, &noise);
+        best = ROWS_TILE;
+        for (i = 0; i < sizeof(TuneTiles) / sizeof(TuneTiles[0]); i++) {
+            if (ROWS_TILE == TuneTiles[i])
+                continue;
+            prvt->tileRows = TuneTiles[i];
+            if (tune_workspace(prvt)) {
+                free(buffer);
+                return 1;
+            }
+            elapsed = tune_measure(&tc, NULL);
+            if (ROWS_TILE == best || elapsed < bestTime) {
+                bestTime = elapsed;
+                best = TuneTiles[i];
+            }
+        }
+        if (!tune_is_better(bestTime, defaultTime, noise))
+            best = ROWS_TILE;
+        sprintf(value, "%lu", (unsigned long)best);
+        count++;
+        if (tune_store(fileName, cpu, key, value)) {
+            free(buffer);
+            return 1;
+        }
+    }
+    prvt->tileRows = best;
+    if (tune_workspace(prvt)) {
+        free(buffer);
+        return 1;
+    }
+
+    /* The kernel of every dense layer for the products of a tile */
+    for (lay = 0; lay < prvt->layLen; lay++) {
+        layer = &prvt->Lays[lay];
+        if (LAYER_DENSE != layer->type)
+            continue;
+
+        sprintf(key, "dense %lux%lu rows %lu", (unsigned long)layer->weiLen, (unsigned long)layer->neuLen,
+            (unsigned long)prvt->tileRows);
+        if (tune_lookup(fileName, cpu, key, value, sizeof(value)) &&
+            (0 == strcmp(value, "auto") || 0 == strcmp(value, "simple") || 0 == strcmp(value, "blocked"))) {
+            layer->kernel = (0 == strcmp(value, "simple")) ? KERNEL_SIMPLE :
+                (0 == strcmp(value, "blocked")) ? KERNEL_BLOCKED : KERNEL_AUTO;
+            continue;
+        }
+
+        /* The kernel chosen by the sizes stays unless the other one is clearly faster */
+        tc.layer = layer;
+        layer->kernel = KERNEL_AUTO;
+        defaultTime = tune_measure(&tc, &noise);
+        layer->kernel = KERNEL_SIMPLE;
+        bestTime = tune_measure(&tc, NULL);
+        kernel = KERNEL_SIMPLE;
+        layer->kernel = KERNEL_BLOCKED;
+        elapsed = tune_measure(&tc, NULL);
+        if (elapsed < bestTime) {
+            bestTime = elapsed;
+            kernel = KERNEL_BLOCKED;
+        }
+        layer->kernel = tune_is_better(bestTime, defaultTime, noise) ? kernel : KERNEL_AUTO;
+        count++;
+        if (tune_store(fileName, cpu, key, (KERNEL_SIMPLE == layer->kernel) ? "simple" :
+            (KERNEL_BLOCKED == layer->kernel) ? "blocked" : "auto")) {
+            free(buffer);
+            return 1;
+        }
+    }
+
+    free(buffer);
+    if (NULL != measured)
+        *measured = count;
+
+    return 0;
+}
+
+/* The loss on count rows of data with the inputs and the outputs, calculated in tiles as CNNFW_CalculateBatch does */
+static int rows_loss(p_PRIVATE prvt, const double *data, size_t count, double *loss) {
+    size_t first, rows, row, out, outLen = prvt->Lays[prvt->layLen - 1].valLen;
+    double diff, result = 0.0;
+    const double *outputs;
+
+    if (NULL == prvt->ws) {
+        prvt->ws = workspace_create(prvt, prvt->tileRows, 0);
+        if (NULL == prvt->ws) return 1;
+    }
+
+    for (first = 0; first < count; first += rows) {
+        rows = (count - first < prvt->ws->rows) ? count - first : prvt->ws->rows;
+        forward_rows(prvt, prvt->ws, data + first * prvt->Data.cols, prvt->Data.cols, NULL, 0, rows, prvt->layLen, prvt->prof);
+        outputs = prvt->ws->values[prvt->layLen - 1];
+        for (row = 0; row < rows; row++) {
+            for (out = 0; out < outLen; out++) {
+                diff = outputs[row * outLen + out] - data[(first + row) * prvt->Data.cols + prvt->Inps.inpLen + out];
+                result += diff * diff;
+            }
+        }
+    }
+    *loss = result / count;
+
+    return 0;
+}
+
+/* The loss on all the rows of the sparse training data */
+static int sparse_loss(p_PRIVATE prvt, const SPARSE *sparse, double *loss) {
+    size_t first, rows, i, outLen = prvt->Lays[prvt->layLen - 1].valLen;
+    double diff, result = 0.0;
+    const double *outputs;
+
+    if (NULL == prvt->ws) {
+        prvt->ws = workspace_create(prvt, prvt->tileRows, 0);
+        if (NULL == prvt->ws) return 1;
+    }
+
+    for (first = 0; first < sparse->rows; first += rows) {
+        rows = (sparse->rows - first < prvt->ws->rows) ? sparse->rows - first : prvt->ws->rows;
+        forward_rows(prvt, prvt->ws, NULL, 0, sparse, first, rows, prvt->layLen, prvt->prof);
+        outputs = prvt->ws->values[prvt->layLen - 1];
+        for (i = 0; i < rows * outLen; i++) {
+            diff = outputs[i] - sparse->targets[first * outLen + i];
+            result += diff * diff;
+        }
+    }
+    *loss = result / sparse->rows;
+
+    return 0;
+}
+
+int CNNFW_GetLoss(N_NET NNetwork, double *loss) {
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+    if (NULL == prvt || NULL == loss) {
+        printf("Neural network and the pointer to the loss cannot be NULL\n");
+        return 1;
+    }
+    if (NULL != prvt->sparseData)
+        return sparse_loss(prvt, prvt->sparseData, loss);
+    if (NULL == prvt->Data.data || 0 == prvt->Data.rows) {
+        printf("Train data is NULL\n");
+        return 1;
+    }
+
+    return rows_loss(prvt, prvt->Data.data, prvt->Data.rows, loss);
+}
+
+/* The inverse of im2col: folds the columns back into the input summing the overlapping windows */
+static void col2im(const GEOMETRY *geo, const double *cols, double *in) {
+    size_t c, ky, kx, oy, ox, P = geo->outHeight * geo->outWidth;
+    long iy, ix;
+    const double *row = cols;
+
+    memset(in, 0, sizeof(double) * geo->inChannels * geo->inHeight * geo->inWidth);
+    for (c = 0; c < geo->inChannels; c++) {
+        for (ky = 0; ky < geo->kerHeight; ky++) {
+            for (kx = 0; kx < geo->kerWidth; kx++) {
+                for (oy = 0; oy < geo->outHeight; oy++) {
+                    iy = (long)(oy * geo->strHeight + ky) - (long)geo->padHeight;
+                    if (iy < 0 || iy >= (long)geo->inHeight) continue;
+                    for (ox = 0; ox < geo->outWidth; ox++) {
+                        ix = (long)(ox * geo->strWidth + kx) - (long)geo->padWidth;
+                        if (ix >= 0 && ix < (long)geo->inWidth)
+                            in[(c * geo->inHeight + (size_t)iy) * geo->inWidth + (size_t)ix] += row[oy * geo->outWidth + ox];
+                    }
+                }
+                row += P;
+            }
+        }
+    }
+}
+
+/* Passes the deltas of a pooling layer to its input. Max pooling gives each delta to
+* the first maximum of the window, average pooling spreads it evenly over the window */
+static void pooling_backward(const LAYER *layer, const double *in, const double *delta, double *dIn) {
+    const GEOMETRY *geo = &layer->geo;
+    size_t c, ky, kx, oy, ox, cnt, idx, best, pass;
+    long iy, ix;
+    double acc, v, share;
+
+    memset(dIn, 0, sizeof(double) * geo->inChannels * geo->inHeight * geo->inWidth);
+    for (c = 0; c < geo->outChannels; c++) {
+        for (oy = 0; oy < geo->outHeight; oy++) {
+            for (ox = 0; ox < geo->outWidth; ox++) {
+                acc = share = 0.0;
+                cnt = best = 0;
+                for (pass = 0; pass < 2; pass++) {
+                    for (ky = 0; ky < geo->kerHeight; ky++) {
+                        iy = (long)(oy * geo->strHeight + ky) - (long)geo->padHeight;
+                        if (iy < 0 || iy >= (long)geo->inHeight) continue;
+                        for (kx = 0; kx < geo->kerWidth; kx++) {
+                            ix = (long)(ox * geo->strWidth + kx) - (long)geo->padWidth;
+                            if (ix < 0 || ix >= (long)geo->inWidth) continue;
+                            idx = (c * geo->inHeight + (size_t)iy) * geo->inWidth + (size_t)ix;
+                            if (1 == pass) {
+                                dIn[idx] += share;
+                                continue;
+                            }
+                            v = in[idx];
+                            if (0 == cnt || v > acc) {
+                                acc = v;
+                                best = idx;
+                            }
+                            cnt++;
+                        }
+                    }
+                    if (0 == cnt) break;
+                    if (LAYER_MAX_POOL == layer->type) {
+                        dIn[best] += delta[(c * geo->outHeight + oy) * geo->outWidth + ox];
+                        break;
+                    }
+                    share = delta[(c * geo->outHeight + oy) * geo->outWidth + ox] / (double)cnt;
+                }
+            }
+        }
+    }
+}
+
+/* Adds to grad the gradient of the squared errors of count <= ws->rows rows of the training
+* data (stored ldr values apart) multiplied by scale. The layers are calculated into the
+* workspace, the Neural Network does not change. The gradients of the weights of the
+* dense layers are calculated for all the rows by matrix multiplications. If sparse is
+* not NULL, its rows from first are used instead and only the columns of the non-zero
+* inputs get the derivatives of the first layer. If loss is not NULL, the squared errors
+* multiplied by scale are added to it */
+static void backward_rows(p_PRIVATE prvt, p_WORKSPACE ws, const double *rows, size_t ldr,
+    const SPARSE *sparse, size_t first, size_t count, double scale, double *grad, double *loss, p_PROFILER prof) {
+    size_t lay, row, i, k, P, ldIn, neuLen, weiLen, valLen, wOff, bOff;
+    double d, diff, *delta, *dIn, *g;
+    const double *in, *values, *weights, *target;
+    p_LAYER layer;
+    PROFILE_MARK mark;
+
+    forward_rows(prvt, ws, rows, ldr, sparse, first, count, prvt->layLen, prof);
+
+    lay = prvt->layLen - 1;
+    valLen = prvt->Lays[lay].valLen;
+    for (row = 0; row < count; row++) {
+        target = (NULL != sparse) ? sparse->targets + (first + row) * valLen : rows + row * ldr + prvt->Inps.inpLen;
+        for (i = 0; i < valLen; i++) {
+            diff = ws->values[lay][row * valLen + i] - target[i];
+            ws->deltas[lay][row * valLen + i] = 2.0 * scale * diff;
+            if (NULL != loss) *loss += scale * diff * diff;
+        }
+    }
+
+    wOff = weights_count(prvt);
+    bOff = parameters_count(prvt);
+    for (lay = prvt->layLen; lay-- > 0; ) {
+        layer = &prvt->Lays[lay];
+        neuLen = layer->neuLen;
+        weiLen = layer->weiLen;
+        valLen = layer->valLen;
+        in = (0 == lay) ? rows : ws->values[lay - 1];
+        ldIn = (0 == lay) ? ldr : prvt->Lays[lay - 1].valLen;
+        values = ws->values[lay];
+        delta = ws->deltas[lay];
+        dIn = (0 == lay) ? NULL : ws->deltas[lay - 1];
+        weights = (0 < neuLen) ? layer->neurons[0].weights : NULL;
+        wOff -= neuLen * weiLen;
+
+        if (NULL != prof) profile_begin(prof, &mark);
+        if (lay < prvt->layLen - 1 && layer_has_bias(layer)) {
+            if (ENABLE == prvt->actFunc) {
+                for (i = 0; i < count * valLen; i++)
+                    delta[i] *= values[i] * (1.0 - values[i]);
+            }
+            d = 0.0;
+            for (i = 0; i < count * valLen; i++)
+                d += delta[i];
+            grad[--bOff] += d;
+        }
+
+        if (0 == lay && NULL != sparse) {
+            for (row = 0; row < count; row++) {
+                for (i = 0; i < neuLen; i++) {
+                    d = delta[row * neuLen + i];
+                    g = grad + wOff + i * weiLen;
+                    for (k = sparse->offsets[first + row]; k < sparse->offsets[first + row + 1]; k++)
+                        g[sparse->indices[k]] += d * sparse->values[k];
+                }
+            }
+        } else if (LAYER_DENSE == layer->type) {
+            /* The gradient of the weights [neurons x inputs] += delta^T * inputs */
+            gemm(1, 0, neuLen, weiLen, count, delta, neuLen, in, ldIn, 1, grad + wOff, weiLen, ws->pack);
+            /* The deltas of the inputs [rows x inputs] = delta * weights */
+            if (NULL != dIn)
+                gemm(0, 0, count, weiLen, neuLen, delta, neuLen, weights, weiLen, 0, dIn, ldIn, ws->pack);
+        } else if (LAYER_CONV == layer->type) {
+            /* delta of a row is [filters x P], the columns are [weiLen x P] */
+            P = layer->geo.outHeight * layer->geo.outWidth;
+            for (row = 0; row < count; row++) {
+                im2col(&layer->geo, in + row * ldIn, ws->cols);
+                gemm(0, 1, neuLen, weiLen, P, delta + row * valLen, P, ws->cols, P, 1, grad + wOff, weiLen, ws->pack);
+                if (NULL != dIn) {
+                    gemm(1, 0, weiLen, P, neuLen, weights, weiLen, delta + row * valLen, P, 0, ws->dcols, P, ws->pack);
+                    col2im(&layer->geo, ws->dcols, dIn + row * ldIn);
+                }
+            }
+        } else if (NULL != dIn) {
+            for (row = 0; row < count; row++)
+                pooling_backward(layer, in + row * ldIn, delta + row * valLen, dIn + row * ldIn);
+        }
+        if (NULL != prof)
+            profile_end(prof, &mark, lay, PHASE_BACKWARD, 2.0 * count * layer_flops(layer), 2.0 * layer_bytes(layer));
+    }
+}
+
+int CNNFW_SetTrainingMethod(N_NET NNetwork, TRAINING_METHOD method) {
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+    if (FINITE_DIFFERENCE != method && CENTRAL_DIFFERENCE != method && BACKPROPAGATION != method && LBFGS != method) {
+        printf("Unknown training method\n");
+        return 1;
+    }
+
+    prvt->method = method;
+
+    return 0;
+}
+
+/* The gradient of the loss over the rows of the training data into gradient tile by tile in the
+* workspace of the Neural Network, every row contributes its part of the loss over all the rows.
+* If loss is not NULL, the part of the loss of the rows is stored in it */
+static void gradient_rows(p_PRIVATE prvt, size_t firstRow, size_t rowsCount, double *gradient, double *loss) {
+    size_t i, rows, count = parameters_count(prvt), total = data_rows(prvt);
+
+    for (i = 0; i < count; i++)
+        gradient[i] = 0.0;
+    if (NULL != loss)
+        *loss = 0.0;
+
+    for (i = firstRow; i < firstRow + rowsCount; i += rows) {
+        rows = (firstRow + rowsCount - i < prvt->ws->rows) ? firstRow + rowsCount - i : prvt->ws->rows;
+        backward_rows(prvt, prvt->ws, (NULL != prvt->sparseData) ? NULL : prvt->Data.data + i * prvt->Data.cols,
+            prvt->Data.cols, prvt->sparseData, i, rows, 1.0 / (double)total, gradient, loss, prvt->prof);
+    }
+}
+
+int CNNFW_ComputeGradient(N_NET NNetwork, DATA_ROWS firstRow, DATA_ROWS rowsCount, double *gradient) {
+    size_t total;
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+    if (NULL == gradient) {
+        printf("The pointer to the gradient cannot be NULL\n");
+        return 1;
+    }
+    if (NULL == prvt->Data.data && NULL == prvt->sparseData) {
+        printf("Train data is NULL\n");
+        return 1;
+    }
+    total = data_rows(prvt);
+    if (firstRow > total || rowsCount > total - firstRow) {
+        printf("The rows are out of range of the data\n");
+        return 1;
+    }
+
+    if (NULL == prvt->ws) {
+        prvt->ws = workspace_create(prvt, prvt->tileRows, 0);
+        if (NULL == prvt->ws) return 1;
+    }
+
+    gradient_rows(prvt, firstRow, rowsCount, gradient, NULL);
+
+    return 0;
+}
+
+int CNNFW_ApplyGradient(N_NET NNetwork, const double *gradient) {
+    size_t lay, i, n;
+    double *weights;
+    const double *biases;
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+    PROFILE_MARK mark;
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+    if (NULL == gradient) {
+        printf("The pointer to the gradient cannot be NULL\n");
+        return 1;
+    }
+
+    weights = weights_begin(prvt);
+    biases = gradient + weights_count(prvt);
+    for (lay = 0; lay < prvt->layLen; lay++) {
+        if (NULL != prvt->prof) profile_begin(prvt->prof, &mark);
+        n = prvt->Lays[lay].neuLen * prvt->Lays[lay].weiLen;
+        for (i = 0; i < n; i++)
+            weights[i] -= prvt->step * gradient[i];
+        weights += n;
+        gradient += n;
+        if (lay < prvt->layLen - 1 && layer_has_bias(&prvt->Lays[lay])) {
+            prvt->Lays[lay].bias -= prvt->step * *biases++;
+            n++;
+        }
+        if (NULL != prvt->prof)
+            profile_end(prvt->prof, &mark, lay, PHASE_UPDATE, 2.0 * n, 3.0 * sizeof(double) * n);
+    }
+
+    prvt->isChanged = 1;
+
+    return 0;
+}
+
+int CNNFW_GetParameters(N_NET NNetwork, double *parameters) {
+    size_t lay, count;
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+    if (NULL == parameters) {
+        printf("The pointer to the parameters cannot be NULL\n");
+        return 1;
+    }
+
+    count = weights_count(prvt);
+    memcpy(parameters, weights_begin(prvt), sizeof(double) * count);
+    for (lay = 0; lay + 1 < prvt->layLen; lay++)
+        if (layer_has_bias(&prvt->Lays[lay]))
+            parameters[count++] = prvt->Lays[lay].bias;
+
+    return 0;
+}
+
+int CNNFW_SetParameters(N_NET NNetwork, const double *parameters) {
+    size_t lay, count;
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+    if (NULL == parameters) {
+        printf("The pointer to the parameters cannot be NULL\n");
+        return 1;
+    }
+
+    count = weights_count(prvt);
+    memcpy(weights_begin(prvt), parameters, sizeof(double) * count);
+    for (lay = 0; lay + 1 < prvt->layLen; lay++)
+        if (layer_has_bias(&prvt->Lays[lay]))
+            prvt->Lays[lay].bias = parameters[count++];
+
+    prvt->isChanged = 1;
+
+    return 0;
+}
+
+/* Makes sure that the workspace of the Neural Network has the buffer for the gradient */
+static int workspace_gradient(p_PRIVATE prvt) {
+    if (NULL != prvt->ws && NULL == prvt->ws->grad) {
+        free(prvt->ws);
+        prvt->ws = NULL;
+    }
+    if (NULL == prvt->ws) {
+        prvt->ws = workspace_create(prvt, prvt->tileRows, 1);
+        if (NULL == prvt->ws) return 1;
+    }
+
+    return 0;
+}
+
+/* One epoch of the gradient descent over all the rows of the data */
+static int train_backpropagation(p_PRIVATE prvt) {
+    if (workspace_gradient(prvt))
+        return 1;
+
+    if (CNNFW_ComputeGradient((N_NET)prvt, 0, data_rows(prvt), prvt->ws->grad))
+        return 1;
+
+    return CNNFW_ApplyGradient((N_NET)prvt, prvt->ws->grad);
+}
+
+int CNNFW_TrainNewest(N_NET NNetwork, DATA_ROWS count) {
+    size_t i, first, rows, done;
+    p_ONLINE online;
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+    if (!online_is_active(prvt))
+        return 1;
+    online = prvt->online;
+    if (1 > count || count > online->filled) {
+        printf("The number of the newest rows is out of range of the filled ring\n");
+        return 1;
+    }
+
+    if (workspace_gradient(prvt))
+        return 1;
+    for (i = 0; i < parameters_count(prvt); i++)
+        prvt->ws->grad[i] = 0.0;
+
+    /* The newest rows end before the next slot and wrap around the end of the ring at most once */
+    first = (online->next + online->recent - count) % online->recent;
+    for (done = 0; done < count; done += rows) {
+        rows = (count - done < prvt->ws->rows) ? count - done : prvt->ws->rows;
+        if (rows > online->recent - first) rows = online->recent - first;
+        backward_rows(prvt, prvt->ws, prvt->Data.data + first * prvt->Data.cols, prvt->Data.cols,
+            NULL, 0, rows, 1.0 / (double)count, prvt->ws->grad, NULL, prvt->prof);
+        first = (first + rows) % online->recent;
+    }
+
+    return CNNFW_ApplyGradient((N_NET)prvt, prvt->ws->grad);
+}
+
+/* The constants of the strong Wolfe conditions of the line search: the sufficient
+* decrease of the loss and the decrease of the derivative along the direction */
+#define LBFGS_C1 1e-4
+#define LBFGS_C2 0.9
+
+/* The calculations of the loss allowed to one line search */
+#define LBFGS_EVALUATIONS 20
+
+/* The norm of the gradient at which the iterations stop, relative to the loss above 1,
+* and the relative decrease of the loss below which a step has made no progress */
+#define LBFGS_TOLERANCE 1e-5
+#define LBFGS_PROGRESS 1e-12
+
+/* The cosine of the angle between the direction and the gradient below which the direction
+* from the history is not taken */
+#define LBFGS_ANGLE 1e-2
+
+static p_LBFGS_MEMORY lbfgs_create(size_t length, size_t history) {
+    p_LBFGS_MEMORY lb;
+
+    lb = (p_LBFGS_MEMORY)malloc(sizeof(LBFGS_MEMORY) + sizeof(double) * (5 * length + 2 * history + 2 * history * length));
+    if (NULL == lb) {
+        printf("Unsuccessful memory allocation\n");
+        return NULL;
+    }
+
+    memset(lb, 0, sizeof(LBFGS_MEMORY));
+    lb->length = length;
+    lb->history = history;
+    lb->x = (double *)(lb + 1);
+    lb->g = lb->x + length;
+    lb->d = lb->g + length;
+    lb->xNew = lb->d + length;
+    lb->gNew = lb->xNew + length;
+    lb->rho = lb->gNew + length;
+    lb->alpha = lb->rho + history;
+    lb->s = lb->alpha + history;
+    lb->y = lb->s + history * length;
+
+    return lb;
+}
+
+static double lbfgs_dot(const double *a, const double *b, size_t n) {
+    size_t i;
+    double result = 0.0;
+
+    for (i = 0; i < n; i++)
+        result += a[i] * b[i];
+
+    return result;
+}
+
+/* Calculates the loss and its gradient over all the rows at the parameters x + step * d
+* into xNew and gNew, returns the loss and the derivative along d */
+static void lbfgs_evaluate(p_PRIVATE prvt, p_LBFGS_MEMORY lb, double step, double *loss, double *derivative) {
+    size_t i;
+
+    for (i = 0; i < lb->length; i++)
+        lb->xNew[i] = lb->x[i] + step * lb->d[i];
+    CNNFW_SetParameters((N_NET)prvt, lb->xNew);
+    gradient_rows(prvt, 0, data_rows(prvt), lb->gNew, loss);
+    *derivative = lbfgs_dot(lb->gNew, lb->d, lb->length);
+    lb->stats.evaluations++;
+}
+
+/* The direction d = -H g by the two-loop recursion over the kept steps, H is the inverse
+* of the Hessian approximated from them */
+static void lbfgs_direction(p_LBFGS_MEMORY lb) {
+    size_t i, j, k, n = lb->length;
+    double beta, gamma;
+    double *d = lb->d, *s, *y;
+
+    for (j = 0; j < n; j++)
+        d[j] = -lb->g[j];
+
+    /* From the newest step to the oldest one and back */
+    for (i = 0; i < lb->count; i++) {
+        k = (lb->next + lb->history - 1 - i) % lb->history;
+        s = lb->s + k * n;
+        y = lb->y + k * n;
+        lb->alpha[k] = lb->rho[k] * lbfgs_dot(s, d, n);
+        for (j = 0; j < n; j++)
+            d[j] -= lb->alpha[k] * y[j];
+    }
+    if (0 < lb->count) {
+        k = (lb->next + lb->history - 1) % lb->history;
+        gamma = lbfgs_dot(lb->s + k * n, lb->y + k * n, n) / lbfgs_dot(lb->y + k * n, lb->y + k * n, n);
+        for (j = 0; j < n; j++)
+            d[j] *= gamma;
+    }
+    for (i = lb->count; i-- > 0; ) {
+        k = (lb->next + lb->history - 1 - i) % lb->history;
+        s = lb->s + k * n;
+        y = lb->y + k * n;
+        beta = lb->rho[k] * lbfgs_dot(y, d, n);
+        for (j = 0; j < n; j++)
+            d[j] += s[j] * (lb->alpha[k] - beta);
+    }
+}
+
+/* The minimum of the cubic with the values and the derivatives at a and b. It is kept
+* away from the ends of the interval, otherwise the middle is taken */
+static double lbfgs_cubic(double a, double fa, double da, double b, double fb, double db) {
+    double d1, d2, t, lo, width;
+
+    d1 = da + db - 3.0 * (fa - fb) / (a - b);
+    d2 = d1 * d1 - da * db;
+    if (d2 < 0.0)
+        return 0.5 * (a + b);
+    d2 = (b < a) ? -sqrt(d2) : sqrt(d2);
+    t = b - (b - a) * (db + d2 - d1) / (db - da + 2.0 * d2);
+
+    lo = (a < b) ? a : b;
+    width = fabs(b - a);
+    if (!(t >= lo + 0.1 * width && t <= lo + 0.9 * width))
+        t = 0.5 * (a + b);
+
+    return t;
+}
+
+/* Discards the history after a step without progress, the next one goes along the gradient.
+* If this step already went along the gradient, the iterations stop as stalled */
+static void lbfgs_restart(p_LBFGS_MEMORY lb, size_t history) {
+    lb->count = 0;
+    lb->next = 0;
+    if (0 < history)
+        lb->stats.restarts++;
+    else
+        lb->stats.stalled = 1;
+}
+
+/* One iteration of LBFGS: the direction from the kept steps and the step along it which
+* satisfies the strong Wolfe conditions, found by expanding and then narrowing an interval */
+static int train_lbfgs(p_PRIVATE prvt) {
+    size_t j, k, evals, history, n = parameters_count(prvt);
+    double f0, d0, scale, a, fa, da, aPrev, fPrev, dPrev, lo = 0.0, fLo = 0.0, dLo = 0.0, hi = 0.0, fHi = 0.0, dHi = 0.0, last, sy;
+    int found = 0, zoom = 0;
+    double *s, *y;
+    p_LBFGS_MEMORY lb;
+
+    if (NULL == prvt->ws) {
+        prvt->ws = workspace_create(prvt, prvt->tileRows, 0);
+        if (NULL == prvt->ws) return 1;
+    }
+    if (NULL == prvt->lbfgs) {
+        prvt->lbfgs = lbfgs_create(n, prvt->history);
+        if (NULL == prvt->lbfgs) return 1;
+    }
+    lb = prvt->lbfgs;
+
+    /* The history belongs to the parameters and the training data of the last iteration */
+    CNNFW_GetParameters((N_NET)prvt, lb->xNew);
+    if (!lb->valid || lb->version != prvt->Data.version || 0 != memcmp(lb->xNew, lb->x, sizeof(double) * n)) {
+        memcpy(lb->x, lb->xNew, sizeof(double) * n);
+        memset(lb->d, 0, sizeof(double) * n);
+        lbfgs_evaluate(prvt, lb, 0.0, &lb->loss, &d0);
+        memcpy(lb->g, lb->gNew, sizeof(double) * n);
+        lb->count = 0;
+        lb->next = 0;
+        lb->valid = 1;
+        lb->version = prvt->Data.version;
+        lb->stats.converged = 0;
+        lb->stats.stalled = 0;
+    }
+    lb->stats.loss = lb->loss;
+    lb->stats.gradientNorm = sqrt(lbfgs_dot(lb->g, lb->g, n));
+    scale = (1.0 < fabs(lb->loss)) ? fabs(lb->loss) : 1.0;
+    if (lb->stats.gradientNorm <= LBFGS_TOLERANCE * scale)
+        lb->stats.converged = 1;
+    if (lb->stats.converged || lb->stats.stalled)
+        return 0;
+    lb->stats.iterations++;
+
+    lbfgs_direction(lb);
+    d0 = lbfgs_dot(lb->g, lb->d, n);
+    if (!(-d0 > LBFGS_ANGLE * lb->stats.gradientNorm * sqrt(lbfgs_dot(lb->d, lb->d, n))) && 0 < lb->count) {
+        lb->count = 0;
+        lb->stats.restarts++;
+        lbfgs_direction(lb);
+        d0 = lbfgs_dot(lb->g, lb->d, n);
+    }
+    /* The gradient is zero, the parameters are at a minimum */
+    if (!(d0 < 0.0)) {
+        lb->stats.converged = 1;
+        return 0;
+    }
+    history = lb->count;
+
+    /* Without the history the first step is at most 1 long */
+    f0 = lb->loss;
+    a = (0 == lb->count && 1.0 < -d0) ? 1.0 / sqrt(-d0) : 1.0;
+    aPrev = 0.0;
+    fPrev = f0;
+    dPrev = d0;
+    for (evals = 0; evals < LBFGS_EVALUATIONS; evals++) {
+        lbfgs_evaluate(prvt, lb, a, &fa, &da);
+        last = a;
+        if (fa > f0 + LBFGS_C1 * a * d0 || (0 < evals && fa >= fPrev)) {
+            lo = aPrev; fLo = fPrev; dLo = dPrev;
+            hi = a; fHi = fa; dHi = da;
+            zoom = 1;
+            break;
+        }
+        if (fabs(da) <= -LBFGS_C2 * d0) {
+            found = 1;
+            break;
+        }
+        if (da >= 0.0) {
+            lo = a; fLo = fa; dLo = da;
+            hi = aPrev; fHi = fPrev; dHi = dPrev;
+            zoom = 1;
+            break;
+        }
+        aPrev = a;
+        fPrev = fa;
+        dPrev = da;
+        a *= 2.0;
+    }
+
+    /* The interval between lo and hi has a step which satisfies the conditions, lo has the lowest loss */
+    for (evals++; zoom && !found && evals < LBFGS_EVALUATIONS; evals++) {
+        a = lbfgs_cubic(lo, fLo, dLo, hi, fHi, dHi);
+        lbfgs_evaluate(prvt, lb, a, &fa, &da);
+        last = a;
+        if (fa > f0 + LBFGS_C1 * a * d0 || fa >= fLo) {
+            hi = a; fHi = fa; dHi = da;
+        } else {
+            if (fabs(da) <= -LBFGS_C2 * d0) {
+                found = 1;
+                break;
+            }
+            if (da * (hi - lo) >= 0.0) {
+                hi = lo; fHi = fLo; dHi = dLo;
+            }
+            lo = a; fLo = fa; dLo = da;
+        }
+    }
+
+    /* Without such a step the lowest loss found is taken, if it is lower than before */
+    if (!found) {
+        a = zoom ? lo : aPrev;
+        fa = zoom ? fLo : fPrev;
+        if (0.0 == a) {
+            CNNFW_SetParameters((N_NET)prvt, lb->x);
+            lbfgs_restart(lb, history);
+            return 0;
+        }
+        if (last != a)
+            lbfgs_evaluate(prvt, lb, a, &fa, &da);
+    }
+
+    /* The step which has made no progress is kept, but not its direction */
+    if (f0 - fa <= LBFGS_PROGRESS * scale) {
+        memcpy(lb->x, lb->xNew, sizeof(double) * n);
+        memcpy(lb->g, lb->gNew, sizeof(double) * n);
+        lb->loss = fa;
+        lb->stats.loss = fa;
+        lb->stats.gradientNorm = sqrt(lbfgs_dot(lb->g, lb->g, n));
+        lbfgs_restart(lb, history);
+        return 0;
+    }
+
+    /* The step joins the history if the curvature along it is positive */
+    k = lb->next;
+    s = lb->s + k * n;
+    y = lb->y + k * n;
+    for (j = 0; j < n; j++) {
+        s[j] = lb->xNew[j] - lb->x[j];
+        y[j] = lb->gNew[j] - lb->g[j];
+    }
+    sy = lbfgs_dot(s, y, n);
+    if (sy > 1e-10 * lbfgs_dot(y, y, n)) {
+        lb->rho[k] = 1.0 / sy;
+        lb->next = (k + 1) % lb->history;
+        if (lb->count < lb->history) lb->count++;
+    }
+
+    memcpy(lb->x, lb->xNew, sizeof(double) * n);
+    memcpy(lb->g, lb->gNew, sizeof(double) * n);
+    lb->loss = fa;
+    lb->stats.loss = fa;
+    lb->stats.gradientNorm = sqrt(lbfgs_dot(lb->g, lb->g, n));
+
+    return 0;
+}
+
+int CNNFW_SetLBFGSHistory(N_NET NNetwork, size_t history) {
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+    if (1 > history) {
+        printf("LBFGS has to keep at least one step\n");
+        return 1;
+    }
+
+    free(prvt->lbfgs);
+    prvt->lbfgs = NULL;
+    prvt->history = history;
+
+    return 0;
+}
+
+int CNNFW_GetLBFGSStats(N_NET NNetwork, LBFGS_STATS *stats) {
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+    if (NULL == prvt || NULL == stats) {
+        printf("Neural network and the pointer to the statistics cannot be NULL\n");
+        return 1;
+    }
+
+    if (NULL == prvt->lbfgs)
+        memset(stats, 0, sizeof(LBFGS_STATS));
+    else
+        *stats = prvt->lbfgs->stats;
+
+    return 0;
+}
+
+/* Creates the values of all the layers for rows rows and the buffers for one row */
+static p_ACTIVATIONS activations_create(const PRIVATE *prvt, size_t rows) {
+    size_t lay, doubles = 0, maxCols = 0, dim = 1;
+    double *p;
+    const LAYER *layer;
+    p_ACTIVATIONS acts;
+
+    for (lay = 0; lay < prvt->layLen; lay++) {
+        layer = &prvt->Lays[lay];
+        doubles += (rows + 1) * layer->valLen;
+        if (layer->colLen > maxCols) maxCols = layer->colLen;
+        if (layer->valLen > dim) dim = layer->valLen;
+        if (layer->weiLen > dim) dim = layer->weiLen;
+    }
+    doubles += maxCols + gemm_pack_size(dim);
+
+    acts = (p_ACTIVATIONS)malloc(sizeof(ACTIVATIONS) + sizeof(double) * doubles + 2 * sizeof(double *) * prvt->layLen);
+    if (NULL == acts) {
+        printf("Unsuccessful memory allocation\n");
+        return NULL;
+    }
+
+    p = (double *)(acts + 1);
+    acts->rows = rows;
+    acts->values = (double **)(p + doubles);
+    acts->changed = acts->values + prvt->layLen;
+    for (lay = 0; lay < prvt->layLen; lay++) {
+        acts->values[lay] = p;
+        p += rows * prvt->Lays[lay].valLen;
+        acts->changed[lay] = p;
+        p += prvt->Lays[lay].valLen;
+    }
+    acts->cols = p;
+    acts->pack = p + maxCols;
+
+    return acts;
+}
+
+/* The input of the layer for the row: the row of the data or the kept values of the previous layer */
+static const double *activations_input(p_PRIVATE prvt, size_t lay, size_t row) {
+    if (0 == lay)
+        return prvt->Data.data + row * prvt->Data.cols;
+    return prvt->acts->values[lay - 1] + row * prvt->Lays[lay - 1].valLen;
+}
+
+/* Calculates one neuron of a dense layer exactly as layer_forward does */
+static double neuron_forward(p_PRIVATE prvt, size_t lay, size_t neu, const double *in) {
+    size_t wei;
+    double tmp = 0.0;
+    p_LAYER layer = &prvt->Lays[lay];
+    const double *weights = layer->neurons[neu].weights;
+    PROFILE_MARK mark;
+
+    if (NULL != prvt->prof) profile_begin(prvt->prof, &mark);
+    for (wei = 0; wei < layer->weiLen; wei++) {
+        tmp += in[wei] * weights[wei];
+    }
+    if (NULL != prvt->prof)
+        profile_end(prvt->prof, &mark, lay, PHASE_FORWARD, 2.0 * layer->weiLen, 2.0 * sizeof(double) * layer->weiLen);
+    layer_activate(prvt, lay, &tmp, 1, prvt->prof);
+
+    return tmp;
+}
+
+/* Updates the kept values of the layer after its parameters have changed. If neu is a neuron
+* of a dense layer, only it is calculated, otherwise the whole layer */
+static void activations_update(p_PRIVATE prvt, size_t lay, size_t neu) {
+    size_t row;
+    p_LAYER layer = &prvt->Lays[lay];
+    p_ACTIVATIONS acts = prvt->acts;
+
+    for (row = 0; row < acts->rows; row++) {
+        if (LAYER_DENSE == layer->type && neu < layer->neuLen)
+            acts->values[lay][row * layer->valLen + neu] = neuron_forward(prvt, lay, neu, activations_input(prvt, lay, row));
+        else
+            layer_forward(prvt, lay, activations_input(prvt, lay, row), acts->values[lay] + row * layer->valLen,
+                acts->cols, acts->pack, prvt->prof);
+    }
+}
+
+/* The loss over all the rows when the layer has been changed. The layers before it are taken
+* from the kept values, neu selects the recalculated part of the layer as in activations_update.
+* The sums are done in the same order as in difference, so the result is the same */
+static double activations_loss(p_PRIVATE prvt, size_t lay, size_t neu) {
+    size_t row, l, out;
+    double kept = 0.0, diff, result = 0.0;
+    const double *in, *target;
+    double *values;
+    p_LAYER layer = &prvt->Lays[lay];
+    p_ACTIVATIONS acts = prvt->acts;
+    PROFILE_MARK mark;
+
+    for (row = 0; row < acts->rows; row++) {
+        if (LAYER_DENSE == layer->type && neu < layer->neuLen) {
+            /* The other neurons of the layer are not changed, the kept row is used with one value replaced */
+            values = acts->values[lay] + row * layer->valLen;
+            kept = values[neu];
+            values[neu] = neuron_forward(prvt, lay, neu, activations_input(prvt, lay, row));
+        } else {
+            values = acts->changed[lay];
+            layer_forward(prvt, lay, activations_input(prvt, lay, row), values, acts->cols, acts->pack, prvt->prof);
+        }
+
+        in = values;
+        for (l = lay + 1; l < prvt->layLen; l++) {
+            layer_forward(prvt, l, in, acts->changed[l], acts->cols, acts->pack, prvt->prof);
+            in = acts->changed[l];
+        }
+
+        target = prvt->Data.data + row * prvt->Data.cols + prvt->Inps.inpLen;
+        if (NULL != prvt->prof) profile_begin(prvt->prof, &mark);
+        for (out = 0; out < prvt->Lays[prvt->layLen - 1].valLen; out++) {
+            diff = in[out] - target[out];
+            result += diff * diff;
+        }
+        if (NULL != prvt->prof)
+            profile_end(prvt->prof, &mark, prvt->layLen - 1, PHASE_LOSS, 3.0 * out, 2.0 * sizeof(double) * out);
+
+        if (LAYER_DENSE == layer->type && neu < layer->neuLen)
+            values[neu] = kept;
+    }
+
+    return result / acts->rows;
+}
+
+/* The derivative of the loss by the parameter of the layer, curDiff is the loss before the
+* changes of the epoch. The parameter is restored before returning */
+static double parameter_derivative(p_PRIVATE prvt, size_t lay, size_t neu, double *parameter, double curDiff) {
+    double tmp = *parameter;
+    double newDiff;
+
+    *parameter = tmp + prvt->eps;
+    newDiff = activations_loss(prvt, lay, neu);
+    if (CENTRAL_DIFFERENCE == prvt->method) {
+        *parameter = tmp - prvt->eps;
+        curDiff = activations_loss(prvt, lay, neu);
+        *parameter = tmp;
+        return (newDiff - curDiff) / (2.0 * prvt->eps);
+    }
+    *parameter = tmp;
+
+    return (newDiff - curDiff) / prvt->eps;
+}
+
+/* One epoch of the training with finite differences. Each parameter is updated right after
+* its derivative is known, the following derivatives are calculated with the updated ones */
+static int train_finite_difference(p_PRIVATE prvt) {
+    size_t neu, lay, wei, row, out, params, all;
+    double curDiff = 0.0;
+    double diff;
+    double *weights;
+    const double *values;
+    p_ACTIVATIONS acts;
+    PROFILE_MARK mark, nested = { 0 };
+
+    if (NULL != prvt->acts && prvt->acts->rows != prvt->Data.rows) {
+        free(prvt->acts);
+        prvt->acts = NULL;
+    }
+    if (NULL == prvt->acts) {
+        prvt->acts = activations_create(prvt, prvt->Data.rows);
+        if (NULL == prvt->acts) return 1;
+    }
+    acts = prvt->acts;
+
+    /* The values of all the layers and the loss before the changes, as difference calculates them */
+    for (lay = 0; lay < prvt->layLen; lay++)
+        activations_update(prvt, lay, prvt->Lays[lay].neuLen);
+    values = acts->values[prvt->layLen - 1];
+    for (row = 0; row < acts->rows; row++) {
+        if (NULL != prvt->prof) profile_begin(prvt->prof, &mark);
+        for (out = 0; out < prvt->Lays[prvt->layLen - 1].valLen; out++) {
+            diff = values[row * prvt->Lays[prvt->layLen - 1].valLen + out] - prvt->Data.data[row * prvt->Data.cols + prvt->Inps.inpLen + out];
+            curDiff += diff * diff;
+        }
+        if (NULL != prvt->prof)
+            profile_end(prvt->prof, &mark, prvt->layLen - 1, PHASE_LOSS, 3.0 * out, 2.0 * sizeof(double) * out);
+    }
+    curDiff /= acts->rows;
+
+    for (lay = 0; lay < prvt->layLen; lay++) {
+        if (NULL != prvt->prof) {
+            nested = prvt->prof->nested;
+            profile_begin(prvt->prof, &mark);
+        }
+        all = prvt->Lays[lay].neuLen;
+        params = 0;
+        /* The previous layer has changed, the kept values of this one are calculated again */
+        if (0 < lay)
+            activations_update(prvt, lay, all);
+        if (lay < prvt->layLen - 1 && layer_has_bias(&prvt->Lays[lay])) {
+            prvt->Lays[lay].bias -= prvt->step * parameter_derivative(prvt, lay, all, &prvt->Lays[lay].bias, curDiff);
+            activations_update(prvt, lay, all);
+            params++;
+        }
+        for (neu = 0; neu < prvt->Lays[lay].neuLen; neu++) {
+            weights = prvt->Lays[lay].neurons[neu].weights;
+            for (wei = 0; wei < prvt->Lays[lay].neurons[neu].weiLen; wei++)
+                weights[wei] -= prvt->step * parameter_derivative(prvt, lay, neu, &weights[wei], curDiff);
+            /* Every weight of a convolution changes all the positions of its filter */
+            if (LAYER_DENSE == prvt->Lays[lay].type)
+                activations_update(prvt, lay, neu);
+            params += prvt->Lays[lay].neurons[neu].weiLen;
+        }
+        if (LAYER_DENSE != prvt->Lays[lay].type && 0 < params)
+            activations_update(prvt, lay, all);
+        /* The forward passes and the loss are accounted separately, only the updates are left here */
+        if (NULL != prvt->prof)
+            profile_end_outer(prvt->prof, &mark, &nested, lay, PHASE_UPDATE, 5.0 * params, 3.0 * sizeof(double) * params);
+    }
+
+    prvt->isChanged = 1;
+
+    return 0;
+}
+
+#if defined(_WIN32)
+static unsigned __stdcall thread_entry(void *arg) {
+    THREAD *th = (THREAD *)arg;
+    th->func(th->arg);
+    return 0;
+}
+#endif
+
+static int thread_start(THREAD *th, void *(*func)(void *), void *arg) {
+    th->func = func;
+    th->arg = arg;
+#if defined(_WIN32)
+    th->handle = (HANDLE)_beginthreadex(NULL, 0, thread_entry, th, 0, NULL);
+    return 0 == th->handle;
+#else
+    return 0 != pthread_create(&th->handle, NULL, func, arg);
+#endif
+}
+
+static void thread_join(THREAD *th) {
+#if defined(_WIN32)
+    WaitForSingleObject(th->handle, INFINITE);
+    CloseHandle(th->handle);
+#else
+    pthread_join(th->handle, NULL);
+#endif
+}
+
+static void thread_yield(void) {
+#if defined(_WIN32)
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+/* Writes up to count processors the process may run on into cpu, returns their number */
+static size_t allowed_processors(int *cpu, size_t count) {
+    size_t found = 0;
+#if defined(__linux__)
+    int i;
+    cpu_set_t set;
+    if (0 != sched_getaffinity(0, sizeof(set), &set))
+        return 0;
+    for (i = 0; i < CPU_SETSIZE && found < count; i++)
+        if (CPU_ISSET(i, &set)) cpu[found++] = i;
+#elif defined(_WIN32)
+    int i;
+    DWORD_PTR process, system;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &process, &system))
+        return 0;
+    for (i = 0; i < (int)(sizeof(process) * 8) && found < count; i++)
+        if (process & ((DWORD_PTR)1 << i)) cpu[found++] = i;
+#else
+    (void)cpu;
+    (void)count;
+#endif
+    return found;
+}
+
+/* Pins the calling thread to the processor */
+static void thread_pin(int cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+#elif defined(_WIN32)
+    SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu);
+#else
+    (void)cpu;
+#endif
+}
+
+/* The number of rows a worker of the asynchronous training takes at once */
+#define ASYNC_CHUNK 16
+
+/* Stochastic gradient descent without locks (Hogwild). The gradient of each row is
+* calculated in the private workspace and subtracted from the common weights while
+* the other workers read and write them. The races are accepted: a lost update only
+* adds noise to the descent. Zero derivatives, e.g. of the weights of zero inputs,
+* are skipped, so the workers do not touch the same weights without need. With the sparse
+* data only the columns of the non-zero inputs of the first layer are visited */
+static void *async_worker(void *arg) {
+    ASYNC_WORKER *w = (ASYNC_WORKER *)arg;
+    p_PRIVATE prvt = w->prvt;
+    p_SPARSE sparse = prvt->sparseData;
+    size_t i, j, k, neu, lay, row, first, last, count = parameters_count(prvt), wCount = weights_count(prvt);
+    size_t skip = (NULL != sparse) ? prvt->Lays[0].neuLen * prvt->Lays[0].weiLen : 0;
+    double *weights = weights_begin(prvt), *grad, step = prvt->step;
+
+    /* The buffers are allocated after the pinning, so they are on the node of the thread */
+    if (0 <= w->cpu)
+        thread_pin(w->cpu);
+    w->ws = workspace_create(prvt, 1, 1);
+    if (NULL == w->ws) {
+        w->failed = 1;
+        return NULL;
+    }
+    grad = w->ws->grad;
+    memset(grad, 0, sizeof(double) * skip);
+
+    for (;;) {
+        first = (size_t)(ATOMIC_ADD(w->next, ASYNC_CHUNK) - ASYNC_CHUNK);
+        if (first >= w->total) break;
+        last = (first + ASYNC_CHUNK < w->total) ? first + ASYNC_CHUNK : w->total;
+
+        for (i = first; i < last; i++) {
+            memset(grad + skip, 0, sizeof(double) * (count - skip));
+            if (NULL == sparse) {
+                backward_rows(prvt, w->ws, prvt->Data.data + (i % prvt->Data.rows) * prvt->Data.cols, prvt->Data.cols,
+                    NULL, 0, 1, 1.0, grad, NULL, NULL);
+            } else {
+                row = i % sparse->rows;
+                backward_rows(prvt, w->ws, NULL, 0, sparse, row, 1, 1.0, grad, NULL, NULL);
+                /* The derivatives of the first layer are cleared as they are used */
+                for (k = sparse->offsets[row]; k < sparse->offsets[row + 1]; k++) {
+                    for (neu = 0; neu < prvt->Lays[0].neuLen; neu++) {
+                        j = neu * prvt->Lays[0].weiLen + sparse->indices[k];
+                        if (0.0 != grad[j]) weights[j] -= step * grad[j];
+                        grad[j] = 0.0;
+                    }
+                }
+            }
+
+            for (k = skip; k < wCount; k++)
+                if (0.0 != grad[k]) weights[k] -= step * grad[k];
+            for (lay = 0; lay + 1 < prvt->layLen; lay++)
+                if (layer_has_bias(&prvt->Lays[lay]))
+                    prvt->Lays[lay].bias -= step * grad[k++];
+        }
+    }
+
+    return NULL;
+}
+
+int CNNFW_TrainAsync(N_NET NNetwork, size_t threads, size_t epochs) {
+    size_t i, started, cpus = 0;
+    int result = 0;
+    int *cpu = NULL;
+    volatile long next = 0;
+    ASYNC_WORKER *workers = NULL;
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+#if defined(__linux__)
+    cpu_set_t affinity;
+#endif
+
+    if (NULL == prvt) {
+        printf("Neural Network is NULL\n");
+        return 1;
+    }
+    if (NULL == prvt->Data.data && NULL == prvt->sparseData) {
+        printf("Train data is NULL\n");
+        return 1;
+    }
+    if (0 == data_rows(prvt)) {
+        printf("Train data has no rows\n");
+        return 1;
+    }
+    if (1 > threads) {
+        printf("The number of threads cannot be less than 1\n");
+        return 1;
+    }
+
+    workers = (ASYNC_WORKER *)calloc(threads, sizeof(ASYNC_WORKER));
+    cpu = (int *)malloc(sizeof(int) * threads);
+    if (NULL == workers || NULL == cpu) {
+        printf("Unsuccessful memory allocation\n");
+        free(workers);
+        free(cpu);
+        return 1;
+    }
+    cpus = (ENABLE == prvt->pinning) ? allowed_processors(cpu, threads) : 0;
+#if defined(__linux__)
+    if (0 < cpus) sched_getaffinity(0, sizeof(affinity), &affinity);
+#endif
+    for (i = 0; i < threads; i++) {
+        workers[i].prvt = prvt;
+        workers[i].next = &next;
+        workers[i].total = data_rows(prvt) * epochs;
+        workers[i].cpu = (0 < cpus) ? cpu[i % cpus] : -1;
+    }
+
+    /* The calling thread is the first worker, if a thread cannot be started the rest do its part */
+    for (started = 1; started < threads; started++) {
+        if (thread_start(&workers[started].thread, async_worker, &workers[started])) {
+            printf("Unsuccessful thread creation, %lu threads are used\n", (unsigned long)started);
+            break;
+        }
+    }
+    async_worker(&workers[0]);
+    for (i = 1; i < started; i++)
+        thread_join(&workers[i].thread);
+    prvt->isChanged = 1;
+#if defined(__linux__)
+    if (0 < cpus) sched_setaffinity(0, sizeof(affinity), &affinity);
+#endif
+
+    for (i = 0; i < started; i++) {
+        if (workers[i].failed) result = 1;
+        free(workers[i].ws);
+    }
+    free(workers);
+    free(cpu);
+
+    return result;
+}
+
+int CNNFW_SetThreadPinning(N_NET NNetwork, FEATURE_STATE state) {
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+    if (ENABLE != state && DISABLE != state) {
+        printf("Unknown state of the thread pinning\n");
+        return 1;
+    }
+
+    prvt->pinning = state;
+
+    return 0;
+}
+
+int CNNFW_SetMemoryPolicy(N_NET *NNetwork, HUGE_PAGES pages, NUMA_POLICY numa, unsigned int node) {
+    size_t mapped, setMapped = 0;
+    p_PRIVATE prvtOld = (NULL != NNetwork) ? (p_PRIVATE)*NNetwork : NULL;
+    p_PRIVATE prvt = NULL;
+    p_SET set = NULL, setOld;
+
+    if (NULL == prvtOld) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+    if ((HUGE_PAGES_NONE != pages && HUGE_PAGES_TRANSPARENT != pages && HUGE_PAGES_EXPLICIT != pages) ||
+        (NUMA_FIRST_TOUCH != numa && NUMA_INTERLEAVE != numa && NUMA_BIND != numa)) {
+        printf("Unknown memory policy\n");
+        return 1;
+    }
+
+    /* The shared or borrowed training data stays where it is */
+    setOld = prvtOld->Data.set;
+    if (NULL != setOld && 1 == setOld->refs && prvtOld->Data.data == setOld->data) {
+        set = (p_SET)memory_alloc(sizeof(SET) + sizeof(double) * setOld->rows * setOld->cols, pages, numa, node, &setMapped);
+        if (NULL == set) return 1;
+    }
+    prvt = (p_PRIVATE)memory_alloc(prvtOld->structureSize, pages, numa, node, &mapped);
+    if (NULL == prvt) {
+        if (NULL != set) memory_free(set, setMapped);
+        return 1;
+    }
+
+    memcpy(prvt, prvtOld, prvtOld->structureSize);
+    if (NULL != set) {
+        memcpy(set, setOld, sizeof(SET) + sizeof(double) * setOld->rows * setOld->cols);
+        set->data = (double *)(set + 1);
+        set->mapped = setMapped;
+        prvt->Data.set = set;
+        prvt->Data.data = set->data;
+        memory_free(setOld, setOld->mapped);
+    }
+    prvt->mapped = mapped;
+    link_structure(prvt, NULL);
+
+    memory_free(prvtOld, prvtOld->mapped);
+    *NNetwork = (N_NET)prvt;
+
+    return 0;
+}
+
+static void monitor_init(MONITOR *mon) {
+#if defined(_WIN32)
+    InitializeCriticalSection(&mon->mutex);
+    InitializeConditionVariable(&mon->cond);
+#else
+    pthread_mutex_init(&mon->mutex, NULL);
+    pthread_cond_init(&mon->cond, NULL);
+#endif
+}
+
+static void monitor_destroy(MONITOR *mon) {
+#if defined(_WIN32)
+    DeleteCriticalSection(&mon->mutex);
+#else
+    pthread_cond_destroy(&mon->cond);
+    pthread_mutex_destroy(&mon->mutex);
+#endif
+}
+
+static void monitor_lock(MONITOR *mon) {
+#if defined(_WIN32)
+    EnterCriticalSection(&mon->mutex);
+#else
+    pthread_mutex_lock(&mon->mutex);
+#endif
+}
+
+static void monitor_unlock(MONITOR *mon) {
+#if defined(_WIN32)
+    LeaveCriticalSection(&mon->mutex);
+#else
+    pthread_mutex_unlock(&mon->mutex);
+#endif
+}
+
+/* Waits for a notification, the monitor must be locked */
+static void monitor_wait(MONITOR *mon) {
+#if defined(_WIN32)
+    SleepConditionVariableCS(&mon->cond, &mon->mutex, INFINITE);
+#else
+    pthread_cond_wait(&mon->cond, &mon->mutex);
+#endif
+}
+
+static void monitor_notify(MONITOR *mon) {
+#if defined(_WIN32)
+    WakeAllConditionVariable(&mon->cond);
+#else
+    pthread_cond_broadcast(&mon->cond);
+#endif
+}
+
+/* The thread of a pipeline: fills the free buffers until the end of the data, an error or the stop */
+static void *pipeline_producer(void *arg) {
+    p_PIPELINE_MEMORY pln = (p_PIPELINE_MEMORY)arg;
+    size_t slot;
+    DATA_ROWS rows;
+    double start;
+    int result;
+
+    for (;;) {
+        start = time_now();
+        monitor_lock(&pln->monitor);
+        while (pln->filled == pln->depth && !pln->stop)
+            monitor_wait(&pln->monitor);
+        pln->stats.stallTime += time_now() - start;
+        if (pln->stop) {
+            monitor_unlock(&pln->monitor);
+            break;
+        }
+        slot = (pln->first + pln->filled) % pln->depth;
+        monitor_unlock(&pln->monitor);
+
+        start = time_now();
+        rows = 0;
+        result = pln->producer(pln->context, pln->buffers + slot * pln->capacity * pln->cols, pln->capacity, &rows);
+
+        monitor_lock(&pln->monitor);
+        pln->stats.produceTime += time_now() - start;
+        if (0 != result || 0 == rows || rows > pln->capacity) {
+            pln->failed = (0 != result || rows > pln->capacity);
+            pln->finished = 1;
+            monitor_notify(&pln->monitor);
+            monitor_unlock(&pln->monitor);
+            break;
+        }
+        pln->rows[slot] = rows;
+        pln->filled++;
+        monitor_notify(&pln->monitor);
+        monitor_unlock(&pln->monitor);
+    }
+
+    return NULL;
+}
+
+int CNNFW_CreatePipeline(PIPELINE *Pipeline, N_NET NNetwork, DATA_ROWS capacity, size_t depth, PRODUCER producer, void *context) {
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+    p_PIPELINE_MEMORY pln;
+
+    if (NULL == Pipeline || NULL == prvt || NULL == producer) {
+        printf("The pipeline, the Neural Network and the producer cannot be NULL\n");
+        return 1;
+    }
+    if (NULL != *Pipeline) {
+        printf("The pipeline object is not NULL\n");
+        return 1;
+    }
+    if (0 == capacity || 0 == depth) {
+        printf("The pipeline must have at least one buffer of at least one row\n");
+        return 1;
+    }
+
+    pln = (p_PIPELINE_MEMORY)malloc(sizeof(PIPELINE_MEMORY) + sizeof(double) * depth * capacity * prvt->Data.cols + sizeof(DATA_ROWS) * depth);
+    if (NULL == pln) {
+        printf("Unsuccessful memory allocation\n");
+        return 1;
+    }
+    memset(pln, 0, sizeof(PIPELINE_MEMORY));
+    pln->producer = producer;
+    pln->context = context;
+    pln->depth = depth;
+    pln->capacity = capacity;
+    pln->cols = prvt->Data.cols;
+    pln->buffers = (double *)(pln + 1);
+    pln->rows = (DATA_ROWS *)(pln->buffers + depth * capacity * pln->cols);
+    monitor_init(&pln->monitor);
+
+    if (thread_start(&pln->thread, pipeline_producer, pln)) {
+        printf("Unsuccessful thread creation\n");
+        monitor_destroy(&pln->monitor);
+        free(pln);
+        return 1;
+    }
+
+    *Pipeline = (PIPELINE)pln;
+
+    return 0;
+}
+
+int CNNFW_TrainPipeline(N_NET NNetwork, PIPELINE Pipeline, size_t chunks, size_t epochs) {
+    size_t done, epoch, slot;
+    double start;
+    double *data;
+    DATA_ROWS rows;
+    int result = 0;
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+    p_PIPELINE_MEMORY pln = (p_PIPELINE_MEMORY)Pipeline;
+
+    if (NULL == prvt || NULL == pln) {
+        printf("The Neural Network and the pipeline cannot be NULL\n");
+        return 1;
+    }
+    if (prvt->Data.cols != pln->cols) {
+        printf("The rows of the pipeline do not fit the Neural Network\n");
+        return 1;
+    }
+    if (NULL != prvt->sparseData) {
+        printf("The pipeline cannot train a Neural Network with the sparse training data\n");
+        return 1;
+    }
+
+    data = prvt->Data.data;
+    rows = prvt->Data.rows;
+
+    for (done = 0; 0 == chunks || done < chunks; done++) {
+        start = time_now();
+        monitor_lock(&pln->monitor);
+        while (0 == pln->filled && !pln->finished)
+            monitor_wait(&pln->monitor);
+        pln->stats.waitTime += time_now() - start;
+        if (0 == pln->filled) {
+            if (pln->failed) {
+                printf("The producer of the pipeline failed\n");
+                result = 1;
+            }
+            monitor_unlock(&pln->monitor);
+            break;
+        }
+        slot = pln->first;
+        monitor_unlock(&pln->monitor);
+
+        start = time_now();
+        prvt->Data.data = pln->buffers + slot * pln->capacity * pln->cols;
+        prvt->Data.rows = pln->rows[slot];
+        prvt->Data.version++;
+        for (epoch = 0; epoch < epochs && 0 == result; epoch++)
+            result = CNNFW_Train(NNetwork);
+
+        monitor_lock(&pln->monitor);
+        pln->stats.trainTime += time_now() - start;
+        pln->stats.chunks++;
+        pln->stats.rows += (unsigned long)pln->rows[slot];
+        pln->first = (pln->first + 1) % pln->depth;
+        pln->filled--;
+        monitor_notify(&pln->monitor);
+        monitor_unlock(&pln->monitor);
+
+        if (0 != result) break;
+    }
+
+    prvt->Data.data = data;
+    prvt->Data.rows = rows;
+    prvt->Data.version++;
+
+    return result;
+}
+
+int CNNFW_GetPipelineStats(PIPELINE Pipeline, PIPELINE_STATS *stats) {
+    p_PIPELINE_MEMORY pln = (p_PIPELINE_MEMORY)Pipeline;
+
+    if (NULL == pln || NULL == stats) {
+        printf("The pipeline and the statistics cannot be NULL\n");
+        return 1;
+    }
+
+    monitor_lock(&pln->monitor);
+    *stats = pln->stats;
+    monitor_unlock(&pln->monitor);
+
+    return 0;
+}
+
+void CNNFW_FreePipeline(PIPELINE *Pipeline) {
+    p_PIPELINE_MEMORY pln;
+
+    if (NULL != Pipeline && NULL != *Pipeline) {
+        pln = (p_PIPELINE_MEMORY)*Pipeline;
+        monitor_lock(&pln->monitor);
+        pln->stop = 1;
+        monitor_notify(&pln->monitor);
+        monitor_unlock(&pln->monitor);
+        thread_join(&pln->thread);
+        monitor_destroy(&pln->monitor);
+        free(pln);
+        *Pipeline = NULL;
+    }
+}
+
+static void model_version_free(p_MODEL_VERSION ver, size_t readers) {
+    size_t i;
+
+    if (NULL == ver) return;
+    if (NULL != ver->ws) {
+        for (i = 0; i < readers; i++)
+            free(ver->ws[i]);
+        free(ver->ws);
+    }
+    CNNFW_Free(&ver->net);
+    free(ver);
+}
+
+/* Makes a version of the Neural Network with the workspaces of all the readers, so the
+* readers never allocate memory. The version takes the Neural Network */
+static p_MODEL_VERSION model_version_create(N_NET *NNetwork, size_t readers) {
+    size_t i;
+    p_MODEL_VERSION ver = (p_MODEL_VERSION)malloc(sizeof(MODEL_VERSION));
+    if (NULL == ver) {
+        printf("Unsuccessful memory allocation\n");
+        return NULL;
+    }
+
+    ver->net = NULL;
+    ver->ws = (p_WORKSPACE *)calloc(readers, sizeof(p_WORKSPACE));
+    if (NULL == ver->ws) {
+        printf("Unsuccessful memory allocation\n");
+        free(ver);
+        return NULL;
+    }
+    for (i = 0; i < readers; i++) {
+        ver->ws[i] = workspace_create((p_PRIVATE)*NNetwork, ((p_PRIVATE)*NNetwork)->tileRows, 0);
+        if (NULL == ver->ws[i]) {
+            model_version_free(ver, readers);
+            return NULL;
+        }
+    }
+    ver->net = *NNetwork;
+    *NNetwork = NULL;
+
+    return ver;
+}
+
+int CNNFW_CreateModel(MODEL *Model, N_NET *NNetwork, size_t readers) {
+    p_MODEL_MEMORY mdl;
+
+    if (NULL == Model || NULL == NNetwork || NULL == *NNetwork) {
+        printf("The model object and the Neural Network cannot be NULL\n");
+        return 1;
+    }
+    if (NULL != *Model) {
+        printf("The model object is not NULL\n");
+        return 1;
+    }
+    if (1 > readers) {
+        printf("The number of readers cannot be less than 1\n");
+        return 1;
+    }
+
+    mdl = (p_MODEL_MEMORY)malloc(sizeof(MODEL_MEMORY));
+    if (NULL == mdl) {
+        printf("Unsuccessful memory allocation\n");
+        return 1;
+    }
+    mdl->slots = (MODEL_READER *)calloc(readers, sizeof(MODEL_READER));
+    CNNFW_GetInputsAndOutputsCount(*NNetwork, &mdl->inputs, &mdl->outputs);
+    mdl->current = (NULL != mdl->slots) ? model_version_create(NNetwork, readers) : NULL;
+    if (NULL == mdl->current) {
+        if (NULL == mdl->slots) printf("Unsuccessful memory allocation\n");
+        free(mdl->slots);
+        free(mdl);
+        return 1;
+    }
+    mdl->readers = readers;
+    mdl->epoch = 1;
+    monitor_init(&mdl->monitor);
 
-    *NNetwork = (N_NET)prvt;
+    *Model = (MODEL)mdl;
 
     return 0;
 }
 
-double ActivationFunction(double x) {
-    return 1.0 / (1.0 + exp(-x));
-}
+int CNNFW_ModelCalculate(MODEL Model, size_t reader, const double *inputs, size_t count, double *outputs) {
+    p_MODEL_MEMORY mdl = (p_MODEL_MEMORY)Model;
+    p_MODEL_VERSION ver;
+    MODEL_READER *slot;
 
-double difference(N_NET NNetwork) {
-    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
-    size_t i, j, out;
-    double result = 0.0;
-    double diff = 0.0;
-    for (i = 0; i < prvt->Data.rows; i++) {
-        for (j = 0; j < prvt->Inps.inpLen; j++) {
-            prvt->Inps.inputs[j] = prvt->Data.data[i][j];
-        }
+    if (NULL == mdl || NULL == inputs || NULL == outputs) {
+        printf("The model object and the pointers to the inputs and outputs cannot be NULL\n");
+        return 1;
+    }
+    if (reader >= mdl->readers) {
+        printf("The reader is out of range\n");
+        return 1;
+    }
 
-        CNNFW_Calculate(NNetwork);
+    /* The epoch is announced before the version is taken, a writer which has published
+    * a newer version either sees the announcement or this reader sees the newer version */
+    slot = &mdl->slots[reader];
+    ATOMIC_STORE(&slot->epoch, ATOMIC_LOAD(&mdl->epoch));
+    ver = ATOMIC_LOAD(&mdl->current);
 
-        for (out = 0; out < prvt->Lays[prvt->layLen - 1].neuLen; out++) {
-            diff = prvt->Lays[prvt->layLen - 1].neurons[out].value - prvt->Data.data[i][prvt->Inps.inpLen + out];
-            result += diff * diff;
-        }
-    }
+    calculate_rows((p_PRIVATE)ver->net, ver->ws[reader], inputs, count, outputs, NULL);
 
-    return result / prvt->Data.rows;
+    ATOMIC_STORE(&slot->epoch, 0);
+
+    return 0;
 }
 
-int CNNFW_Train(N_NET NNetwork) {
-    size_t neu, lay, wei;
-    double curDiff = 0.0;
-    double newDiff = 0.0;
-    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+int CNNFW_SwapModel(MODEL Model, N_NET *NNetwork) {
+    size_t i, inputs, outputs;
+    long epoch;
+    p_MODEL_MEMORY mdl = (p_MODEL_MEMORY)Model;
+    p_MODEL_VERSION ver, old;
 
-    if (NULL == prvt) {
-        printf("Neural Network is NULL\n");
+    if (NULL == mdl || NULL == NNetwork || NULL == *NNetwork) {
+        printf("The model object and the Neural Network cannot be NULL\n");
         return 1;
     }
-
-    if (NULL == prvt->Data.data) {
-        printf("Train data is NULL\n");
+    CNNFW_GetInputsAndOutputsCount(*NNetwork, &inputs, &outputs);
+    if (inputs != mdl->inputs || outputs != mdl->outputs) {
+        printf("The new Neural Network has other numbers of inputs and outputs\n");
         return 1;
     }
 
-    curDiff = difference(NNetwork);
+    ver = model_version_create(NNetwork, mdl->readers);
+    if (NULL == ver)
+        return 1;
+
+    monitor_lock(&mdl->monitor);
+    old = mdl->current;
+    ATOMIC_STORE(&mdl->current, ver);
+    epoch = ATOMIC_ADD(&mdl->epoch, 1);
 
-    for (lay = 0; lay < prvt->layLen; lay++) {
-        if (lay < prvt->layLen - 1) {
-            double tmp = prvt->Lays[lay].bias;
-            prvt->Lays[lay].bias += prvt->eps;
-            newDiff = difference(NNetwork);
-            prvt->Lays[lay].bias = tmp;
-            prvt->Lays[lay].bias -= prvt->step * ((newDiff - curDiff) / prvt->eps);
-        }
-        for (neu = 0; neu < prvt->Lays[lay].neuLen; neu++) {
-            for (wei = 0; wei < prvt->Lays[lay].neurons[neu].weiLen; wei++) {
-                double tmp = prvt->Lays[lay].neurons[neu].weights[wei];
-                prvt->Lays[lay].neurons[neu].weights[wei] += prvt->eps;
-                newDiff = difference(NNetwork);
-                prvt->Lays[lay].neurons[neu].weights[wei] = tmp;
-                prvt->Lays[lay].neurons[neu].weights[wei] -= prvt->step * ((newDiff - curDiff) / prvt->eps);
-            }
-        }
+    /* The readers which have announced an older epoch may still hold the old version */
+    for (i = 0; i < mdl->readers; i++) {
+        while (0 != ATOMIC_LOAD(&mdl->slots[i].epoch) && ATOMIC_LOAD(&mdl->slots[i].epoch) < epoch)
+            thread_yield();
     }
+    monitor_unlock(&mdl->monitor);
 
-    prvt->isChanged = 1;
+    model_version_free(old, mdl->readers);
 
     return 0;
 }
 
-int CNNFW_Calculate(N_NET NNetwork) {
-    size_t lay, neu, wei;
-    double tmp;
-    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
-    if (NULL == prvt) {
-        printf("Neural network is NULL\n");
+int CNNFW_ReloadModel(MODEL Model, const char *fileName) {
+    N_NET NNetwork = NULL;
+
+    if (NULL == Model) {
+        printf("The model object is NULL\n");
         return 1;
     }
-
-    for (lay = 0; lay < prvt->layLen; lay++) {
-        for (neu = 0; neu < prvt->Lays[lay].neuLen; neu++) {
-            tmp = 0.0;
-            prvt->Lays[lay].neurons[neu].value = 0.0;
-            for (wei = 0; wei < prvt->Lays[lay].neurons[neu].weiLen; wei++) {
-                if (lay == 0) {
-                    tmp += prvt->Inps.inputs[wei] * prvt->Lays[lay].neurons[neu].weights[wei];
-                } else {
-                    tmp += prvt->Lays[lay - 1].neurons[wei].value * prvt->Lays[lay].neurons[neu].weights[wei];
-                }
-            }
-
-            if (lay == prvt->layLen - 1) {
-                prvt->Lays[prvt->layLen - 1].neurons[neu].value = tmp;
-            } else {
-                if (prvt->actFunc == ENABLE) {
-                    prvt->Lays[lay].neurons[neu].value = ActivationFunction(tmp + prvt->Lays[lay].bias);
-                } else if (prvt->actFunc == DISABLE) {
-                    prvt->Lays[lay].neurons[neu].value = tmp + prvt->Lays[lay].bias;
-                }
-            }
-        }
+    if (CNNFW_LoadFromFile(&NNetwork, fileName))
+        return 1;
+    if (CNNFW_SwapModel(Model, &NNetwork)) {
+        CNNFW_Free(&NNetwork);
+        return 1;
     }
 
     return 0;
 }
 
+void CNNFW_FreeModel(MODEL *Model) {
+    p_MODEL_MEMORY mdl;
+
+    if (NULL != Model && NULL != *Model) {
+        mdl = (p_MODEL_MEMORY)*Model;
+        model_version_free(mdl->current, mdl->readers);
+        monitor_destroy(&mdl->monitor);
+        free(mdl->slots);
+        free(mdl);
+        *Model = NULL;
+    }
+}
+
 int CNNFW_SetActivationFunction(N_NET NNetwork, ACTIVATION_FUNCTION state) {
     p_PRIVATE prvt = (p_PRIVATE)NNetwork;
     if (NULL == prvt) {
@@ -317,8 +3841,9 @@ void CNNFW_PrintOutputs(N_NET NNetwork) {
     } else {
         printf("\n----------------------------------------------------------------------------------------------------\n");
         printf("Outputs:\n");
-        for (neu = 0; neu < prvt->Lays[prvt->layLen - 1].neuLen; neu++)
-            printf("  output %lu, value %0.3f\n", (unsigned long)neu, prvt->Lays[prvt->layLen - 1].neurons[neu].value);
+        lazy_finish(prvt);
+        for (neu = 0; neu < prvt->Lays[prvt->layLen - 1].valLen; neu++)
+            printf("  output %lu, value %0.3f\n", (unsigned long)neu, prvt->Lays[prvt->layLen - 1].values[neu]);
         printf("----------------------------------------------------------------------------------------------------\n\n");
     }
 }
@@ -331,6 +3856,7 @@ void CNNFW_Print(N_NET NNetwork) {
     } else {
         printf("----------------------------------------------------------------------------------------------------\n\n");
 
+        lazy_finish(prvt);
         printf("Inputs %lu:\n", (unsigned long)prvt->Inps.inpLen);
         for (inp = 0; inp < prvt->Inps.inpLen; inp++) {
             printf("    value: %0.3f\n", prvt->Inps.inputs[inp]);
@@ -343,14 +3869,33 @@ void CNNFW_Print(N_NET NNetwork) {
             else
                 printf("layer %lu:\n", (unsigned long)lay);
 
-            for (neu = 0; neu < prvt->Lays[lay].neuLen; neu++) {
-                printf("    neuron %lu, value %0.3f:\n", (unsigned long)neu, prvt->Lays[lay].neurons[neu].value);
-                for (wei = 0; wei < prvt->Lays[lay].neurons[neu].weiLen; wei++) {
-                    printf("        weight %lu: %0.3f\n", (unsigned long)wei, prvt->Lays[lay].neurons[neu].weights[wei]);
+            if (LAYER_DENSE == prvt->Lays[lay].type) {
+                for (neu = 0; neu < prvt->Lays[lay].neuLen; neu++) {
+                    printf("    neuron %lu, value %0.3f:\n", (unsigned long)neu, prvt->Lays[lay].values[neu]);
+                    for (wei = 0; wei < prvt->Lays[lay].neurons[neu].weiLen; wei++) {
+                        printf("        weight %lu: %0.3f\n", (unsigned long)wei, prvt->Lays[lay].neurons[neu].weights[wei]);
+                    }
+                }
+            } else {
+                printf("    %s, %lux%lux%lu -> %lux%lux%lu:\n",
+                    (LAYER_CONV == prvt->Lays[lay].type) ? "convolution" : (LAYER_MAX_POOL == prvt->Lays[lay].type) ? "max pooling" : "average pooling",
+                    (unsigned long)prvt->Lays[lay].geo.inChannels, (unsigned long)prvt->Lays[lay].geo.inHeight, (unsigned long)prvt->Lays[lay].geo.inWidth,
+                    (unsigned long)prvt->Lays[lay].geo.outChannels, (unsigned long)prvt->Lays[lay].geo.outHeight, (unsigned long)prvt->Lays[lay].geo.outWidth);
+                for (neu = 0; neu < prvt->Lays[lay].neuLen; neu++) {
+                    printf("    filter %lu:\n", (unsigned long)neu);
+                    for (wei = 0; wei < prvt->Lays[lay].neurons[neu].weiLen; wei++) {
+                        printf("        weight %lu: %0.3f\n", (unsigned long)wei, prvt->Lays[lay].neurons[neu].weights[wei]);
+                    }
+                }
+                for (neu = 0; neu < prvt->Lays[lay].valLen; neu++) {
+                    printf("    value %lu: %0.3f\n", (unsigned long)neu, prvt->Lays[lay].values[neu]);
                 }
             }
 
-            printf("    bias: %0.3f\n\n", prvt->Lays[lay].bias);
+            if (layer_has_bias(&prvt->Lays[lay]))
+                printf("    bias: %0.3f\n\n", prvt->Lays[lay].bias);
+            else
+                printf("\n");
         }
 
         printf("----------------------------------------------------------------------------------------------------\n\n");
@@ -376,6 +3921,8 @@ int set_inputs(N_NET NNetwork, double *newInputs, size_t newInpLen) {
     for (i = 0; i < newInpLen; i++) {
         prvt->Inps.inputs[i] = newInputs[i];
     }
+    if (NULL != prvt->sparseInps)
+        prvt->sparseInps->rows = 0;
 
     return 0;
 }
@@ -393,6 +3940,51 @@ int CNNFW_SetInput(N_NET NNetwork, size_t index, double value) {
     }
 
     prvt->Inps.inputs[index] = value;
+    if (NULL != prvt->sparseInps)
+        prvt->sparseInps->rows = 0;
+
+    return 0;
+}
+
+int CNNFW_SetSparseInputs(N_NET NNetwork, const size_t *indices, const double *values, size_t count) {
+    size_t i, offsets[2];
+    p_SPARSE sparse;
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+    if (0 < count && (NULL == indices || NULL == values)) {
+        printf("The pointers to the indices and the values cannot be NULL\n");
+        return 1;
+    }
+    offsets[0] = 0;
+    offsets[1] = count;
+    if (sparse_check(prvt, 1, offsets, indices))
+        return 1;
+
+    /* Only the inputs of the previous sparse call have to be cleared */
+    sparse = prvt->sparseInps;
+    if (NULL != sparse && 0 < sparse->rows) {
+        for (i = 0; i < sparse->offsets[1]; i++)
+            prvt->Inps.inputs[sparse->indices[i]] = 0.0;
+    } else {
+        memset(prvt->Inps.inputs, 0, sizeof(double) * prvt->Inps.inpLen);
+    }
+
+    if (NULL == sparse || sparse->length < count) {
+        sparse_release(sparse);
+        prvt->sparseInps = sparse = sparse_create(1, count, 0);
+        if (NULL == sparse) return 1;
+    }
+
+    sparse->rows = 1;
+    sparse->offsets[1] = count;
+    for (i = 0; i < count; i++) {
+        sparse->indices[i] = indices[i];
+        sparse->values[i] = values[i];
+        prvt->Inps.inputs[indices[i]] += values[i];
+    }
 
     return 0;
 }
@@ -404,12 +3996,46 @@ int CNNFW_GetOutput(N_NET NNetwork, size_t index, double *retValue) {
         return 1;
     }
 
-    if (index >= prvt->Lays[prvt->layLen - 1].neuLen) {
+    if (index >= prvt->Lays[prvt->layLen - 1].valLen) {
         printf("Index is out of range\n");
         return 1;
     }
 
-    *retValue = prvt->Lays[prvt->layLen - 1].neurons[index].value;
+    lazy_output(prvt, index);
+    *retValue = prvt->Lays[prvt->layLen - 1].values[index];
+
+    return 0;
+}
+
+int CNNFW_GetInputsAndOutputsCount(N_NET NNetwork, size_t *inputs, size_t *outputs) {
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+    if (NULL == inputs || NULL == outputs) {
+        printf("The pointers to store the numbers of inputs and outputs cannot be NULL\n");
+        return 1;
+    }
+
+    *inputs = prvt->Inps.inpLen;
+    *outputs = prvt->Lays[prvt->layLen - 1].valLen;
+
+    return 0;
+}
+
+int CNNFW_GetParametersCount(N_NET NNetwork, size_t *count) {
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+    if (NULL == count) {
+        printf("The pointer to store the number of parameters cannot be NULL\n");
+        return 1;
+    }
+
+    *count = parameters_count(prvt);
 
     return 0;
 }
@@ -481,89 +4107,312 @@ int CNNFW_WeightsCrossingower(N_NET NNdst, N_NET NNsrc) {
             }
         }
     }
-    prvtDst->isChanged = 1;
+    prvtDst->isChanged = 1;
+
+    return 0;
+}
+
+int CNNFW_SetEpsilonAndLearningStep(N_NET NNetwork, EPSILON eps, LEARNING_STEP step) {
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+    if (0 >= eps) {
+        printf("The epsilon cannot be equal to or less than zero\n");
+        return 1;
+    }
+    if (0 >= step) {
+        printf("The learning step cannot be equal to or less than zero\n");
+        return 1;
+    }
+
+    prvt->eps = eps;
+    prvt->step = step;
+
+    return 0;
+}
+
+int CNNFW_SetValueInData(N_NET NNetwork, DATA_ROWS rowIndex, DATA_COLS colIndex, double value) {
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+    if (NULL == prvt->Data.data) {
+        printf("Training data is NULL\n");
+        return 1;
+    }
+    if (prvt->Data.rows <= rowIndex) {
+        printf("Row index out of range\n");
+        return 1;
+    }
+    if (prvt->Data.cols <= colIndex) {
+        printf("Column index out of range\n");
+        return 1;
+    }
+    if (!data_is_writable(prvt))
+        return 1;
+
+    prvt->Data.data[rowIndex * prvt->Data.cols + colIndex] = value;
+    prvt->Data.version++;
+
+    return 0;
+}
+
+int CNNFW_GetValueFromData(N_NET NNetwork, DATA_ROWS rowIndex, DATA_COLS colIndex, double *retValue) {
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+    if (NULL == prvt->Data.data) {
+        printf("Training data is NULL\n");
+        return 1;
+    }
+    if (NULL == retValue) {
+        printf("The pointer to the variable where the value should be stored is NULL\n");
+        return 1;
+    }
+    if (prvt->Data.rows <= rowIndex) {
+        printf("Row index out of range\n");
+        return 1;
+    }
+    if (prvt->Data.cols <= colIndex) {
+        printf("Column index out of range\n");
+        return 1;
+    }
+
+    *retValue = prvt->Data.data[rowIndex * prvt->Data.cols + colIndex];
+
+    return 0;
+}
+
+int CNNFW_SetDataRows(N_NET NNetwork, DATA_ROWS firstRow, DATA_ROWS rowsCount, const double *buffer) {
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+    if (NULL == prvt->Data.data) {
+        printf("Training data is NULL\n");
+        return 1;
+    }
+    if (NULL == buffer) {
+        printf("The pointer to the buffer with rows is NULL\n");
+        return 1;
+    }
+    if (prvt->Data.rows < firstRow || prvt->Data.rows - firstRow < rowsCount) {
+        printf("Row range out of range\n");
+        return 1;
+    }
+    if (!data_is_writable(prvt))
+        return 1;
+
+    memcpy(prvt->Data.data + firstRow * prvt->Data.cols, buffer, sizeof(double) * rowsCount * prvt->Data.cols);
+    prvt->Data.version++;
+
+    return 0;
+}
+
+int CNNFW_BorrowData(N_NET NNetwork, double *buffer, DATA_ROWS rows) {
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+    if (NULL == buffer) {
+        printf("The pointer to the borrowed buffer is NULL\n");
+        return 1;
+    }
+    if (1 > rows) {
+        printf("The training data must contain at least one row\n");
+        return 1;
+    }
+
+    prvt->Data.data = buffer;
+    prvt->Data.rows = rows;
+    prvt->Data.version++;
+
+    return 0;
+}
+
+int CNNFW_ReleaseData(N_NET NNetwork) {
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+
+    prvt->Data.data = (NULL != prvt->Data.set) ? prvt->Data.set->data : NULL;
+    prvt->Data.rows = (NULL != prvt->Data.set) ? prvt->Data.set->rows : 0;
+    if (NULL != prvt->online)
+        prvt->Data.rows = prvt->online->filled + prvt->online->sampled;
+    prvt->Data.version++;
+
+    return 0;
+}
+
+int CNNFW_SetSparseData(N_NET NNetwork, DATA_ROWS rows, const size_t *offsets, const size_t *indices,
+    const double *values, const double *targets) {
+    size_t i, outLen;
+    p_SPARSE sparse = NULL;
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+
+    if (0 < rows) {
+        if (NULL == offsets || NULL == targets || ((NULL == indices || NULL == values) && offsets[rows] > offsets[0])) {
+            printf("The pointers to the sparse rows cannot be NULL\n");
+            return 1;
+        }
+        if (sparse_check(prvt, rows, offsets, indices))
+            return 1;
+
+        outLen = prvt->Lays[prvt->layLen - 1].valLen;
+        sparse = sparse_create(rows, offsets[rows] - offsets[0], outLen);
+        if (NULL == sparse)
+            return 1;
+        for (i = 0; i <= rows; i++)
+            sparse->offsets[i] = offsets[i] - offsets[0];
+        if (0 < sparse->length) {
+            memcpy(sparse->indices, indices + offsets[0], sizeof(size_t) * sparse->length);
+            memcpy(sparse->values, values + offsets[0], sizeof(double) * sparse->length);
+        }
+        memcpy(sparse->targets, targets, sizeof(double) * rows * outLen);
+    }
+
+    sparse_release(prvt->sparseData);
+    prvt->sparseData = sparse;
+    prvt->Data.version++;
 
     return 0;
 }
 
-int CNNFW_SetEpsilonAndLearningStep(N_NET NNetwork, EPSILON eps, LEARNING_STEP step) {
+int CNNFW_SetOnline(N_NET NNetwork, DATA_ROWS recent, DATA_ROWS reservoir) {
+    p_SET set;
+    p_ONLINE online;
     p_PRIVATE prvt = (p_PRIVATE)NNetwork;
-
     if (NULL == prvt) {
         printf("Neural network is NULL\n");
         return 1;
     }
-    if (0 >= eps) {
-        printf("The epsilon cannot be equal to or less than zero\n");
+    if (1 > recent) {
+        printf("The ring of the recent rows must contain at least one row\n");
         return 1;
     }
-    if (0 >= step) {
-        printf("The learning step cannot be equal to or less than zero\n");
+
+    online = (p_ONLINE)malloc(sizeof(ONLINE));
+    if (NULL == online) {
+        printf("Unsuccessful memory allocation\n");
+        return 1;
+    }
+    set = set_create(recent + reservoir, prvt->Data.cols);
+    if (NULL == set) {
+        free(online);
         return 1;
     }
 
-    prvt->eps = eps;
-    prvt->step = step;
+    /* The Neural Network keeps the only reference to the rows */
+    data_attach(prvt, set);
+    set_release(set);
+    online->recent = recent;
+    online->reservoir = reservoir;
+    online->next = 0;
+    online->filled = 0;
+    online->sampled = 0;
+    online->evicted = 0;
+    prvt->online = online;
+    prvt->Data.rows = 0;
 
     return 0;
 }
 
-int CNNFW_SetValueInData(N_NET NNetwork, DATA_ROWS rowIndex, DATA_COLS colIndex, double value) {
+int CNNFW_PushRows(N_NET NNetwork, const double *rows, DATA_ROWS count) {
+    size_t i, slot, cols;
+    unsigned long j;
+    double *data;
+    p_ONLINE online;
     p_PRIVATE prvt = (p_PRIVATE)NNetwork;
-
     if (NULL == prvt) {
         printf("Neural network is NULL\n");
         return 1;
     }
-    if (NULL == prvt->Data.data) {
-        printf("Training data is NULL\n");
-        return 1;
-    }
-    if (prvt->Data.rows <= rowIndex) {
-        printf("Row index out of range\n");
+    if (NULL == rows) {
+        printf("The pointer to the rows cannot be NULL\n");
         return 1;
     }
-    if (prvt->Data.cols <= colIndex) {
-        printf("Column index out of range\n");
+    if (!online_is_active(prvt) || online_unshare(prvt))
         return 1;
-    }
 
-    prvt->Data.data[rowIndex][colIndex] = value;
+    online = prvt->online;
+    cols = prvt->Data.cols;
+    data = prvt->Data.data;
+    for (i = 0; i < count; i++) {
+        slot = online->next;
+        if (online->filled == online->recent) {
+            /* The oldest row leaves the ring, the reservoir keeps it with the probability reservoir / evicted */
+            online->evicted++;
+            if (online->sampled < online->reservoir)
+                j = (unsigned long)online->sampled++;
+            else
+                j = ((unsigned long)rand() * ((unsigned long)RAND_MAX + 1) + (unsigned long)rand()) % online->evicted;
+            if (j < online->reservoir)
+                memcpy(data + (online->recent + j) * cols, data + slot * cols, sizeof(double) * cols);
+        } else {
+            online->filled++;
+        }
+        memcpy(data + slot * cols, rows + i * cols, sizeof(double) * cols);
+        online->next = (slot + 1) % online->recent;
+    }
+    prvt->Data.rows = online->filled + online->sampled;
+    prvt->Data.version++;
 
     return 0;
 }
 
-int CNNFW_GetValueFromData(N_NET NNetwork, DATA_ROWS rowIndex, DATA_COLS colIndex, double *retValue) {
+int CNNFW_GetOutputs(N_NET NNetwork, const double **outputs, size_t *count) {
     p_PRIVATE prvt = (p_PRIVATE)NNetwork;
 
     if (NULL == prvt) {
         printf("Neural network is NULL\n");
         return 1;
     }
-    if (NULL == prvt->Data.data) {
-        printf("Training data is NULL\n");
-        return 1;
-    }
-    if (NULL == retValue) {
-        printf("The pointer to the variable where the value should be stored is NULL\n");
-        return 1;
-    }
-    if (prvt->Data.rows <= rowIndex) {
-        printf("Row index out of range\n");
-        return 1;
-    }
-    if (prvt->Data.cols <= colIndex) {
-        printf("Column index out of range\n");
+    if (NULL == outputs || NULL == count) {
+        printf("The pointers to store the outputs and their number cannot be NULL\n");
         return 1;
     }
 
-    *retValue = prvt->Data.data[rowIndex][colIndex];
+    lazy_finish(prvt);
+    *outputs = prvt->Lays[prvt->layLen - 1].values;
+    *count = prvt->Lays[prvt->layLen - 1].valLen;
 
     return 0;
 }
 
+/* A saved file begins with the magic number, the version of the format and the size of
+* PRIVATE, so files of another format or of a differently compiled library are rejected.
+* The version changes with every change of PRIVATE or of the order of the saved data */
+#define FILE_MAGIC "cNNFW"
+#define FILE_VERSION 2UL
+
+typedef struct {
+    char magic[8];
+    unsigned long version;
+    unsigned long structure;
+} FILE_HEADER;
+
 int CNNFW_SaveToFile(N_NET NNetwork, const char *fileName) {
     FILE *fp = NULL;
+    FILE_HEADER header = { FILE_MAGIC, FILE_VERSION, sizeof(PRIVATE) };
     p_PRIVATE prvt = (p_PRIVATE)NNetwork;
     if (NULL == prvt) {
         printf("Neural Network is NULL\n");
@@ -579,7 +4428,13 @@ int CNNFW_SaveToFile(N_NET NNetwork, const char *fileName) {
             return 1;
         }
 
-        if (fwrite(prvt, prvt->structureSize, 1, fp) != 1) {
+        if (fwrite(&header, sizeof(FILE_HEADER), 1, fp) != 1 || fwrite(prvt, prvt->structureSize, 1, fp) != 1) {
+            printf("Unsuccessful file writting\n");
+            fclose(fp);
+            return 1;
+        }
+
+        if (0 < prvt->Data.rows && fwrite(prvt->Data.data, sizeof(double) * prvt->Data.cols, prvt->Data.rows, fp) != prvt->Data.rows) {
             printf("Unsuccessful file writting\n");
             fclose(fp);
             return 1;
@@ -594,8 +4449,9 @@ int CNNFW_SaveToFile(N_NET NNetwork, const char *fileName) {
 }
 
 int CNNFW_LoadFromFile(N_NET *NNetwork, const char *fileName) {
-    size_t lay, neu, i;
+    size_t lay;
     FILE *fp = NULL;
+    FILE_HEADER header;
     PRIVATE Prvt = { 0 };
     p_PRIVATE prvt = NULL;
 
@@ -605,13 +4461,22 @@ int CNNFW_LoadFromFile(N_NET *NNetwork, const char *fileName) {
         return 1;
     }
 
-    if (fread(&Prvt, sizeof(PRIVATE), 1, fp) != 1) {
-        printf("Unsuccessful file reading (1)\n");
+    if (fread(&header, sizeof(FILE_HEADER), 1, fp) != 1 || 0 != memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC))) {
+        printf("The file is not a saved Neural Network\n");
+        fclose(fp);
+        return 1;
+    }
+    if (FILE_VERSION != header.version || sizeof(PRIVATE) != header.structure) {
+        printf("The file has another format (version %lu), save the Neural Network again\n", header.version);
         fclose(fp);
         return 1;
     }
 
-    fseek(fp, 0, SEEK_SET);
+    if (fread(&Prvt, sizeof(PRIVATE), 1, fp) != 1 || sizeof(PRIVATE) >= Prvt.structureSize) {
+        printf("Unsuccessful file reading (1)\n");
+        fclose(fp);
+        return 1;
+    }
 
     prvt = (p_PRIVATE)malloc(Prvt.structureSize);
     if (NULL == prvt) {
@@ -619,41 +4484,52 @@ int CNNFW_LoadFromFile(N_NET *NNetwork, const char *fileName) {
         printf("unsuccessful memory allocation\n");
         return 1;
     }
-    if (fread(prvt, Prvt.structureSize, 1, fp) != 1) {
+    memcpy(prvt, &Prvt, sizeof(PRIVATE));
+    if (fread((char *)prvt + sizeof(PRIVATE), Prvt.structureSize - sizeof(PRIVATE), 1, fp) != 1) {
         printf("Unsuccessful file reading (2)\n");
         free(prvt);
         fclose(fp);
         return 1;
     }
-    fclose(fp);
-
-    prvt->Inps.inputs = (double *)(prvt + 1);
-
-    prvt->Lays = (p_LAYER)(prvt->Inps.inputs + prvt->Inps.inpLen);
-    for (lay = 0; lay < prvt->layLen; lay++) {
-        if (0 == lay)
-            prvt->Lays[0].neurons = (p_NEURON)(prvt->Lays + prvt->layLen);
-        else
-            prvt->Lays[lay].neurons = prvt->Lays[lay - 1].neurons + prvt->Lays[lay - 1].neuLen;
-    }
 
-    for (lay = 0; lay < prvt->layLen; lay++) {
-        for (neu = 0; neu < prvt->Lays[lay].neuLen; neu++) {
-            if (0 == lay && 0 == neu)
-                prvt->Lays[0].neurons[0].weights = (double *)(prvt->Lays[prvt->layLen - 1].neurons + prvt->Lays[prvt->layLen - 1].neuLen);
-            else if (0 == neu)
-                prvt->Lays[lay].neurons[0].weights = (double *)(prvt->Lays[lay - 1].neurons[prvt->Lays[lay - 1].neuLen - 1].weights + prvt->Lays[lay - 1].neurons[prvt->Lays[lay - 1].neuLen - 1].weiLen);
-            else
-                prvt->Lays[lay].neurons[neu].weights = (double *)(prvt->Lays[lay].neurons[neu - 1].weights + prvt->Lays[lay].neurons[neu - 1].weiLen);
+    prvt->Data.set = NULL;
+    prvt->Data.data = NULL;
+    prvt->Data.version = 0;
+    if (0 < prvt->Data.rows) {
+        prvt->Data.set = set_create(prvt->Data.rows, prvt->Data.cols);
+        if (NULL == prvt->Data.set) {
+            free(prvt);
+            fclose(fp);
+            return 1;
+        }
+        prvt->Data.data = prvt->Data.set->data;
+        if (fread(prvt->Data.data, sizeof(double) * prvt->Data.cols, prvt->Data.rows, fp) != prvt->Data.rows) {
+            printf("Unsuccessful file reading (3)\n");
+            set_release(prvt->Data.set);
+            free(prvt);
+            fclose(fp);
+            return 1;
         }
     }
+    fclose(fp);
 
-    prvt->Data.data = (double **)(prvt->Lays[prvt->layLen - 1].neurons[prvt->Lays[prvt->layLen - 1].neuLen - 1].weights + prvt->Lays[prvt->layLen - 1].neurons[prvt->Lays[prvt->layLen - 1].neuLen - 1].weiLen);
+    link_structure(prvt, NULL);
 
-    for (i = 0; i < prvt->Data.rows; i++)
-        prvt->Data.data[i] = (double *)(prvt->Data.data + prvt->Data.rows) + i * prvt->Data.cols;
+    /* The tuned kernels belong to the machine which has saved the file */
+    prvt->tileRows = ROWS_TILE;
+    for (lay = 0; lay < prvt->layLen; lay++)
+        prvt->Lays[lay].kernel = KERNEL_AUTO;
 
     prvt->isChanged = 0;
+    prvt->prof = NULL;
+    prvt->ws = NULL;
+    prvt->acts = NULL;
+    prvt->sparseInps = NULL;
+    prvt->sparseData = NULL;
+    prvt->online = NULL;
+    prvt->lazy = NULL;
+    prvt->lbfgs = NULL;
+    prvt->mapped = 0;
 
     *NNetwork = (N_NET)prvt;
 
@@ -663,8 +4539,459 @@ int CNNFW_LoadFromFile(N_NET *NNetwork, const char *fileName) {
 void CNNFW_Free(N_NET *NNetwork) {
     if (NULL != NNetwork) {
         if (NULL != *NNetwork) {
-            free(*NNetwork);
+            CNNFW_SetProfiling(*NNetwork, DISABLE, DISABLE);
+            free(((p_PRIVATE)*NNetwork)->ws);
+            free(((p_PRIVATE)*NNetwork)->acts);
+            sparse_release(((p_PRIVATE)*NNetwork)->sparseInps);
+            sparse_release(((p_PRIVATE)*NNetwork)->sparseData);
+            free(((p_PRIVATE)*NNetwork)->online);
+            free(((p_PRIVATE)*NNetwork)->lazy);
+            free(((p_PRIVATE)*NNetwork)->lbfgs);
+            set_release(((p_PRIVATE)*NNetwork)->Data.set);
+            memory_free(*NNetwork, ((p_PRIVATE)*NNetwork)->mapped);
             *NNetwork = NULL;
         }
     }
-}
\ No newline at end of file
+}
+
+int CNNFW_Clone(N_NET *NNdst, N_NET NNsrc) {
+    p_PRIVATE prvtSrc = (p_PRIVATE)NNsrc;
+    p_PRIVATE prvt = NULL;
+
+    if (NULL == NNdst || NULL == prvtSrc) {
+        printf("A neural network object cannot be NULL\n");
+        return 1;
+    }
+    if (NULL != *NNdst) {
+        printf("The destination Neural Network object is not NULL\n");
+        return 1;
+    }
+
+    prvt = (p_PRIVATE)malloc(prvtSrc->structureSize);
+    if (NULL == prvt) {
+        printf("Unsuccessful memory allocation\n");
+        return 1;
+    }
+    memcpy(prvt, prvtSrc, prvtSrc->structureSize);
+
+    link_structure(prvt, NULL);
+
+    /* The clone shares the training data, a borrowed buffer stays borrowed */
+    if (NULL != prvt->Data.set)
+        ATOMIC_ADD(&prvt->Data.set->refs, 1);
+    if (NULL != prvt->sparseData)
+        ATOMIC_ADD(&prvt->sparseData->refs, 1);
+    prvt->prof = NULL;
+    prvt->ws = NULL;
+    prvt->acts = NULL;
+    prvt->sparseInps = NULL;
+    prvt->online = NULL;
+    prvt->lazy = NULL;
+    prvt->lbfgs = NULL;
+    prvt->mapped = 0;
+
+    *NNdst = (N_NET)prvt;
+
+    return 0;
+}
+
+int CNNFW_CreateData(DATASET *Data, DATA_ROWS rows, DATA_COLS cols) {
+    if (NULL == Data) {
+        printf("A pointer to a data object is NULL\n");
+        return 1;
+    }
+    if (NULL != *Data) {
+        printf("The data object is not NULL\n");
+        return 1;
+    }
+    if (1 > rows || 1 > cols) {
+        printf("The data must contain at least one row and one column\n");
+        return 1;
+    }
+
+    *Data = (DATASET)set_create(rows, cols);
+
+    return (NULL == *Data) ? 1 : 0;
+}
+
+int CNNFW_SetDatasetRows(DATASET Data, DATA_ROWS firstRow, DATA_ROWS rowsCount, const double *buffer) {
+    p_SET set = (p_SET)Data;
+
+    if (NULL == set) {
+        printf("Data object is NULL\n");
+        return 1;
+    }
+    if (NULL == buffer) {
+        printf("The pointer to the buffer with rows is NULL\n");
+        return 1;
+    }
+    if (set->rows < firstRow || set->rows - firstRow < rowsCount) {
+        printf("Row range out of range\n");
+        return 1;
+    }
+    if (set->refs > 1) {
+        printf("The data is shared with Neural Networks and cannot be changed\n");
+        return 1;
+    }
+
+    memcpy(set->data + firstRow * set->cols, buffer, sizeof(double) * rowsCount * set->cols);
+
+    return 0;
+}
+
+int CNNFW_SetValueInDataset(DATASET Data, DATA_ROWS rowIndex, DATA_COLS colIndex, double value) {
+    p_SET set = (p_SET)Data;
+
+    if (NULL == set) {
+        printf("Data object is NULL\n");
+        return 1;
+    }
+    if (set->rows <= rowIndex) {
+        printf("Row index out of range\n");
+        return 1;
+    }
+    if (set->cols <= colIndex) {
+        printf("Column index out of range\n");
+        return 1;
+    }
+    if (set->refs > 1) {
+        printf("The data is shared with Neural Networks and cannot be changed\n");
+        return 1;
+    }
+
+    set->data[rowIndex * set->cols + colIndex] = value;
+
+    return 0;
+}
+
+int CNNFW_AttachData(N_NET NNetwork, DATASET Data) {
+    p_PRIVATE prvt = (p_PRIVATE)NNetwork;
+    p_SET set = (p_SET)Data;
+
+    if (NULL == prvt) {
+        printf("Neural network is NULL\n");
+        return 1;
+    }
+    if (NULL == set) {
+        printf("Data object is NULL\n");
+        return 1;
+    }
+    if (set->cols != prvt->Data.cols) {
+        printf("The number of data columns is not equal to the number of inputs plus the number of outputs\n");
+        return 1;
+    }
+
+    data_attach(prvt, set);
+
+    return 0;
+}
+
+void CNNFW_FreeData(DATASET *Data) {
+    if (NULL != Data) {
+        set_release((p_SET)*Data);
+        *Data = NULL;
+    }
+}
+
+#if !defined(_WIN32)
+
+/* Waits until all the processes of the group reach the barrier */
+static void group_barrier(p_GROUP_MEMORY grp) {
+    long generation = ATOMIC_LOAD(&grp->generation);
+
+    if ((long)grp->processes == ATOMIC_ADD(&grp->arrived, 1)) {
+        ATOMIC_STORE(&grp->arrived, 0);
+        ATOMIC_ADD(&grp->generation, 1);
+    } else {
+        while (generation == ATOMIC_LOAD(&grp->generation))
+            sched_yield();
+    }
+}
+
+static size_t group_bytes(size_t processes, size_t length) {
+    return sizeof(GROUP_MEMORY) + sizeof(double) * length * (processes + 1);
+}
+
+int CNNFW_CreateGroup(GROUP *Group, size_t processes, size_t length) {
+    p_GROUP_MEMORY grp;
+
+    if (NULL == Group) {
+        printf("A pointer to a group object is NULL\n");
+        return 1;
+    }
+    if (NULL != *Group) {
+        printf("The group object is not NULL\n");
+        return 1;
+    }
+    if (1 > processes || 1 > length) {
+        printf("The number of processes and the length of the buffers cannot be less than 1\n");
+        return 1;
+    }
+
+    grp = (p_GROUP_MEMORY)mmap(NULL, group_bytes(processes, length), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == (void *)grp) {
+        printf("Unsuccessful shared memory allocation\n");
+        return 1;
+    }
+
+    grp->processes = processes;
+    grp->length = length;
+    grp->arrived = 0;
+    grp->generation = 0;
+    grp->buffers = (double *)(grp + 1);
+    grp->sum = grp->buffers + processes * length;
+
+    *Group = (GROUP)grp;
+
+    return 0;
+}
+
+int CNNFW_AllReduce(GROUP Group, size_t rank, double *buffer) {
+    size_t i, r, chunk, first, last;
+    double acc;
+    p_GROUP_MEMORY grp = (p_GROUP_MEMORY)Group;
+
+    if (NULL == grp) {
+        printf("The group is NULL\n");
+        return 1;
+    }
+    if (NULL == buffer) {
+        printf("The pointer to the buffer cannot be NULL\n");
+        return 1;
+    }
+    if (rank >= grp->processes) {
+        printf("The rank is out of range of the group\n");
+        return 1;
+    }
+
+    memcpy(grp->buffers + rank * grp->length, buffer, sizeof(double) * grp->length);
+    group_barrier(grp);
+
+    /* Reduce-scatter: each rank sums its own part of the buffers, always in the order of
+    * the ranks, so the result does not depend on the timing of the processes */
+    chunk = (grp->length + grp->processes - 1) / grp->processes;
+    first = rank * chunk < grp->length ? rank * chunk : grp->length;
+    last = first + chunk < grp->length ? first + chunk : grp->length;
+    for (i = first; i < last; i++) {
+        acc = grp->buffers[i];
+        for (r = 1; r < grp->processes; r++)
+            acc += grp->buffers[r * grp->length + i];
+        grp->sum[i] = acc;
+    }
+    group_barrier(grp);
+
+    /* All-gather. The next call writes the sum only after the first barrier, when all the
+    * processes have already taken it */
+    memcpy(buffer, grp->sum, sizeof(double) * grp->length);
+
+    return 0;
+}
+
+void CNNFW_FreeGroup(GROUP *Group) {
+    p_GROUP_MEMORY grp;
+
+    if (NULL != Group && NULL != *Group) {
+        grp = (p_GROUP_MEMORY)*Group;
+        munmap((void *)grp, group_bytes(grp->processes, grp->length));
+        *Group = NULL;
+    }
+}
+
+#else
+
+int CNNFW_CreateGroup(GROUP *Group, size_t processes, size_t length) {
+    (void)Group;
+    (void)processes;
+    (void)length;
+    printf("Groups of processes are supported only on POSIX systems\n");
+    return 1;
+}
+
+int CNNFW_AllReduce(GROUP Group, size_t rank, double *buffer) {
+    (void)Group;
+    (void)rank;
+    (void)buffer;
+    printf("Groups of processes are supported only on POSIX systems\n");
+    return 1;
+}
+
+void CNNFW_FreeGroup(GROUP *Group) {
+    (void)Group;
+}
+
+#endif
+
+static void *search_worker(void *arg) {
+    SEARCH_ROUND *round = (SEARCH_ROUND *)arg;
+    SEARCH_TRIAL *trial;
+    p_PRIVATE prvt;
+    size_t i;
+
+    for (;;) {
+        i = (size_t)(ATOMIC_ADD(&round->next, 1) - 1);
+        if (i >= round->count) break;
+        trial = round->order[i];
+        prvt = (p_PRIVATE)trial->net;
+
+        for (; trial->epochs < round->epochs && !trial->failed; trial->epochs++)
+            if (CNNFW_Train(trial->net)) trial->failed = 1;
+
+        if (!trial->failed) {
+            if (NULL != round->validation)
+                trial->failed = rows_loss(prvt, round->validation->data, round->validation->rows, &trial->loss);
+            else
+                trial->failed = rows_loss(prvt, prvt->Data.data, prvt->Data.rows, &trial->loss);
+        }
+        /* A diverged trial: the loss is infinite or not a number */
+        if (!trial->failed && !(trial->loss - trial->loss == 0.0))
+            trial->failed = 1;
+    }
+
+    return NULL;
+}
+
+/* The stopped trials go after the others, the rest by the loss */
+static int search_compare(const void *a, const void *b) {
+    const SEARCH_TRIAL *x = *(SEARCH_TRIAL *const *)a;
+    const SEARCH_TRIAL *y = *(SEARCH_TRIAL *const *)b;
+    if (x->failed != y->failed) return x->failed - y->failed;
+    if (x->failed) return 0;
+    return (x->loss < y->loss) ? -1 : (x->loss > y->loss) ? 1 : 0;
+}
+
+/* Trains the trials of the round by threads threads, the calling thread is one of them */
+static void search_round(SEARCH_ROUND *round, THREAD *threads, size_t count) {
+    size_t i, started;
+
+    round->next = 0;
+    for (started = 1; started < count && started < round->count; started++) {
+        if (thread_start(&threads[started], search_worker, round)) {
+            printf("Unsuccessful thread creation, %lu threads are used\n", (unsigned long)started);
+            break;
+        }
+    }
+    search_worker(round);
+    for (i = 1; i < started; i++)
+        thread_join(&threads[i]);
+}
+
+int CNNFW_Search(DATASET Data, DATASET Validation, const SEARCH_SPACE *space, const SEARCH_OPTIONS *options,
+    N_NET *Best, SEARCH_RESULT *result) {
+    size_t i, k, combinations, count, rounds, budget, r, ci, ei, si, ai;
+    int status = 0;
+    p_SET set = (p_SET)Data, validation = (p_SET)Validation;
+    SEARCH_TRIAL *trials = NULL, *best;
+    SEARCH_ROUND round;
+    THREAD *threads = NULL;
+
+    if (NULL == set || NULL == space || NULL == options) {
+        printf("The data, the search space and the options cannot be NULL\n");
+        return 1;
+    }
+    if (NULL != Best && NULL != *Best) {
+        printf("The Neural Network object for the best trial is not NULL\n");
+        return 1;
+    }
+    if (0 == space->configsCount || 0 == options->threads || 0 == options->epochs ||
+        (SEARCH_RANDOM == options->mode && 0 == options->trials)) {
+        printf("The search needs at least one configuration, trial, thread and epoch\n");
+        return 1;
+    }
+    if (NULL != validation && validation->cols != set->cols) {
+        printf("The validation data has a different number of columns\n");
+        return 1;
+    }
+
+    /* The empty lists of the values mean the values by default */
+    combinations = space->configsCount * (space->epsCount ? space->epsCount : 1) *
+        (space->stepsCount ? space->stepsCount : 1) * (space->actFuncsCount ? space->actFuncsCount : 1);
+    count = (SEARCH_GRID == options->mode) ? combinations : options->trials;
+
+    trials = (SEARCH_TRIAL *)calloc(count, sizeof(SEARCH_TRIAL));
+    round.order = (SEARCH_TRIAL **)malloc(sizeof(SEARCH_TRIAL *) * count);
+    threads = (THREAD *)malloc(sizeof(THREAD) * options->threads);
+    if (NULL == trials || NULL == round.order || NULL == threads) {
+        printf("Unsuccessful memory allocation\n");
+        free(trials);
+        free(round.order);
+        free(threads);
+        return 1;
+    }
+
+    /* The Neural Networks are created here, so that their weights depend only on the seed of rand */
+    for (i = 0; i < count && 0 == status; i++) {
+        k = (SEARCH_GRID == options->mode) ? i : (size_t)rand() % combinations;
+        ci = k % space->configsCount;
+        k /= space->configsCount;
+        ei = space->epsCount ? k % space->epsCount : 0;
+        k /= space->epsCount ? space->epsCount : 1;
+        si = space->stepsCount ? k % space->stepsCount : 0;
+        k /= space->stepsCount ? space->stepsCount : 1;
+        ai = space->actFuncsCount ? k % space->actFuncsCount : 0;
+
+        trials[i].config = ci;
+        trials[i].eps = space->epsCount ? space->eps[ei] : 0.01;
+        trials[i].step = space->stepsCount ? space->steps[si] : 0.01;
+        trials[i].actFunc = space->actFuncsCount ? space->actFuncs[ai] : ENABLE;
+        status = create(&trials[i].net, (CONFIG *)space->configs[ci], space->configSizes[ci], 0) ||
+            CNNFW_AttachData(trials[i].net, Data) ||
+            CNNFW_SetEpsilonAndLearningStep(trials[i].net, trials[i].eps, trials[i].step) ||
+            CNNFW_SetActivationFunction(trials[i].net, trials[i].actFunc) ||
+            CNNFW_SetTrainingMethod(trials[i].net, options->method);
+        round.order[i] = &trials[i];
+    }
+
+    /* Each round keeps the best 1/eta of the trials, the last one trains a single trial to the end */
+    rounds = 1;
+    if (options->eta > 1)
+        for (k = count; k > 1; k = (k + options->eta - 1) / options->eta)
+            rounds++;
+
+    round.validation = validation;
+    round.count = count;
+    for (r = 0; r < rounds && 0 == status; r++) {
+        for (budget = options->epochs, k = r + 1; k < rounds; k++)
+            budget /= options->eta;
+        round.epochs = (0 < budget) ? budget : 1;
+        search_round(&round, threads, options->threads);
+
+        qsort(round.order, round.count, sizeof(SEARCH_TRIAL *), search_compare);
+        while (0 < round.count && round.order[round.count - 1]->failed)
+            round.count--;
+        if (0 == round.count) {
+            printf("All the trials of the search diverged\n");
+            status = 1;
+        } else if (r + 1 < rounds) {
+            round.count = (round.count + options->eta - 1) / options->eta;
+        }
+    }
+
+    if (0 == status) {
+        best = round.order[0];
+        if (NULL != options->fileName)
+            status = CNNFW_SaveToFile(best->net, options->fileName);
+        if (NULL != result) {
+            result->trials = count;
+            result->stopped = 0;
+            for (i = 0; i < count; i++)
+                if (trials[i].failed || trials[i].epochs < options->epochs) result->stopped++;
+            result->config = best->config;
+            result->eps = best->eps;
+            result->step = best->step;
+            result->actFunc = best->actFunc;
+            result->loss = best->loss;
+        }
+        if (NULL != Best) {
+            *Best = best->net;
+            best->net = NULL;
+        }
+    }
+
+    for (i = 0; i < count; i++)
+        CNNFW_Free(&trials[i].net);
+    free(trials);
+    free(round.order);
+    free(threads);
+
+    return status;
+}